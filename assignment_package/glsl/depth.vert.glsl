@@ -3,8 +3,28 @@
 
 in vec4 vs_Pos;
 uniform mat4 u_Model;
-uniform mat4 u_ViewProj;
+// The shadow cascade to draw from the light for, or -1 to draw from the
+// camera
+uniform int u_Cascade;
+
+// Shared by the terrain shaders and updated once a frame, see
+// PerFrameUniforms in shaderprogram.h
+layout(std140) uniform PerFrame {
+    mat4 u_ViewProj;
+    mat4 u_Cascades[4]; // ShadowCascades::MAX_CASCADES
+    vec3 u_LightDirection;
+    float u_height;
+    vec3 u_CameraPos;
+    int u_Time;
+    vec2 u_ScreenSize;
+    int u_CascadeCount;
+};
+
+// The main pass tests its depth against this one's, so both must come out
+// of the same sums bit for bit
+invariant gl_Position;
 
 void main() {
-    gl_Position = u_ViewProj * u_Model * vs_Pos;
+    mat4 viewProj = u_Cascade >= 0 ? u_Cascades[u_Cascade] : u_ViewProj;
+    gl_Position = viewProj * (u_Model * vs_Pos);
 }
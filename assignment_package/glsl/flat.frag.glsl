@@ -4,20 +4,27 @@
 // Refer to the lambert shader files for useful comments
 uniform sampler2D u_Texture;
 uniform sampler2D u_DepthTexture;
-uniform sampler2D u_ShadowMappingDepth;
-uniform vec2 u_ScreenSize;
-uniform int u_Time;
-uniform vec3 u_CameraPos;
+uniform sampler2DArray u_ShadowMappingDepth; // a layer per cascade
 uniform mat4 u_Model;
-uniform mat4 u_ViewProj;
 uniform mat4 u_ModelInvTr;
-uniform vec3 u_LightDirection;
-uniform float u_height;
+
+// Shared by the terrain shaders and updated once a frame, see
+// PerFrameUniforms in shaderprogram.h
+layout(std140) uniform PerFrame {
+    mat4 u_ViewProj;
+    mat4 u_Cascades[4]; // ShadowCascades::MAX_CASCADES
+    vec3 u_LightDirection;
+    float u_height;
+    vec3 u_CameraPos;
+    int u_Time;
+    vec2 u_ScreenSize;
+    int u_CascadeCount;
+};
 
 in vec3 fs_UV;
 in vec3 fs_Nor;
 in vec3 fs_Pos;
-in vec4 fs_PosLightSpace;
+in vec3 fs_ShadowPos;
 
 out vec4 out_Col;
 
@@ -27,12 +34,24 @@ const float u_FogStart = 210.0;
 const float u_FogEnd = 230.0;
 
 
-float ShadowCalculation(vec4 fragPosLightSpace)
+float ShadowCalculation(vec3 shadowPos)
 {
-    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-    projCoords = projCoords * 0.5 + 0.5;
+    // Use the nearest cascade, which has the most detail, that the point
+    // is inside of, with room for the PCF around it
+    vec2 texelSize = 1.0 / textureSize(u_ShadowMappingDepth, 0).xy;
+    int cascade = -1;
+    vec3 projCoords = vec3(0.0);
+    for (int i = 0; i < u_CascadeCount; i++) {
+        vec4 fragPosLightSpace = u_Cascades[i] * vec4(shadowPos, 1.0);
+        projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+        if (all(greaterThan(projCoords.xy, texelSize)) && all(lessThan(projCoords.xy, 1.0 - texelSize))) {
+            cascade = i;
+            break;
+        }
+    }
 
-    float closestDepth = texture(u_ShadowMappingDepth, projCoords.xy).r;
+    // outside of every shadow map counts as lit
+    float closestDepth = cascade >= 0 ? texture(u_ShadowMappingDepth, vec3(projCoords.xy, cascade)).r : 1.0;
     float currentDepth = projCoords.z;
 
     // add larger bias when the face is more verticle to sunlight
@@ -41,26 +60,31 @@ float ShadowCalculation(vec4 fragPosLightSpace)
     float dot_value = dot(normalize(fs_Nor), normalize(u_LightDirection));
     float abs_dot_value = abs(dot_value);  // take the abs so that opposite face should also have no bias
     float bias = max(min_bias, max_bias * (1 - abs_dot_value));
+    // The far cascades have bigger texels than the single map these were
+    // tuned for had at its widest, 0.04 blocks, so need more
+    if (cascade >= 0) {
+        vec3 lightRight = vec3(u_Cascades[cascade][0][0], u_Cascades[cascade][1][0], u_Cascades[cascade][2][0]);
+        float texelBlocks = 2.0 * texelSize.x / length(lightRight);
+        bias *= max(1.0, texelBlocks / 0.04);
+    }
 
 
     float shadow = 0.0;
     if (dot_value < -0.000001)  // self shadow, always 1
         shadow = 1.0;
-    else if (projCoords.x < 0 || projCoords.x > 1 || projCoords.y < 0 || projCoords.y > 1)
-        {} // do not render shadow if it is out of the shadow depth map
+    else if (cascade < 0)
+        {} // do not render shadow if it is out of the shadow depth maps
     else if (abs_dot_value < -0.000001)
         {}   // the plane is too vertical to generate shadow
     else if (u_height > 10.f)  // if u_height > 20, no need to use PCF, just normal shadow mapping
         shadow = currentDepth - bias > closestDepth ? 1.f : 0.f;
     else {
         // player is close to the scene, then need to soft the shadow with its neighbours
-        vec2 texelSize = 1.0 / textureSize(u_ShadowMappingDepth, 0);
-
         for(int x = -1; x <= 1; ++x)
         {
             for(int y = -1; y <= 1; ++y)
             {
-                float pcfDepth = texture(u_ShadowMappingDepth, projCoords.xy + vec2(x, y) * texelSize).r;
+                float pcfDepth = texture(u_ShadowMappingDepth, vec3(projCoords.xy + vec2(x, y) * texelSize, cascade)).r;
                 shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
             }
         }
@@ -282,7 +306,7 @@ void main()
     float lightIntensity = clamp(ambientTerm + diffuseTerm, 0, 1);
 
     // add shadow
-    float shadow = ShadowCalculation(fs_PosLightSpace);
+    float shadow = ShadowCalculation(fs_ShadowPos);
     //float shadow = 0;
     vec3 pure_color = (1 - shadow) * diffuseColor.rgb * lightIntensity;
 
@@ -4,10 +4,20 @@
 // Refer to the lambert shader files for useful comments
 
 uniform mat4 u_Model;
-uniform mat4 u_ViewProj;
 uniform mat4 u_ModelInvTr;
-uniform mat4 u_LightSpaceMatrix;
-uniform int u_Time;
+
+// Shared by the terrain shaders and updated once a frame, see
+// PerFrameUniforms in shaderprogram.h
+layout(std140) uniform PerFrame {
+    mat4 u_ViewProj;
+    mat4 u_Cascades[4]; // ShadowCascades::MAX_CASCADES
+    vec3 u_LightDirection;
+    float u_height;
+    vec3 u_CameraPos;
+    int u_Time;
+    vec2 u_ScreenSize;
+    int u_CascadeCount;
+};
 
 in vec4 vs_Pos;
 in vec4 vs_Nor;
@@ -16,7 +26,9 @@ in vec4 vs_UV;
 out vec3 fs_UV;
 out vec3 fs_Nor;
 out vec3 fs_Pos;
-out vec4 fs_PosLightSpace;
+out vec3 fs_ShadowPos; // in the world, waves and all, to look up in the shadow maps
+// Tested against the depth prepass, see depth.vert.glsl
+invariant gl_Position;
 
 void main()
 {
@@ -38,7 +50,7 @@ void main()
     vec4 worldPos = u_Model * vs_Pos;
     fs_Pos = worldPos.xyz;
 
-    fs_PosLightSpace = u_LightSpaceMatrix * modelposition;
+    fs_ShadowPos = modelposition.xyz;
 
     //built-in things to pass down the pipeline
     gl_Position = u_ViewProj * modelposition;
@@ -47,6 +47,15 @@ address_sanitizer {
     QMAKE_CXXFLAGS += -fsanitize=address
     QMAKE_LFLAGS += -fsanitize=address
 }
+# Likewise for Thread Sanitizer (TSAN), which reports data races between
+# the GUI thread and the terrain workers. Build with
+# `qmake CONFIG+=thread_sanitizer` and press B in game to run the
+# chunk directory stress test. It cannot be combined with ASAN.
+thread_sanitizer {
+    message("Enabling Thread Sanitizer")
+    QMAKE_CXXFLAGS += -fsanitize=thread
+    QMAKE_LFLAGS += -fsanitize=thread
+}
 
 HEADERS +=
 
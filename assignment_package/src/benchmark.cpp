@@ -0,0 +1,961 @@
+#include "benchmark.h"
+#include "scene/blockaccessor.h"
+#include "scene/regionfile.h"
+#include <chrono>
+#include <climits>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <QThread>
+#include <QThreadPool>
+#include <QTemporaryDir>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double msSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Every benchmark world has the same seed, so that runs compare
+constexpr uint32_t BENCH_SEED = 26;
+
+// Makes dir the save directory of a new world with BENCH_SEED, for a
+// Terrain of a benchmark's own, which must never open the player's save
+QString benchWorldDirectory(const QTemporaryDir &dir) {
+    RegionStore(dir.path()).worldSeed(BENCH_SEED);
+    return dir.path();
+}
+
+// Chunks whose block data has been generated. Generation always
+// starts from a STONE floor, the same check Terrain uses.
+std::vector<const Chunk*> generatedChunks(const Terrain &terrain) {
+    std::vector<const Chunk*> chunks;
+    terrain.m_chunks.forEach([&chunks](int64_t, const Chunk *c) {
+        if (c->getBlockAt(0, 0, 0) == STONE) {
+            chunks.push_back(c);
+        }
+    });
+    return chunks;
+}
+
+// The lookup Terrain::getBlockAt did before ChunkGrid:
+// float floor, then a chunk map lookup, for every block
+BlockType mapGetBlockAt(const Terrain &terrain, int x, int y, int z) {
+    int xFloor = static_cast<int>(glm::floor(x / 16.f));
+    int zFloor = static_cast<int>(glm::floor(z / 16.f));
+    const Chunk *c = terrain.m_chunks.find(toKey(16 * xFloor, 16 * zFloor));
+    if (c == nullptr) {
+        throw std::out_of_range("no Chunk");
+    }
+    return c->getBlockAt(x - 16 * xFloor, y, z - 16 * zFloor);
+}
+
+// Chunks MyGL would draw around a player at pos, in front of them, that
+// have no mesh yet and so show up as holes
+int missingChunksInView(const Terrain &terrain, glm::vec3 pos, glm::vec3 look) {
+    int x = static_cast<int>(glm::floor(pos.x / 16.f) * 16);
+    int z = static_cast<int>(glm::floor(pos.z / 16.f) * 16);
+    int drawBlockSize = (terrain.zoneRadius - 1) * 64;
+    int missing = 0;
+    for (int cx = x - drawBlockSize; cx < x + drawBlockSize; cx += 16) {
+        for (int cz = z - drawBlockSize; cz < z + drawBlockSize; cz += 16) {
+            glm::vec2 toChunk(cx + 8 - pos.x, cz + 8 - pos.z);
+            if (glm::dot(toChunk, glm::vec2(look.x, look.z)) <= 0.f) {
+                continue;
+            }
+            const Chunk *c = terrain.findChunk(cx, cz);
+            if (c == nullptr || !c->hasMesh()) {
+                missing++;
+            }
+        }
+    }
+    return missing;
+}
+
+// One chunk's mesh in buffers of its own, drawn with a draw call per
+// pass the way every chunk was before MeshArena
+class SeparateMesh : public Drawable {
+public:
+    SeparateMesh(OpenGLContext *context, const ChunkOpaqueTransparentVBOData &mesh)
+        : Drawable(context)
+    {
+        upload(mesh.m_vboDataOpaque, true);
+        upload(mesh.m_vboDataTransparent, false);
+    }
+    ~SeparateMesh() override { destroyVBOdata(); }
+    void createVBOdata() override {}
+
+private:
+    void upload(const std::vector<glm::vec4> &vertices, bool opaque) {
+        int faces = static_cast<int>(vertices.size() / 12);
+        std::vector<GLuint> indices;
+        for (GLuint i = 0; i < static_cast<GLuint>(faces); i++) {
+            for (GLuint corner : {0u, 1u, 2u, 0u, 2u, 3u}) {
+                indices.push_back(4 * i + corner);
+            }
+        }
+        if (opaque) {
+            generateIdxOpq();
+            generateDataOpq();
+            bindIdxOpq();
+            bindDataOpq();
+            m_countOpq = static_cast<int>(indices.size());
+        } else {
+            generateIdxTra();
+            generateDataTra();
+            bindIdxTra();
+            bindDataTra();
+            m_countTra = static_cast<int>(indices.size());
+        }
+        mp_context->glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+        mp_context->glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec4), vertices.data(), GL_STATIC_DRAW);
+    }
+};
+
+} // namespace
+
+void Benchmark::faceMasks(const Terrain &terrain)
+{
+    std::vector<const Chunk*> chunks = generatedChunks(terrain);
+    if (chunks.empty()) {
+        std::cout << "[bench] face masks: no generated chunks" << std::endl;
+        return;
+    }
+
+    long long referenceFaces = 0;
+    Clock::time_point start = Clock::now();
+    for (const Chunk *c : chunks) {
+        for (int x = 0; x < 16; x++)
+            for (int y = 0; y < 256; y++)
+                for (int z = 0; z < 16; z++)
+                    referenceFaces += popCount(c->is_boundary(x, y, z));
+    }
+    double referenceMs = msSince(start);
+
+    uPtr<ChunkSnapshot> snapshot = mkU<ChunkSnapshot>();
+    uPtr<ChunkFaceMasks> masks = mkU<ChunkFaceMasks>();
+    long long maskFaces = 0;
+    double captureMs = 0;
+    start = Clock::now();
+    for (const Chunk *c : chunks) {
+        Clock::time_point captureStart = Clock::now();
+        snapshot->capture(*c);
+        captureMs += msSince(captureStart);
+        masks->compute(*snapshot);
+        maskFaces += masks->faceCount();
+    }
+    double maskMs = msSince(start);
+
+    std::cout << "[bench] face masks over " << chunks.size() << " chunks: "
+              << "is_boundary " << referenceMs / chunks.size() << " ms/chunk, "
+              << "bitmask " << maskMs / chunks.size() << " ms/chunk ("
+              << referenceMs / std::max(maskMs, 1e-6) << "x, of which snapshot "
+              << captureMs / chunks.size() << " ms), "
+              << "faces " << referenceFaces << " / " << maskFaces
+              << (referenceFaces == maskFaces ? "" : "  MISMATCH") << std::endl;
+}
+
+void Benchmark::meshing(const Terrain &terrain)
+{
+    std::vector<const Chunk*> chunks = generatedChunks(terrain);
+    if (chunks.empty()) {
+        std::cout << "[bench] meshing: no generated chunks" << std::endl;
+        return;
+    }
+
+    // What the old push_back-only mesher would have done: every vector
+    // starts empty and doubles its way up to its final size
+    auto growthAllocations = [](size_t n) {
+        long long count = 0;
+        for (size_t capacity = 0; capacity < n; capacity = std::max<size_t>(1, capacity * 2)) {
+            count++;
+        }
+        return count;
+    };
+
+    uPtr<ChunkSnapshot> snapshot = mkU<ChunkSnapshot>();
+    long long pushBackAllocations = 0;
+    long long opaqueFaces = 0, shadowFaces = 0;
+    // The first pass fills the pool, the second shows its steady state
+    for (int pass = 0; pass < 2; pass++) {
+        MeshBufferPool::Stats before = MeshBufferPool::stats();
+        Clock::time_point start = Clock::now();
+        for (const Chunk *c : chunks) {
+            snapshot->capture(*c);
+            uPtr<ChunkOpaqueTransparentVBOData> data = MeshBufferPool::acquire(nullptr);
+            c->buildMesh(*snapshot, *data);
+            if (pass == 0) {
+                pushBackAllocations += growthAllocations(data->m_vboDataOpaque.size())
+                                     + growthAllocations(data->m_vboDataTransparent.size())
+                                     + growthAllocations(data->m_vboDataDepth.size())
+                                     + growthAllocations(data->m_vboDataShadow.size());
+                opaqueFaces += data->opaqueFaces();
+                shadowFaces += data->shadowFaces();
+            }
+            MeshBufferPool::release(std::move(data));
+        }
+        double ms = msSince(start);
+        MeshBufferPool::Stats after = MeshBufferPool::stats();
+
+        std::cout << "[bench] meshing pass " << pass + 1 << " over " << chunks.size() << " chunks: "
+                  << ms / chunks.size() << " ms/chunk, "
+                  << double(after.allocations - before.allocations) / chunks.size() << " allocations/chunk, "
+                  << after.created - before.created << " new buffers";
+        if (pass == 0) {
+            std::cout << " (push_back alone: " << double(pushBackAllocations) / chunks.size()
+                      << " allocations/chunk)";
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "[bench] shadow faces: " << shadowFaces << " merged from " << opaqueFaces << " opaque ("
+              << 100.0 * shadowFaces / std::max(1LL, opaqueFaces) << "%); depth-only streams "
+              << MeshArena::POSITION_FACE_BYTES << " bytes/face against " << MeshArena::FACE_BYTES << std::endl;
+}
+
+void Benchmark::blockLookup(const Terrain &terrain)
+{
+    std::vector<const Chunk*> chunks = generatedChunks(terrain);
+    if (chunks.empty()) {
+        std::cout << "[bench] block lookup: no generated chunks" << std::endl;
+        return;
+    }
+
+    // Random blocks anywhere in the loaded world
+    const int QUERIES = 1 << 20;
+    std::mt19937 rng(26);
+    std::vector<glm::ivec3> points(QUERIES);
+    for (glm::ivec3 &p : points) {
+        const Chunk *c = chunks[rng() % chunks.size()];
+        p = glm::ivec3(c->get_minX() + rng() % 16, rng() % 256, c->get_minZ() + rng() % 16);
+    }
+
+    long long mapSum = 0, gridSum = 0;
+    Clock::time_point start = Clock::now();
+    for (const glm::ivec3 &p : points) {
+        mapSum += mapGetBlockAt(terrain, p.x, p.y, p.z);
+    }
+    double mapMs = msSince(start);
+
+    start = Clock::now();
+    for (const glm::ivec3 &p : points) {
+        gridSum += terrain.getBlockAt(p.x, p.y, p.z);
+    }
+    double gridMs = msSince(start);
+
+    std::cout << "[bench] getBlockAt x" << QUERIES << ": "
+              << "hash map " << QUERIES / (mapMs * 1000) << " M/s, "
+              << "chunk grid " << QUERIES / (gridMs * 1000) << " M/s ("
+              << mapMs / std::max(gridMs, 1e-6) << "x)"
+              << (mapSum == gridSum ? "" : "  MISMATCH") << std::endl;
+}
+
+void Benchmark::blockQueries(const Terrain &terrain)
+{
+    std::vector<const Chunk*> chunks = generatedChunks(terrain);
+    if (chunks.empty()) {
+        std::cout << "[bench] block queries: no generated chunks" << std::endl;
+        return;
+    }
+
+    const int QUERIES = 1 << 20;
+    std::mt19937 rng(32);
+
+    // Random: anywhere in the loaded world.
+    // Coherent: short walks through neighboring blocks, like a raycast.
+    std::vector<glm::ivec3> random(QUERIES), coherent(QUERIES);
+    for (glm::ivec3 &p : random) {
+        const Chunk *c = chunks[rng() % chunks.size()];
+        p = glm::ivec3(c->get_minX() + rng() % 16, rng() % 256, c->get_minZ() + rng() % 16);
+    }
+    for (int i = 0; i < QUERIES; i += 64) {
+        const Chunk *c = chunks[rng() % chunks.size()];
+        glm::ivec3 p(c->get_minX() + rng() % 16, 100 + rng() % 56, c->get_minZ() + rng() % 16);
+        for (int j = i; j < i + 64; j++) {
+            coherent[j] = p;
+            p[rng() % 3] += (rng() & 1) ? 1 : -1;
+        }
+    }
+
+    auto run = [&](const char *pattern, const std::vector<glm::ivec3> &points) {
+        long long sums[3] = {0, 0, 0};
+        double ms[3];
+
+        Clock::time_point start = Clock::now();
+        for (const glm::ivec3 &p : points) {
+            try {
+                sums[0] += terrain.getBlockAt(p.x, p.y, p.z);
+            } catch (const std::out_of_range &) {
+                sums[0] -= 1;
+            }
+        }
+        ms[0] = msSince(start);
+
+        start = Clock::now();
+        for (const glm::ivec3 &p : points) {
+            std::optional<BlockType> t = terrain.tryGetBlockAt(p.x, p.y, p.z);
+            sums[1] += t ? *t : -1;
+        }
+        ms[1] = msSince(start);
+
+        start = Clock::now();
+        BlockAccessor blocks(terrain);
+        for (const glm::ivec3 &p : points) {
+            std::optional<BlockType> t = blocks.get(p.x, p.y, p.z);
+            sums[2] += t ? *t : -1;
+        }
+        ms[2] = msSince(start);
+
+        std::cout << "[bench] block queries, " << pattern << " x" << points.size() << ": "
+                  << "getBlockAt " << points.size() / (ms[0] * 1000) << " M/s, "
+                  << "tryGetBlockAt " << points.size() / (ms[1] * 1000) << " M/s, "
+                  << "BlockAccessor " << points.size() / (ms[2] * 1000) << " M/s"
+                  << (sums[0] == sums[1] && sums[1] == sums[2] ? "" : "  MISMATCH") << std::endl;
+    };
+    run("random", random);
+    run("coherent", coherent);
+}
+
+void Benchmark::regions(const Terrain &terrain)
+{
+    std::vector<const Chunk*> chunks = generatedChunks(terrain);
+    if (chunks.empty()) {
+        std::cout << "[bench] regions: no generated chunks" << std::endl;
+        return;
+    }
+    const Chunk *centre = chunks[std::mt19937(33)() % chunks.size()];
+
+    // The writes go to a world of their own, never drawn, with empty
+    // chunks over the biggest box, so the loaded world is left alone
+    QTemporaryDir directory;
+    Terrain scratch(nullptr, benchWorldDirectory(directory));
+    scratch.setAutosaveInterval(0);
+    for (int x = centre->get_minX() - 64; x <= centre->get_minX() + 64; x += 16) {
+        for (int z = centre->get_minZ() - 64; z <= centre->get_minZ() + 64; z += 16) {
+            scratch.instantiateChunkAt(x, z);
+        }
+    }
+    // Every write changes every block, so that none is skipped as
+    // unchanged: odd passes write the blocks read from the world, even
+    // passes, the first among them, something else that is never EMPTY
+    auto written = [](BlockType t, int pass) {
+        return pass % 2 == 1 ? t : (t == STONE ? DIRT : STONE);
+    };
+
+    for (int edge : {8, 32, 128}) {
+        // A cube around the surface, not aligned to chunk borders
+        glm::ivec3 min(centre->get_minX() + 5 - edge / 2, 128 - edge / 2, centre->get_minZ() + 7 - edge / 2);
+        BlockBox box{min, min + glm::ivec3(edge)};
+        // Repeat the small boxes so each timing covers at least 2M blocks
+        int reps = std::max(1, (1 << 21) / box.volume());
+        std::vector<BlockType> perVoxel(box.volume()), bulk;
+        double ms[4];
+
+        Clock::time_point start = Clock::now();
+        for (int r = 0; r < reps; r++) {
+            for (int z = box.min.z; z < box.max.z; z++) {
+                for (int y = box.min.y; y < box.max.y; y++) {
+                    for (int x = box.min.x; x < box.max.x; x++) {
+                        std::optional<BlockType> t = terrain.tryGetBlockAt(x, y, z);
+                        perVoxel[box.indexOf(x, y, z)] = t ? *t : EMPTY;
+                    }
+                }
+            }
+        }
+        ms[0] = msSince(start);
+
+        start = Clock::now();
+        for (int r = 0; r < reps; r++) {
+            terrain.readRegion(box, bulk);
+        }
+        ms[1] = msSince(start);
+
+        // Both passes' blocks up front, so that the timings are of the
+        // writes alone
+        std::vector<BlockType> passes[2] = {bulk, bulk};
+        for (BlockType &t : passes[0]) {
+            t = written(t, 0);
+        }
+
+        start = Clock::now();
+        for (int r = 0; r < reps; r++) {
+            const std::vector<BlockType> &blocks = passes[r % 2];
+            for (int z = box.min.z; z < box.max.z; z++) {
+                for (int y = box.min.y; y < box.max.y; y++) {
+                    for (int x = box.min.x; x < box.max.x; x++) {
+                        scratch.setBlockAt(x, y, z, blocks[box.indexOf(x, y, z)]);
+                    }
+                }
+            }
+        }
+        ms[2] = msSince(start);
+        std::vector<BlockType> check;
+        scratch.readRegion(box, check);
+        bool ok = perVoxel == bulk && check == passes[(reps - 1) % 2];
+
+        // Carry on from where the per-block writes left the blocks
+        size_t remesh = 0;
+        start = Clock::now();
+        for (int r = reps; r < 2 * reps; r++) {
+            remesh += scratch.writeRegion(box, passes[r % 2]).size();
+        }
+        ms[3] = msSince(start);
+        scratch.readRegion(box, check);
+        ok = ok && check == passes[(2 * reps - 1) % 2] && remesh > 0;
+
+        double blocks = double(box.volume()) * reps;
+        std::cout << "[bench] regions, " << edge << "^3 x" << reps << ": "
+                  << "read per block " << blocks / (ms[0] * 1000) << " M/s, "
+                  << "readRegion " << blocks / (ms[1] * 1000) << " M/s; "
+                  << "write per block " << blocks / (ms[2] * 1000) << " M/s, "
+                  << "writeRegion " << blocks / (ms[3] * 1000) << " M/s, "
+                  << static_cast<double>(remesh) / reps << " chunks to remesh per write"
+                  << (ok ? "" : "  MISMATCH") << std::endl;
+    }
+}
+
+void Benchmark::chunkDirectoryStress()
+{
+    // A directory of its own, so the stress test never touches the world.
+    // Worker threads look up random chunks inside guards and read them
+    // while this thread inserts, unloads and reclaims chunks as fast as it
+    // can. Build with CONFIG+=thread_sanitizer to have TSan check it.
+    const int RANGE = 32; // chunk coordinates in [0, RANGE)
+    const int WORKERS = std::max(2, QThread::idealThreadCount() - 1);
+    const double DURATION_MS = 1000;
+
+    ChunkDirectory dir;
+    std::atomic<bool> stop(false);
+    std::atomic<long long> lookups(0), hits(0), corrupt(0);
+
+    std::vector<std::thread> workers;
+    for (int w = 0; w < WORKERS; w++) {
+        workers.emplace_back([&, w]() {
+            std::mt19937 rng(w);
+            long long localLookups = 0, localHits = 0, localCorrupt = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                ChunkDirectory::ReadGuard guard(dir);
+                // A handful of lookups per guard, like one worker job
+                for (int i = 0; i < 8; i++) {
+                    int cx = rng() % RANGE, cz = rng() % RANGE;
+                    const Chunk *c = dir.find(toKey(16 * cx, 16 * cz));
+                    localLookups++;
+                    if (c == nullptr) {
+                        continue;
+                    }
+                    localHits++;
+                    // Freed too early, this reads another chunk or garbage
+                    if (c->get_minX() != 16 * cx || c->get_minZ() != 16 * cz ||
+                        c->getLocalBlockAt(cx & 15, 0, cz & 15) != STONE) {
+                        localCorrupt++;
+                    }
+                }
+            }
+            lookups += localLookups;
+            hits += localHits;
+            corrupt += localCorrupt;
+        });
+    }
+
+    std::mt19937 rng(34);
+    long long inserts = 0, removals = 0, reclaimed = 0;
+    Clock::time_point start = Clock::now();
+    while (msSince(start) < DURATION_MS) {
+        int cx = rng() % RANGE, cz = rng() % RANGE;
+        int64_t key = toKey(16 * cx, 16 * cz);
+        if (dir.find(key) != nullptr) {
+            removals += dir.remove(key);
+        } else {
+            uPtr<Chunk> c = mkU<Chunk>(16 * cx, 16 * cz, nullptr);
+            c->setBlockAt(cx & 15, 0, cz & 15, STONE);
+            dir.insert(key, std::move(c));
+            inserts++;
+        }
+        reclaimed += dir.collect().size();
+    }
+    stop = true;
+    for (std::thread &t : workers) {
+        t.join();
+    }
+    reclaimed += dir.collect().size();
+
+    std::cout << "[bench] chunk directory stress, " << WORKERS << " readers, " << DURATION_MS << " ms: "
+              << lookups / (DURATION_MS * 1000) << " M lookups/s (" << hits << " hits), "
+              << inserts << " inserts, " << removals << " unloads, "
+              << reclaimed << " reclaimed, " << dir.retiredCount() << " left retired"
+              << (corrupt == 0 && reclaimed == removals ? "" : "  FAILED") << std::endl;
+}
+
+void Benchmark::chunkPool()
+{
+    // Fast flight along +x over a strip of zones 11 wide, a zone per step:
+    // each step loads the column of zones ahead and unloads the one
+    // behind. Only chunk creation and unloading is timed, no generation.
+    // The world is a Terrain of its own, and never drawn.
+    const int WIDTH = 11, STEPS = 40;
+    QTemporaryDir directory;
+    Terrain world(nullptr, benchWorldDirectory(directory));
+    auto column = [](int zx, int zz) { return toKey(64 * zx, 64 * zz); };
+
+    Clock::time_point start = Clock::now();
+    for (int step = 0; step < STEPS + WIDTH; step++) {
+        for (int zz = 0; zz < WIDTH; zz++) {
+            for (int x = 0; x < 64; x += 16) {
+                for (int z = 0; z < 64; z += 16) {
+                    world.instantiateChunkAt(64 * step + x, 64 * zz + z);
+                }
+            }
+            if (step >= WIDTH) {
+                world.unloadZone(column(step - WIDTH, zz));
+            }
+        }
+        world.reclaimChunks();
+    }
+    double pooledMs = msSince(start);
+    ChunkPool::Stats stats = world.chunkPoolStats();
+
+    // The same number of chunks through plain new and delete, freeing
+    // each batch like the flight does so the allocator can reuse memory
+    long long chunks = stats.hits + stats.misses;
+    std::vector<uPtr<Chunk>> batch;
+    start = Clock::now();
+    for (long long i = 0; i < chunks; i++) {
+        batch.push_back(mkU<Chunk>(16 * int(i), 0, nullptr));
+        if (batch.size() == WIDTH * 16) {
+            batch.clear();
+        }
+    }
+    double plainMs = msSince(start);
+
+    double avgMiss = stats.misses > 0 ? stats.missMs / stats.misses : 0;
+    std::cout << "[bench] chunk pool, flight of " << chunks << " chunks: "
+              << stats.hits << " hits, " << stats.misses << " misses, "
+              << "acquire " << stats.hitMs * 1000 / std::max(1LL, stats.hits) << " us per hit vs "
+              << avgMiss * 1000 << " us per miss, saved ~" << stats.hits * avgMiss - stats.hitMs << " ms; "
+              << "whole flight " << pooledMs << " ms, new/delete alone " << plainMs << " ms" << std::endl;
+}
+
+void Benchmark::regionFiles(const Terrain &terrain)
+{
+    std::vector<const Chunk*> chunks = generatedChunks(terrain);
+    if (chunks.empty()) {
+        std::cout << "[bench] region files: no generated chunks" << std::endl;
+        return;
+    }
+    if (chunks.size() > 256) {
+        chunks.resize(256);
+    }
+
+    // A scratch world of our own, so the real save is untouched
+    QTemporaryDir scratchDirectory;
+    QString directory = scratchDirectory.path();
+    double ms[4];
+    int bad = 0;
+    {
+        RegionStore store(directory);
+        Clock::time_point start = Clock::now();
+        for (const Chunk *c : chunks) {
+            store.save(c->get_minX(), c->get_minZ(), c->allBlocks());
+        }
+        ms[0] = msSince(start);
+    }
+
+    // Cold: a fresh store that has to open and map the files and fault
+    // the pages in (the OS may still have them cached from the save).
+    // Warm: the same chunks again, from the mapping already made.
+    {
+        RegionStore store(directory);
+        auto blocks = mkU<std::array<BlockType, 65536>>();
+        std::vector<BlockEdit> edits;
+        for (int pass = 1; pass <= 2; pass++) {
+            Clock::time_point start = Clock::now();
+            for (const Chunk *c : chunks) {
+                if (store.load(c->get_minX(), c->get_minZ(), *blocks, edits) != RegionStore::Saved::BLOCKS ||
+                    *blocks != c->allBlocks()) {
+                    bad++;
+                }
+            }
+            ms[pass] = msSince(start);
+        }
+    }
+
+    // What loading saves us: generating the same chunks from noise
+    Chunk scratch(0, 0, nullptr);
+    Clock::time_point start = Clock::now();
+    for (const Chunk *c : chunks) {
+        scratch.reset(c->get_minX(), c->get_minZ());
+        scratch.createChunkBlockData(terrain.seed());
+    }
+    ms[3] = msSince(start);
+
+    double n = chunks.size();
+    std::cout << "[bench] region files, " << chunks.size() << " chunks: "
+              << "save " << ms[0] / n << " ms, cold load " << ms[1] / n << " ms, "
+              << "warm load " << ms[2] / n << " ms, generate " << ms[3] / n << " ms per chunk"
+              << (bad == 0 ? "" : "  MISMATCH") << std::endl;
+}
+
+void Benchmark::editDeltas(const Terrain &terrain)
+{
+    std::vector<const Chunk*> chunks = generatedChunks(terrain);
+    if (chunks.empty()) {
+        std::cout << "[bench] edit deltas: no generated chunks" << std::endl;
+        return;
+    }
+    if (chunks.size() > 256) {
+        chunks.resize(256);
+    }
+
+    // Each chunk as the player might leave it: its real edits, if any,
+    // then EDITS_PER_CHUNK more at random
+    const int EDITS_PER_CHUNK = 32;
+    std::mt19937 rng(7);
+    std::vector<std::vector<BlockEdit>> edits(chunks.size());
+    std::vector<uPtr<std::array<BlockType, 65536>>> edited(chunks.size());
+    for (size_t i = 0; i < chunks.size(); i++) {
+        edits[i] = chunks[i]->edits();
+        for (int e = 0; e < EDITS_PER_CHUNK; e++) {
+            edits[i].push_back({static_cast<uint16_t>(rng() % 65536), static_cast<BlockType>(rng() % (LEAF + 1))});
+        }
+        edited[i] = mkU<std::array<BlockType, 65536>>(chunks[i]->allBlocks());
+        for (const BlockEdit &e : edits[i]) {
+            (*edited[i])[e.index] = e.type;
+        }
+    }
+
+    // Both ways of saving in one scratch directory, under full and edits
+    QTemporaryDir scratchDirectory;
+    QString directory = scratchDirectory.path();
+    double ms[2];
+    qint64 bytes[2];
+    int bad = 0;
+    {
+        RegionStore store(directory + "/full");
+        for (size_t i = 0; i < chunks.size(); i++) {
+            store.save(chunks[i]->get_minX(), chunks[i]->get_minZ(), *edited[i]);
+        }
+        bytes[0] = store.diskUsage();
+    }
+    {
+        RegionStore store(directory + "/edits");
+        for (size_t i = 0; i < chunks.size(); i++) {
+            store.saveEdits(chunks[i]->get_minX(), chunks[i]->get_minZ(), edits[i]);
+        }
+        bytes[1] = store.diskUsage();
+    }
+
+    auto blocks = mkU<std::array<BlockType, 65536>>();
+    std::vector<BlockEdit> loadedEdits;
+    {
+        RegionStore store(directory + "/full");
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (store.load(chunks[i]->get_minX(), chunks[i]->get_minZ(), *blocks, loadedEdits) != RegionStore::Saved::BLOCKS ||
+                *blocks != *edited[i]) {
+                bad++;
+            }
+        }
+        ms[0] = msSince(start);
+    }
+    {
+        // Loading an edited chunk means generating it again and replaying
+        // the edits, so this also checks that generation is repeatable
+        RegionStore store(directory + "/edits");
+        Chunk scratch(0, 0, nullptr);
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < chunks.size(); i++) {
+            int x = chunks[i]->get_minX(), z = chunks[i]->get_minZ();
+            if (store.load(x, z, *blocks, loadedEdits) != RegionStore::Saved::EDITS) {
+                bad++;
+                continue;
+            }
+            scratch.reset(x, z);
+            scratch.setSavedEdits(std::move(loadedEdits));
+            scratch.createChunkBlockData(terrain.seed());
+            if (scratch.allBlocks() != *edited[i]) {
+                bad++;
+            }
+        }
+        ms[1] = msSince(start);
+    }
+
+    double n = chunks.size();
+    std::cout << "[bench] edit deltas, " << chunks.size() << " chunks with " << EDITS_PER_CHUNK << "+ edits: "
+              << "full chunks " << bytes[0] / 1024 << " KB, load " << ms[0] / n << " ms per chunk; "
+              << "edits only " << bytes[1] / 1024 << " KB, load " << ms[1] / n << " ms per chunk"
+              << (bad == 0 ? "" : "  MISMATCH") << std::endl;
+}
+
+void Benchmark::flight()
+{
+    // Straight along +x, one simulated tick per real 60th of a second so
+    // that the workers get the time they would in game. Flight mode's
+    // 300 acceleration against 0.9 friction per tick levels off at 50
+    // blocks per second; twice that is a player outrunning generation.
+    const int FRAMES = 240;
+    for (float speed : {50.f, 100.f, 200.f}) {
+        for (bool predict : {false, true}) {
+            QTemporaryDir directory;
+            Terrain world(nullptr, benchWorldDirectory(directory));
+            world.setAutosaveInterval(0);
+            world.setZonePrediction(predict);
+            glm::vec3 pos(32.f, 150.f, 32.f), look(1.f, 0.f, 0.f);
+            world.initialTerrainGeneration(pos);
+
+            int framesWithHoles = 0;
+            long long holes = 0;
+            Clock::time_point next = Clock::now();
+            for (int frame = 0; frame < FRAMES; frame++) {
+                glm::vec3 last = pos;
+                pos.x += speed / 60.f;
+                world.multithreadedTerrainUpdate(pos, last, look);
+                int missing = missingChunksInView(world, pos, look);
+                framesWithHoles += missing > 0;
+                holes += missing;
+                next += std::chrono::microseconds(16667);
+                std::this_thread::sleep_until(next);
+            }
+            std::cout << "[bench] flight at " << speed << " blocks/s, prediction "
+                      << (predict ? "on " : "off") << ": "
+                      << 100.0 * framesWithHoles / FRAMES << "% of frames with missing chunks in view, "
+                      << static_cast<double>(holes) / FRAMES << " missing per frame" << std::endl;
+        }
+    }
+}
+
+void Benchmark::revisit()
+{
+    // Out along +x far enough for the start to be evicted, back again,
+    // then back and forth over a zone border. Prediction stays on, as in
+    // game, so some meshes reach the cache before their zone is resident.
+    const float SPEED = 100.f;
+    const int LEG_FRAMES = 300;
+    QTemporaryDir directory;
+    Terrain world(nullptr, benchWorldDirectory(directory));
+    world.setAutosaveInterval(0);
+    glm::vec3 pos(32.f, 150.f, 32.f), look(1.f, 0.f, 0.f);
+    world.initialTerrainGeneration(pos);
+
+    Clock::time_point next = Clock::now();
+    auto fly = [&](float dx, int frames) {
+        for (int frame = 0; frame < frames; frame++) {
+            glm::vec3 last = pos;
+            pos.x += dx;
+            world.multithreadedTerrainUpdate(pos, last, look);
+            next += std::chrono::microseconds(16667);
+            std::this_thread::sleep_until(next);
+        }
+    };
+    fly(SPEED / 60.f, LEG_FRAMES);
+    look = glm::vec3(-1.f, 0.f, 0.f);
+    fly(-SPEED / 60.f, LEG_FRAMES);
+    // A second for what was evicted to come back
+    fly(0.f, 60);
+    int missing = missingChunksInView(world, pos, look) + missingChunksInView(world, pos, -look);
+    ChunkResidency::Stats back = world.residencyStats();
+
+    // pos.x is 32 again: cross x = 64 and back, 24 blocks each way
+    for (int i = 0; i < 10; i++) {
+        fly(1.f, 48);
+        fly(-1.f, 48);
+    }
+    ChunkResidency::Stats border = world.residencyStats();
+
+    std::cout << "[bench] revisit after " << SPEED * LEG_FRAMES / 60.f << " blocks out and back: "
+              << missing << " chunks without a mesh in the draw range; "
+              << back.evictions << " zones evicted, " << back.restores << " restored, "
+              << back.hits << " cached meshes reused, " << back.misses << " chunks remeshed, "
+              << back.cachedMeshes << " meshes (" << back.cachedBytes / 1024 << " KB) cached; "
+              << "20 border crossings evicted " << border.evictions - back.evictions << " more zones" << std::endl;
+}
+
+void Benchmark::gpuBudget()
+{
+    // The flight of Benchmark::flight() at 100 blocks/s with the budget
+    // lifted and then set well below what the view range needs. Without
+    // a GL context uploads only count their bytes, which is all the
+    // budget looks at.
+    const int FRAMES = 240;
+    for (size_t budgetMB : {0, 96, 48}) {
+        QTemporaryDir directory;
+        Terrain world(nullptr, benchWorldDirectory(directory));
+        world.setAutosaveInterval(0);
+        world.setGpuBudget(budgetMB);
+        glm::vec3 pos(32.f, 150.f, 32.f), look(1.f, 0.f, 0.f);
+        world.initialTerrainGeneration(pos);
+
+        size_t peak = 0;
+        Clock::time_point next = Clock::now();
+        for (int frame = 0; frame < FRAMES; frame++) {
+            glm::vec3 last = pos;
+            pos.x += 100.f / 60.f;
+            world.multithreadedTerrainUpdate(pos, last, look);
+            peak = std::max(peak, world.residencyStats().gpuBytes);
+            next += std::chrono::microseconds(16667);
+            std::this_thread::sleep_until(next);
+        }
+
+        // The nearest chunk in range without a mesh shows what the budget
+        // costs in view distance
+        float nearestMissing = -1.f;
+        glm::ivec2 zone = toCoords(zoneKeyAt(static_cast<int>(pos.x), static_cast<int>(pos.z)));
+        world.m_chunks.forEach([&](int64_t, const Chunk *c) {
+            glm::ivec2 away = glm::abs(toCoords(zoneKeyAt(c->get_minX(), c->get_minZ())) - zone) / 64;
+            if (!c->hasMesh() && c->isBlockDataReady() && std::max(away.x, away.y) <= world.zoneRadius) {
+                float d = glm::length(glm::vec2(c->get_minX() + 8 - pos.x, c->get_minZ() + 8 - pos.z));
+                nearestMissing = nearestMissing < 0.f ? d : std::min(nearestMissing, d);
+            }
+        });
+        ChunkResidency::Stats stats = world.residencyStats();
+        std::cout << "[bench] GPU budget " << (budgetMB == 0 ? std::string("none") : std::to_string(budgetMB) + " MB")
+                  << ": peak " << peak / 1048576.0 << " MB, now " << stats.gpuBytes / 1048576.0 << " MB in "
+                  << stats.gpuChunks << " chunks; " << stats.budgetEvictions << " meshes evicted for room, "
+                  << stats.budgetRestores << " brought back, " << stats.overBudget << " waiting; nearest chunk without a mesh "
+                  << (nearestMissing < 0.f ? std::string("none") : std::to_string(static_cast<int>(nearestMissing)) + " blocks away")
+                  << std::endl;
+    }
+}
+
+void Benchmark::runAll(Terrain &terrain)
+{
+    // Let the workers finish so we are not racing them for chunk data
+    QThreadPool::globalInstance()->waitForDone();
+    faceMasks(terrain);
+    meshing(terrain);
+    blockLookup(terrain);
+    blockQueries(terrain);
+    regions(terrain);
+    chunkDirectoryStress();
+    chunkPool();
+    regionFiles(terrain);
+    editDeltas(terrain);
+}
+
+void Benchmark::runRealTime()
+{
+    flight();
+    revisit();
+    gpuBudget();
+}
+
+void Benchmark::drawSubmission(Terrain &terrain, ShaderProgram &prog, OpenGLContext *context)
+{
+    // Mesh every chunk that has a mesh up again: whole into buffers of its
+    // own, and cut down to one face per pass both that way and in an
+    // arena, so that drawing costs next to nothing and what is left to
+    // time is submitting the draws
+    std::vector<uPtr<SeparateMesh>> whole, oneFace;
+    MeshArena arena(context);
+    std::vector<MeshArena::Handle> oneFaceOpq, oneFaceTra;
+    glm::ivec2 lo(INT_MAX), hi(INT_MIN);
+    uPtr<ChunkSnapshot> snapshot = mkU<ChunkSnapshot>();
+    uPtr<ChunkOpaqueTransparentVBOData> mesh = MeshBufferPool::acquire(nullptr);
+    terrain.m_chunks.forEach([&](int64_t, const Chunk *c) {
+        if (!c->hasVBOdata()) {
+            return;
+        }
+        snapshot->capture(*c);
+        mesh->clear();
+        c->buildMesh(*snapshot, *mesh);
+        whole.push_back(mkU<SeparateMesh>(context, *mesh));
+        for (std::vector<glm::vec4> *pass : {&mesh->m_vboDataOpaque, &mesh->m_vboDataTransparent}) {
+            pass->resize(std::min(pass->size(), MeshArena::VEC4S_PER_FACE));
+        }
+        oneFace.push_back(mkU<SeparateMesh>(context, *mesh));
+        oneFaceOpq.push_back(arena.upload(mesh->m_vboDataOpaque));
+        oneFaceTra.push_back(arena.upload(mesh->m_vboDataTransparent));
+        lo = glm::min(lo, glm::ivec2(c->get_minX(), c->get_minZ()));
+        hi = glm::max(hi, glm::ivec2(c->get_minX(), c->get_minZ()) + 16);
+    });
+    MeshBufferPool::release(std::move(mesh));
+    if (whole.empty()) {
+        std::cout << "[bench] draw submission: no chunk has a mesh" << std::endl;
+        return;
+    }
+
+    const int FRAMES = 60;
+    // Times FRAMES frames, submitting alone and then with each frame
+    // finished before the next. A warm-up frame keeps first-use costs out.
+    auto time = [&](auto frame, double &ms, double &finishMs) {
+        for (bool finish : {false, true}) {
+            frame();
+            context->glFinish();
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < FRAMES; i++) {
+                frame();
+                if (finish) {
+                    context->glFinish();
+                }
+            }
+            (finish ? finishMs : ms) = msSince(start) / FRAMES;
+            context->glFinish();
+        }
+    };
+    long long draws = 0, glCalls = 0;
+    auto perChunk = [&](const std::vector<uPtr<SeparateMesh>> &meshes) {
+        draws = glCalls = 0;
+        for (bool opaque : {true, false}) {
+            for (const uPtr<SeparateMesh> &m : meshes) {
+                if ((opaque ? m->elemOpqCount() : m->elemTraCount()) > 0) {
+                    glCalls += prog.drawInterleaved(m.get(), opaque, 0);
+                    draws++;
+                }
+            }
+        }
+    };
+    // Counts the draws and GL calls of one frame drawn from an arena,
+    // which also sets up any VAOs it needs before it is timed
+    auto countArena = [&](auto frame, auto stats) {
+        MeshArena::Stats before = stats();
+        frame();
+        draws = stats().drawCalls - before.drawCalls;
+        glCalls = stats().glCalls - before.glCalls;
+    };
+    auto report = [&](const char *what, const char *path, double ms, double finishMs) {
+        std::cout << "[bench] draw submission of " << whole.size() << " chunk meshes, " << what << ", " << path
+                  << ": " << ms << " ms/frame (" << finishMs << " with glFinish), " << draws << " draws, "
+                  << glCalls << " GL calls" << std::endl;
+    };
+
+    double ms, finishMs;
+    time([&]() { perChunk(oneFace); }, ms, finishMs);
+    report("one face each", "per-chunk buffers", ms, finishMs);
+    auto arenaOneFace = [&]() {
+        for (const std::vector<MeshArena::Handle> *pass : {&oneFaceOpq, &oneFaceTra}) {
+            arena.beginBatch();
+            for (MeshArena::Handle h : *pass) {
+                arena.addToBatch(h);
+            }
+            arena.drawBatch(prog, 0);
+        }
+    };
+    for (bool vaos : {false, true}) {
+        arena.setUseVAOs(vaos);
+        countArena(arenaOneFace, [&]() { return arena.stats(); });
+        time(arenaOneFace, ms, finishMs);
+        report("one face each", vaos ? "mesh arena with VAOs" : "mesh arena setting attributes", ms, finishMs);
+    }
+
+    time([&]() { perChunk(whole); }, ms, finishMs);
+    report("whole", "per-chunk buffers", ms, finishMs);
+    auto arenaWhole = [&]() {
+        terrain.draw(lo.x, hi.x, lo.y, hi.y, &prog, true);
+        terrain.draw(lo.x, hi.x, lo.y, hi.y, &prog, false);
+    };
+    for (bool vaos : {false, true}) {
+        terrain.setUseMeshArenaVAOs(vaos);
+        countArena(arenaWhole, [&]() { return terrain.meshArenaStats(); });
+        time(arenaWhole, ms, finishMs);
+        report("whole", vaos ? "mesh arena with VAOs" : "mesh arena setting attributes", ms, finishMs);
+    }
+    terrain.setUseMeshArenaVAOs(true);
+
+    MeshArena::Stats stats = terrain.meshArenaStats();
+    std::cout << "[bench] mesh arena: " << stats.pages << " pages, " << stats.usedBytes / 1048576.0 << " of "
+              << stats.capacityBytes / 1048576.0 << " MB used, " << stats.compactions << " compactions, "
+              << stats.shrinks << " pages emptied, " << stats.vaos << " VAOs" << std::endl;
+    stats = terrain.depthArenaStats();
+    std::cout << "[bench] depth arena: " << stats.pages << " pages, " << stats.usedBytes / 1048576.0 << " of "
+              << stats.capacityBytes / 1048576.0 << " MB used" << std::endl;
+}
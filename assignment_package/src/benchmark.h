@@ -0,0 +1,83 @@
+#pragma once
+#include "scene/terrain.h"
+
+// Micro-benchmarks of the terrain pipeline, printed to stdout.
+// They are run from inside the game with the B key (see MyGL::keyPressEvent)
+// so that they measure the world that is actually loaded.
+namespace Benchmark {
+
+// Face visibility for every loaded chunk: the per-block is_boundary()
+// reference against the ChunkFaceMasks bitmask kernel.
+void faceMasks(const Terrain &terrain);
+
+// Meshing every loaded chunk through MeshBufferPool twice, with the
+// number of buffer allocations per chunk on each pass.
+void meshing(const Terrain &terrain);
+
+// Terrain::getBlockAt() at random loaded blocks, through ChunkGrid,
+// against the float-floor-and-hash lookup it replaced.
+void blockLookup(const Terrain &terrain);
+
+// Terrain::getBlockAt(), tryGetBlockAt() and a BlockAccessor over
+// random blocks and over short coherent walks.
+void blockQueries(const Terrain &terrain);
+
+// Terrain::readRegion() and writeRegion() on 8, 32 and 128 block cubes,
+// against the same boxes read and written one block at a time, with the
+// chunks each writeRegion() leaves to remesh. The reads are of the
+// loaded world; the writes, of blocks that all change, go to a scratch
+// world of empty chunks.
+void regions(const Terrain &terrain);
+
+// Lookups from several threads into a ChunkDirectory that this thread
+// keeps inserting into and unloading from, checking that no reader ever
+// sees a freed chunk.
+void chunkDirectoryStress();
+
+// Loading and unloading zones along a fast flight, with the ChunkPool's
+// hits, misses and time saved, against plain new and delete.
+void chunkPool();
+
+// Saving loaded chunks to region files in a temporary directory and
+// reading them back cold and warm, against generating the same chunks
+// from noise.
+void regionFiles(const Terrain &terrain);
+
+// Region file size and load time per chunk for the same edited chunks
+// saved whole, and saved as edits over regenerated terrain.
+void editDeltas(const Terrain &terrain);
+
+// A fast flight through a fresh world in real time, with and without
+// the ZonePredictor: how often chunks in view had no mesh yet.
+void flight();
+
+// Flying away until the start is evicted from the GPU and back again:
+// how many chunks in range came back without a mesh, and how the
+// ChunkResidency got them back. Then crossing one zone border to and
+// fro, which should evict nothing.
+void revisit();
+
+// The same fast flight without a GPU budget and with two small ones:
+// peak mesh bytes on the GPU, meshes evicted and brought back, and how
+// near the player the nearest chunk left without a mesh was.
+void gpuBudget();
+
+// Runs every CPU-side benchmark above in turn, but for the three that
+// fly in real time, which take about a minute; see runRealTime()
+void runAll(Terrain &terrain);
+
+// flight(), revisit() and gpuBudget() in turn. They only touch worlds of
+// their own, so MyGL runs them on a thread of their own, and the game
+// keeps running meanwhile rather than freezing until they are done. The
+// worlds share the worker threads with the game's, so results are
+// cleanest with the player standing still.
+void runRealTime();
+
+// CPU time to submit both passes of every meshed chunk, each from buffers
+// of its own as chunks used to be drawn, against Terrain::draw() from the
+// MeshArena, with its VAOs and setting the attributes up every draw; also
+// with glFinish() after every frame, and the GL calls of each frame.
+// Needs the context current, and is run after runAll().
+void drawSubmission(Terrain &terrain, ShaderProgram &prog, OpenGLContext *context);
+
+}
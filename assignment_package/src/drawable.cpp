@@ -24,6 +24,11 @@ void Drawable::destroyVBOdata()
     m_countOpq = m_countTra = -1;
 }
 
+bool Drawable::hasVBOdata() const
+{
+    return m_idxOpqGenerated || m_idxTraGenerated || m_bufDataOpqGenerated || m_bufDataTraGenerated;
+}
+
 GLenum Drawable::drawMode()
 {
     // Since we want every three indices in bufIdx to be
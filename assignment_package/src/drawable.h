@@ -38,7 +38,8 @@ public:
     virtual ~Drawable();
 
     virtual void createVBOdata() = 0; // To be implemented by subclasses. Populates the VBOs of the Drawable.
-    void destroyVBOdata(); // Frees the VBOs of the Drawable.
+    virtual void destroyVBOdata(); // Frees the VBOs of the Drawable.
+    virtual bool hasVBOdata() const; // Has any VBO been generated since the last destroyVBOdata()?
 
     // Getter functions for various GL data
     virtual GLenum drawMode();
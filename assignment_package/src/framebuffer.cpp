@@ -4,7 +4,7 @@
 FrameBuffer::FrameBuffer(OpenGLContext *context,
                          unsigned int width, unsigned int height, unsigned int devicePixelRatio)
     : mp_context(context), m_frameBuffer(-1),
-    m_outputTexture(-1), m_depthRenderBuffer(-1),
+    m_outputTexture(-1), m_depthRenderBuffer(-1), m_depthCopyFrameBuffer(-1), m_depthCopyTexture(-1),
     m_width(width), m_height(height), m_devicePixelRatio(devicePixelRatio), m_created(false)
 {}
 
@@ -76,8 +76,25 @@ void FrameBuffer::create() {
     mp_context->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
     m_depthTexture = depthTex;
 
+    // The copy of the depth, alone in a frame buffer of its own
+    mp_context->glGenFramebuffers(1, &m_depthCopyFrameBuffer);
+    mp_context->glGenTextures(1, &m_depthCopyTexture);
+    mp_context->glBindTexture(GL_TEXTURE_2D, m_depthCopyTexture);
+    mp_context->glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, m_width, m_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    mp_context->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    mp_context->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    mp_context->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    mp_context->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    mp_context->glBindFramebuffer(GL_FRAMEBUFFER, m_depthCopyFrameBuffer);
+    mp_context->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depthCopyTexture, 0);
+    GLenum noColour = GL_NONE;
+    mp_context->glDrawBuffers(1, &noColour);
+    mp_context->glReadBuffer(GL_NONE);
+    bool copyComplete = mp_context->glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    mp_context->glBindFramebuffer(GL_FRAMEBUFFER, m_frameBuffer);
+
     m_created = true;
-    if(mp_context->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    if(mp_context->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE || !copyComplete)
     {
         m_created = false;
         std::cout << "Frame buffer did not initialize correctly..." << std::endl;
@@ -93,6 +110,8 @@ void FrameBuffer::destroy() {
         mp_context->glDeleteTextures(1, &m_outputTexture);
         mp_context->glDeleteRenderbuffers(1, &m_depthRenderBuffer);
         mp_context->glDeleteTextures(1, &m_depthTexture);
+        mp_context->glDeleteFramebuffers(1, &m_depthCopyFrameBuffer);
+        mp_context->glDeleteTextures(1, &m_depthCopyTexture);
     }
 }
 
@@ -100,13 +119,20 @@ void FrameBuffer::bindFrameBuffer() {
     mp_context->glBindFramebuffer(GL_FRAMEBUFFER, m_frameBuffer);
 }
 
+void FrameBuffer::copyDepth() {
+    mp_context->glBindFramebuffer(GL_READ_FRAMEBUFFER, m_frameBuffer);
+    mp_context->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_depthCopyFrameBuffer);
+    mp_context->glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    mp_context->glBindFramebuffer(GL_FRAMEBUFFER, m_frameBuffer);
+}
+
 void FrameBuffer::bindToTextureSlot(unsigned int slot) {
     m_textureSlot = slot;
     mp_context->glActiveTexture(GL_TEXTURE0 + slot);
     if (slot == 0) {
         mp_context->glBindTexture(GL_TEXTURE_2D, m_outputTexture);
     } else if (slot == 1) {
-        mp_context->glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+        mp_context->glBindTexture(GL_TEXTURE_2D, m_depthCopyTexture);
     } else {
         std::cerr << "Invalid texture slot: " << slot << std::endl;
     }
@@ -18,6 +18,10 @@ private:
     GLuint m_frameBuffer;
     GLuint m_outputTexture;
     GLuint m_depthRenderBuffer;
+    // A copy of m_depthTexture for shaders to read, and a frame buffer to
+    // blit it into; see copyDepth()
+    GLuint m_depthCopyFrameBuffer;
+    GLuint m_depthCopyTexture;
 
 
     unsigned int m_width, m_height, m_devicePixelRatio;
@@ -35,7 +39,13 @@ public:
     // Deallocate all GPU-side data
     void destroy();
     void bindFrameBuffer();
-    // Associate our output texture with the indicated texture slot
+    // Copies the depth drawn so far into the texture bindToTextureSlot(1)
+    // binds. Shaders cannot read the depth attached to the frame buffer
+    // they draw into, even with depth writes off: that is a feedback loop,
+    // whose result GL leaves undefined. Leaves this frame buffer bound.
+    void copyDepth();
+    // Associate our output texture with the indicated texture slot,
+    // 0 for the colour and 1 for the copy of the depth
     void bindToTextureSlot(unsigned int slot);
     GLuint m_depthTexture;
     unsigned int getTextureSlot() const;
@@ -0,0 +1,78 @@
+#include "gputimer.h"
+
+// Desktop GL only, and so missing from the ES headers Qt may be built with
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+
+GpuTimer::GpuTimer(OpenGLContext *context, std::vector<std::string> passNames)
+    : mp_context(context), m_passNames(std::move(passNames)), m_queries(), m_issued(),
+      m_frame(0), m_totalMs(m_passNames.size(), 0.0), m_frames(m_passNames.size(), 0),
+      m_dropped(0), m_created(false)
+{}
+
+void GpuTimer::create()
+{
+    m_queries.resize(FRAMES_IN_FLIGHT * m_passNames.size());
+    m_issued.assign(m_queries.size(), false);
+    mp_context->glGenQueries(static_cast<GLsizei>(m_queries.size()), m_queries.data());
+    m_created = true;
+}
+
+void GpuTimer::destroy()
+{
+    if (m_created) {
+        m_created = false;
+        mp_context->glDeleteQueries(static_cast<GLsizei>(m_queries.size()), m_queries.data());
+    }
+}
+
+void GpuTimer::beginFrame()
+{
+    m_frame = (m_frame + 1) % FRAMES_IN_FLIGHT;
+    for (size_t pass = 0; pass < m_passNames.size(); pass++) {
+        size_t i = m_frame * m_passNames.size() + pass;
+        if (!m_issued[i]) {
+            continue;
+        }
+        m_issued[i] = false;
+        GLuint available = 0;
+        mp_context->glGetQueryObjectuiv(m_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            m_dropped++;
+            continue;
+        }
+        GLuint ns = 0;
+        mp_context->glGetQueryObjectuiv(m_queries[i], GL_QUERY_RESULT, &ns);
+        m_totalMs[pass] += ns / 1e6;
+        m_frames[pass]++;
+    }
+}
+
+void GpuTimer::begin(int pass)
+{
+    size_t i = m_frame * m_passNames.size() + pass;
+    mp_context->glBeginQuery(GL_TIME_ELAPSED, m_queries[i]);
+    m_issued[i] = true;
+}
+
+void GpuTimer::end()
+{
+    mp_context->glEndQuery(GL_TIME_ELAPSED);
+}
+
+GpuTimer::Times GpuTimer::times() const
+{
+    Times t{m_passNames, {}, m_frames, m_dropped};
+    for (size_t pass = 0; pass < m_passNames.size(); pass++) {
+        t.ms.push_back(m_frames[pass] > 0 ? m_totalMs[pass] / m_frames[pass] : 0.0);
+    }
+    return t;
+}
+
+void GpuTimer::reset()
+{
+    m_totalMs.assign(m_passNames.size(), 0.0);
+    m_frames.assign(m_passNames.size(), 0);
+    m_dropped = 0;
+}
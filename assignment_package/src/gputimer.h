@@ -0,0 +1,48 @@
+#pragma once
+#include "openglcontext.h"
+#include <string>
+#include <vector>
+
+// Times the passes of each frame on the GPU with GL_TIME_ELAPSED queries.
+// A pass's result is read FRAMES_IN_FLIGHT frames after it was issued,
+// once the GPU is done with it, so that timing never stalls the frame;
+// results not ready by then are dropped. Passes may not overlap.
+class GpuTimer {
+public:
+    static constexpr int FRAMES_IN_FLIGHT = 4;
+
+    GpuTimer(OpenGLContext *context, std::vector<std::string> passNames);
+    // Initialize and deallocate the query objects, with the context current
+    void create();
+    void destroy();
+
+    // Collects the results of the frame whose queries are about to be
+    // reused. Call at the start of every frame.
+    void beginFrame();
+    void begin(int pass);
+    void end();
+
+    // Average GPU milliseconds of each pass since the last reset(), and
+    // how many frames that is over
+    struct Times {
+        std::vector<std::string> names;
+        std::vector<double> ms;
+        std::vector<long long> frames;
+        long long dropped; // results that were not ready in time
+    };
+    Times times() const;
+    void reset();
+
+private:
+    OpenGLContext *mp_context;
+    std::vector<std::string> m_passNames;
+    // FRAMES_IN_FLIGHT rows of one query per pass, and whether each was
+    // issued
+    std::vector<GLuint> m_queries;
+    std::vector<bool> m_issued;
+    int m_frame;
+    std::vector<double> m_totalMs;
+    std::vector<long long> m_frames;
+    long long m_dropped;
+    bool m_created;
+};
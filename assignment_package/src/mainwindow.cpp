@@ -18,6 +18,9 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(ui->mygl, SIGNAL(sig_sendPlayerLook(QString)), &playerInfoWindow, SLOT(slot_setLookText(QString)));
     connect(ui->mygl, SIGNAL(sig_sendPlayerChunk(QString)), &playerInfoWindow, SLOT(slot_setChunkText(QString)));
     connect(ui->mygl, SIGNAL(sig_sendPlayerTerrainZone(QString)), &playerInfoWindow, SLOT(slot_setZoneText(QString)));
+    connect(ui->mygl, SIGNAL(sig_sendMeshMemory(QString)), &playerInfoWindow, SLOT(slot_setMeshMemoryText(QString)));
+    connect(ui->mygl, SIGNAL(sig_sendGpuMemory(QString)), &playerInfoWindow, SLOT(slot_setGpuMemoryText(QString)));
+    connect(ui->mygl, SIGNAL(sig_sendShadowCache(QString)), &playerInfoWindow, SLOT(slot_setShadowCacheText(QString)));
 }
 
 MainWindow::~MainWindow()
@@ -1,18 +1,23 @@
 #include "mygl.h"
+#include "benchmark.h"
 #include <glm_includes.h>
 
 #include <iostream>
 #include <QApplication>
 #include <QKeyEvent>
 #include <qdatetime.h>
+#include <QStandardPaths>
 
 
 
 MyGL::MyGL(QWidget *parent)
     : OpenGLContext(parent),
     m_progLambert(this), m_progFlat(this), m_depth(this),m_progSky(this),
-    m_terrain(this), m_player(glm::vec3(32.f, 255.f, 32.f), m_terrain), m_lastTime(QDateTime::currentMSecsSinceEpoch()),m_WLoverlay(this), m_geomQuad(this),
+    m_perFrameUbo(0), m_perFrame(), m_shadowCascades(3, 2048, 192.f),
+    m_shadowStatsTime(QDateTime::currentMSecsSinceEpoch()), m_shadowStatsLast(m_shadowCascades.stats()),
+    m_terrain(this, QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/world"), m_player(glm::vec3(32.f, 255.f, 32.f), m_terrain), m_lastTime(QDateTime::currentMSecsSinceEpoch()),m_WLoverlay(this), m_geomQuad(this),
     m_frameBuffer(this, this->width(), this->height(), this->devicePixelRatio()),
+    m_gpuTimer(this, {"shadow map", "depth prepass", "terrain", "overlay"}),
     m_time(0)
 {
     // Connect the timer to a function so that when the timer ticks the function is executed
@@ -28,7 +33,9 @@ MyGL::MyGL(QWidget *parent)
 MyGL::~MyGL() {
     makeCurrent();
     glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &m_perFrameUbo);
     m_frameBuffer.destroy();
+    m_gpuTimer.destroy();
     m_geomQuad.destroyVBOdata();
 }
 
@@ -37,34 +44,24 @@ void MyGL::moveMouseToCenter() {
     QCursor::setPos(this->mapToGlobal(QPoint(width() / 2, height() / 2)));
 }
 
-void MyGL::setDepthFBO(){
-    glGenFramebuffers(1, &fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_frameBuffer.m_depthTexture, 0);
-    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        std::cerr << "Error: Framebuffer is not complete!" << std::endl;
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        return;
-    }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
 void MyGL::set_shadow_mapping(){
     // create the buffer
     glGenFramebuffers(1, &shadow_mapping_fbo);
 
-    // create the texture
+    // create the texture, a layer per cascade
+    int res = m_shadowCascades.resolution();
     glGenTextures(1, &shadow_mapping_texture);
-    glBindTexture(GL_TEXTURE_2D, shadow_mapping_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-                 shad_width, shad_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_mapping_texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24,
+                 res, res, m_shadowCascades.count(), 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // renderShadowMappingDepth() attaches each layer in turn
     glBindFramebuffer(GL_FRAMEBUFFER, shadow_mapping_fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadow_mapping_texture, 0);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadow_mapping_texture, 0, 0);
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -93,7 +90,7 @@ void MyGL::initializeGL()
     glGenVertexArrays(1, &vao);
 
     m_frameBuffer.create();
-    setDepthFBO();
+    m_gpuTimer.create();
     set_shadow_mapping();
     m_geomQuad.createVBOdata();
 
@@ -105,10 +102,23 @@ void MyGL::initializeGL()
 
     //m_progLambert.setGeometryColor(glm::vec4(0,1,0,1));
 
+    // The terrain programs read the camera, light and time from one
+    // uniform buffer, filled once a frame
+    glGenBuffers(1, &m_perFrameUbo);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_perFrameUbo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(PerFrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, ShaderProgram::PER_FRAME_BINDING, m_perFrameUbo);
+    // and the rest of their uniforms never change
+    m_progFlat.setModelMatrix(glm::mat4());
+    m_progFlat.setDepthTextureSlot(1);
+    m_progFlat.setShadowMappingDepthSlot(2);
+    m_depth.setModelMatrix(glm::mat4());
+
     m_terrain.create_load_texture(":/textures/minecraft_textures_all.png");
 
-    // We have to have a VAO bound in OpenGL 3.2 Core. But if we're not
-    // using multiple VAOs, we can just bind one once.
+    // We have to have a VAO bound in OpenGL 3.2 Core. Chunk meshes are
+    // drawn with VAOs of their own (see MeshArena), which put this one back
+    // afterwards, so everything else can just use this one, bound once.
     glBindVertexArray(vao);
 
     lastMousePosition = QPoint(0, 0);
@@ -125,8 +135,6 @@ void MyGL::resizeGL(int w, int h) {
     // Upload the view-projection matrix to our shaders (i.e. onto the graphics card)
 
     m_progLambert.setViewProjMatrix(viewproj);
-    m_progFlat.setViewProjMatrix(viewproj);
-    m_progFlat.setScreenSize(glm::vec2(width(),height()));
 
     m_progSky.setViewProjMatrix(glm::inverse(viewproj));
     m_progSky.useMe();
@@ -150,11 +158,12 @@ void MyGL::tick() {
     float deltaT = (currentTime - m_lastTime) * 0.001;
     m_lastTime = currentTime;
     m_player.tick(deltaT, m_inputs);
-    m_terrain.multithreadedTerrainUpdate(m_player.mcr_position, m_player.mcr_lastFramePosition);
+    m_terrain.multithreadedTerrainUpdate(m_player.mcr_position, m_player.mcr_lastFramePosition, m_player.mcr_forward);
     m_time++;
     update_light_vector();
     update(); // Calls paintGL() as part of a larger QOpenGLWidget pipeline
     sendPlayerDataToGUI(); // Updates the info in the secondary window displaying player data
+    sendShadowCacheToGUI();
 }
 
 void MyGL::sendPlayerDataToGUI() const {
@@ -167,19 +176,52 @@ void MyGL::sendPlayerDataToGUI() const {
     glm::ivec2 zone(64 * glm::ivec2(glm::floor(pPos / 64.f)));
     emit sig_sendPlayerChunk(QString::fromStdString("( " + std::to_string(chunk.x) + ", " + std::to_string(chunk.y) + " )"));
     emit sig_sendPlayerTerrainZone(QString::fromStdString("( " + std::to_string(zone.x) + ", " + std::to_string(zone.y) + " )"));
+    MeshBufferPool::Stats mesh = MeshBufferPool::stats();
+    emit sig_sendMeshMemory(QString::number(mesh.meshBytes / 1048576.0, 'f', 1) + " MB ("
+                            + QString::number(mesh.pooledBytes / 1048576.0, 'f', 1) + " MB pooled)");
+    ChunkResidency::Stats residency = m_terrain.residencyStats();
+    QString budget = m_terrain.gpuBudget() > 0 ? QString::number(m_terrain.gpuBudget() >> 20) + " MB" : "no limit";
+    emit sig_sendGpuMemory(QString::number(residency.gpuBytes / 1048576.0, 'f', 1) + " MB of " + budget + ", "
+                           + QString::number(residency.gpuChunks) + " chunks ("
+                           + QString::number(residency.overBudget) + " over budget)");
+}
+
+// Sends how many cascade draws the shadow map cache saved, once a second
+void MyGL::sendShadowCacheToGUI() {
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (now - m_shadowStatsTime < 1000) {
+        return;
+    }
+    ShadowCascades::Stats shadow = m_shadowCascades.stats();
+    long long frames = shadow.cascadeFrames - m_shadowStatsLast.cascadeFrames;
+    long long skipped = frames - (shadow.drawn - m_shadowStatsLast.drawn);
+    double seconds = (now - m_shadowStatsTime) * 0.001;
+    emit sig_sendShadowCache(QString::number(skipped / seconds, 'f', 0) + " of "
+                             + QString::number(frames / seconds, 'f', 0) + " cascade draws skipped/s");
+    m_shadowStatsTime = now;
+    m_shadowStatsLast = shadow;
 }
 
 // This function is called whenever update() is called.
 // MyGL's constructor links update() to a timer that fires 60 times per second,
 // so paintGL() called at a rate of 60 frames per second.
 void MyGL::paintGL() {
-    // Clear the screen so that we only see newly drawn images
-    renderDepthView();
+    updatePerFrameUniforms();
+    m_gpuTimer.beginFrame();
 
+    m_gpuTimer.begin(PASS_SHADOW);
     renderShadowMappingDepth();
+    m_gpuTimer.end();
+    m_gpuTimer.begin(PASS_DEPTH);
+    renderDepthView();
+    m_gpuTimer.end();
     //renderSkybox();
+    m_gpuTimer.begin(PASS_TERRAIN);
     renderTerrain();
+    m_gpuTimer.end();
+    m_gpuTimer.begin(PASS_OVERLAY);
     renderOverlay();
+    m_gpuTimer.end();
 }
 
 void MyGL::renderSkybox(){
@@ -191,18 +233,32 @@ void MyGL::renderSkybox(){
 }
 
 void MyGL::renderShadowMappingDepth() {
-    glViewport(0, 0, shad_width, shad_height);
+    glViewport(0, 0, m_shadowCascades.resolution(), m_shadowCascades.resolution());
     glBindFramebuffer(GL_FRAMEBUFFER, shadow_mapping_fbo);
-    glClear(GL_DEPTH_BUFFER_BIT);
-
-    // render scene
-    m_depth.setModelMatrix(glm::mat4(1.0f));
-    m_depth.setViewProjMatrix(LightSpaceMatrix);
 
     int x = static_cast<int>(floor(m_player.mcr_position.x / 16.f) * 16);
     int z = static_cast<int>(floor(m_player.mcr_position.z / 16.f) * 16);
     int drawBlockSize = (m_terrain.zoneRadius - 1) * 64;
-    m_terrain.draw(x - drawBlockSize, x + drawBlockSize, z - drawBlockSize, z + drawBlockSize, &m_depth, true);
+    // the shadow maps are kept from frame to frame; redraw the ones that
+    // a changed chunk casts into, or that were fitted again
+    for (glm::ivec2 corner : m_terrain.takeMeshChanges()) {
+        m_shadowCascades.invalidate(corner);
+    }
+    for (int i = 0; i < m_shadowCascades.count(); i++) {
+        if (!m_shadowCascades.isStale(i)) {
+            continue;
+        }
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadow_mapping_texture, 0, i);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        // render the chunks that can cast a shadow into this cascade,
+        // their coplanar faces merged
+        m_depth.setCascade(i);
+        glm::ivec4 b = m_shadowCascades.casterBounds(i);
+        m_terrain.drawDepth(std::max(b[0], x - drawBlockSize), std::min(b[1], x + drawBlockSize),
+                            std::max(b[2], z - drawBlockSize), std::min(b[3], z + drawBlockSize), &m_depth, true);
+        m_shadowCascades.markDrawn(i);
+    }
 
     glBindFramebuffer(GL_FRAMEBUFFER, this->defaultFramebufferObject());
 }
@@ -212,21 +268,18 @@ void MyGL::renderShadowMappingDepth() {
 // for more info)f
 void MyGL::renderTerrain() {
 
-    m_frameBuffer.bindFrameBuffer();
-    glViewport(0, 0, this->width(), this->height());
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glEnable(GL_CULL_FACE);
-    glFrontFace(GL_CW);
-    glCullFace(GL_BACK);
+    // Draw over the depth prepass, still in m_frameBuffer. It already has
+    // the nearest opaque surface of every pixel, so only those pass the
+    // depth test and get shaded, and depth writes stay off. The edges are
+    // found from a copy of that depth, as the shaders may not read the
+    // depth attached to the frame buffer they draw into.
+    glDepthMask(GL_FALSE);
+    m_frameBuffer.copyDepth();
 
-    m_progFlat.useMe();
-    m_progFlat.setScreenSize(glm::vec2(width(),height()));
-    m_progFlat.setLightSpaceMatrix(LightSpaceMatrix);
     // activate shadow mapping depth texture
     glActiveTexture(GL_TEXTURE0 + 2);
-    glBindTexture(GL_TEXTURE_2D, shadow_mapping_texture);
-    GLuint shadMapDepthUnif = glGetUniformLocation(m_progFlat.prog, "u_ShadowMappingDepth");
-    glUniform1i(shadMapDepthUnif, 2);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_mapping_texture);
+    m_frameBuffer.bindToTextureSlot(1);
 
     int x = static_cast<int>(floor(m_player.mcr_position.x / 16.f) * 16);
     int z = static_cast<int>(floor(m_player.mcr_position.z / 16.f) * 16);
@@ -236,16 +289,7 @@ void MyGL::renderTerrain() {
     m_terrain.draw(x - drawBlockSize, x + drawBlockSize, z - drawBlockSize, z + drawBlockSize, &m_progFlat, true);
     // draw transparent
     m_terrain.draw(x - drawBlockSize, x + drawBlockSize, z - drawBlockSize, z + drawBlockSize, &m_progFlat, false);
-
-    // update time for shader
-    m_progFlat.setTime(m_time);
-    m_progFlat.setCameraPosition(m_player.mcr_camera.mcr_position);
-
-    //set model and view matrix
-    glDisable(GL_DEPTH_TEST);
-    m_progFlat.setModelMatrix(glm::mat4());
-    m_progFlat.setViewProjMatrix(m_player.mcr_camera.getViewProj());
-    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
 }
 
 void MyGL::renderOverlay(){
@@ -270,46 +314,25 @@ void MyGL::renderOverlay(){
 }
 
 
-void MyGL::visualize(){
-    glBindFramebuffer(GL_FRAMEBUFFER, this->defaultFramebufferObject());
-    glViewport(0, 0, this->width(), this->height());
-    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, shadow_mapping_texture);
-    m_WLoverlay.useMe();
-    GLuint shadMapDepthUnif = glGetUniformLocation(m_WLoverlay.prog, "u_RenderedTexture");
-    glUniform1i(shadMapDepthUnif, 0);
-
-    m_WLoverlay.drawEffect(m_geomQuad);
-}
-
 void MyGL::renderDepthView(){
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    m_frameBuffer.bindFrameBuffer();
     glViewport(0, 0, this->width(), this->height());
-    glClear(GL_DEPTH_BUFFER_BIT);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
     glFrontFace(GL_CW);
     glCullFace(GL_BACK);
+    // Depth only; the depth shader has no colour output
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-    m_progFlat.useMe();
-    m_frameBuffer.bindToTextureSlot(1);
-    GLint depthTexUniform = glGetUniformLocation(m_progFlat.prog, "u_DepthTexture");
-    glUniform1i(depthTexUniform, 1);
-
-    m_depth.useMe();
+    m_depth.setCascade(-1);
     int x = static_cast<int>(floor(m_player.mcr_position.x / 16.f) * 16);
     int z = static_cast<int>(floor(m_player.mcr_position.z / 16.f) * 16);
-    // draw opaque
+    // draw opaque, from the same positions the terrain pass has
     int drawBlockSize = (m_terrain.zoneRadius - 1) * 64;
-    m_terrain.draw(x - drawBlockSize, x + drawBlockSize, z - drawBlockSize, z + drawBlockSize, &m_depth, true);
-
-    glDisable(GL_DEPTH_TEST);
-    m_depth.setModelMatrix(glm::mat4());
-    m_depth.setViewProjMatrix(m_player.mcr_camera.getViewProj());
-    glEnable(GL_DEPTH_TEST);
+    m_terrain.drawDepth(x - drawBlockSize, x + drawBlockSize, z - drawBlockSize, z + drawBlockSize, &m_depth, false);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, this->defaultFramebufferObject());
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 }
 
 
@@ -320,25 +343,27 @@ void MyGL::update_light_vector() {
             lightInvDir *= -1;
     }
 
-    // set the projection matrix according to player height
-    // so that it can have higher resolution when the player is near ground
+    // the height goes to the gpu with the next frame's uniforms, to
+    // choose whether to soften the shadows
     float curr_height = m_player.getHeight(m_terrain);
-    curr_height = curr_height > max_height ? max_height : curr_height;
-    float half_width = glm::mix(
-        min_half_width, max_half_width,
-        (curr_height - min_height) / (max_height - min_height)
-    );
-    depthProjMatrix = glm::ortho<float>(-half_width, half_width, -half_width, half_width, 0.1f, 1000.f);
-
-    // send the height value to gpu
-    m_progFlat.useMe();
-    int unifHeight = glGetUniformLocation(m_progFlat.prog, "u_height");
-    glUniform1f(unifHeight, curr_height);
-
-
-    depthViewMatrix = glm::lookAt(lightInvDir + m_player.mcr_position, m_player.mcr_position, glm::vec3(0.f, 1.f, 0.f));
-    LightSpaceMatrix = depthProjMatrix * depthViewMatrix;
-    m_progFlat.setLightDirection(lightInvDir);
+    m_perFrame.height = curr_height > max_height ? max_height : curr_height;
+}
+
+void MyGL::updatePerFrameUniforms() {
+    const Camera &camera = m_player.mcr_camera;
+    m_perFrame.viewProj = camera.getViewProj();
+    // fit the shadow cascades to where the camera looks this frame
+    m_shadowCascades.fit(m_perFrame.viewProj, camera.getNearClip(), camera.getFarClip(), lightInvDir);
+    for (int i = 0; i < m_shadowCascades.count(); i++) {
+        m_perFrame.cascades[i] = m_shadowCascades.matrix(i);
+    }
+    m_perFrame.cascadeCount = m_shadowCascades.count();
+    m_perFrame.lightDirection = lightInvDir;
+    m_perFrame.cameraPos = camera.mcr_position;
+    m_perFrame.time = m_time;
+    m_perFrame.screenSize = glm::vec2(width(), height());
+    glBindBuffer(GL_UNIFORM_BUFFER, m_perFrameUbo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PerFrameUniforms), &m_perFrame);
 }
 
 void MyGL::keyPressEvent(QKeyEvent *e) {
@@ -372,6 +397,25 @@ void MyGL::keyPressEvent(QKeyEvent *e) {
 
         }
 
+    } else if (e->key() == Qt::Key_B) {
+        Benchmark::runAll(m_terrain);
+        // These pace their flights by the clock, so on this thread they
+        // would freeze the game for a minute
+        if (m_realTimeBenchmarks.valid() &&
+            m_realTimeBenchmarks.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            std::cout << "[bench] real-time flights still running, not started again" << std::endl;
+        } else {
+            m_realTimeBenchmarks = std::async(std::launch::async, Benchmark::runRealTime);
+        }
+        makeCurrent();
+        Benchmark::drawSubmission(m_terrain, m_progFlat, this);
+        GpuTimer::Times gpu = m_gpuTimer.times();
+        std::cout << "[bench] GPU time per frame:";
+        for (size_t pass = 0; pass < gpu.names.size(); pass++) {
+            std::cout << " " << gpu.names[pass] << " " << gpu.ms[pass] << " ms (" << gpu.frames[pass] << " frames)";
+        }
+        std::cout << ", " << gpu.dropped << " results not ready in time" << std::endl;
+        m_gpuTimer.reset();
     }
     //flight mode
     if (m_inputs.flight_mode) {
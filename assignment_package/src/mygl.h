@@ -10,6 +10,7 @@
 #include "smartpointerhelp.h"
 #include "scene/quad.h"
 #include "framebuffer.h"
+#include "gputimer.h"
 
 
 
@@ -20,6 +21,7 @@
 #include <QDir>
 #include <QString>
 #include <ctime>
+#include <future>
 
 class MyGL : public OpenGLContext
 {
@@ -34,12 +36,19 @@ private:
     GLuint vao; // A handle for our vertex array object. This will store the VBOs created in our geometry classes.
         // Don't worry too much about this. Just know it is necessary in order to render geometry.
 
-    GLuint fbo;
-
-    // settings about shadow mapping
+    // The uniform buffer of m_perFrame, bound for every terrain program
+    GLuint m_perFrameUbo;
+    PerFrameUniforms m_perFrame;
+
+    // settings about shadow mapping: how many cascades, their resolution
+    // and how far from the camera they reach are set in the constructor
+    ShadowCascades m_shadowCascades;
+    // when the skipped cascade draws were last sent to the GUI, and the
+    // stats then
+    qint64 m_shadowStatsTime;
+    ShadowCascades::Stats m_shadowStatsLast;
     GLuint shadow_mapping_fbo;
-    int shad_width = 1258 * 8; //this->width();
-    int shad_height = 916 * 8; //this->height();
+    // An array texture with a layer for each cascade
     GLuint shadow_mapping_texture;
 
     Terrain m_terrain; // All of the Chunks that currently comprise the world.
@@ -52,38 +61,41 @@ private:
     QPoint lastMousePosition;
     qint64 m_lastTime;
     FrameBuffer m_frameBuffer;
+    // The passes of paintGL(), timed on the GPU by m_gpuTimer
+    enum GpuPass { PASS_SHADOW, PASS_DEPTH, PASS_TERRAIN, PASS_OVERLAY };
+    GpuTimer m_gpuTimer;
+    // Benchmark::runRealTime(), run off the GUI thread by the B key.
+    // Waited for on destruction.
+    std::future<void> m_realTimeBenchmarks;
     Quad m_geomQuad;
 
     void moveMouseToCenter(); // Forces the mouse position to the screen's center. You should call this
         // from within a mouse move event after reading the mouse movement so that
         // your mouse stays within the screen bounds and is always read.
     void sendPlayerDataToGUI() const;
+    void sendShadowCacheToGUI();
 
     int m_time; // another timer for shader programs cuz I don't know how to use QTimer haha.
 
-    void setDepthFBO();
     void set_shadow_mapping();
 
     // Called from paintGL().
     // Calls Terrain::draw().
     void renderTerrain();
+    // Lays down the depth of the opaque terrain in m_frameBuffer, which
+    // renderTerrain() tests against, and reads a copy of for its edges
     void renderDepthView();
     void renderOverlay();
     void renderShadowMappingDepth();
     void renderSkybox();
 
-    void visualize();
+    // Uploads this frame's m_perFrame. Called at the start of paintGL().
+    void updatePerFrameUniforms();
 
     // about shadow mapping
     glm::vec3 lightInvDir = glm::vec3(10.f, 250.f, 10.f);
-    glm::mat4 depthViewMatrix = glm::lookAt(lightInvDir + m_player.mcr_position, m_player.mcr_position, glm::vec3(0.f, 1.f, 0.f));
-    // at max_height, the half width of the projection matrix should be max_half_width, and vice versa
-    float max_half_width = 200.f;
-    float min_half_width = 64.f;
+    // the player's height is clamped to this, see PerFrameUniforms::height
     float max_height = 50.f;
-    float min_height = 0.f;
-    glm::mat4 depthProjMatrix = glm::ortho<float>(-max_half_width, max_half_width, -max_half_width, max_half_width, 0.1f, 1000.f);
-    glm::mat4 LightSpaceMatrix = depthProjMatrix * depthViewMatrix;
     glm::vec3 axis = glm::vec3(1.1f, 0.f, 0.9f);
     glm::mat4 rotMat = glm::rotate(glm::mat4(1.f), glm::radians(0.1f), axis);
     void update_light_vector();
@@ -127,6 +139,9 @@ signals:
     void sig_sendPlayerLook(QString) const;
     void sig_sendPlayerChunk(QString) const;
     void sig_sendPlayerTerrainZone(QString) const;
+    void sig_sendMeshMemory(QString) const;
+    void sig_sendGpuMemory(QString) const;
+    void sig_sendShadowCache(QString) const;
 };
 
 
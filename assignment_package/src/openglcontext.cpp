@@ -8,12 +8,31 @@
 
 
 OpenGLContext::OpenGLContext(QWidget *parent)
-    : QOpenGLWidget(parent)
+    : QOpenGLWidget(parent),
+      mp_multiDrawElementsBaseVertex(nullptr), m_multiDrawResolved(false)
 {}
 
 OpenGLContext::~OpenGLContext()
 {}
 
+int OpenGLContext::multiDrawElementsBaseVertex(GLenum mode, const GLsizei *count, GLenum type,
+                                               const void *const *indices, GLsizei drawcount, const GLint *basevertex)
+{
+    if (!m_multiDrawResolved) {
+        m_multiDrawResolved = true;
+        mp_multiDrawElementsBaseVertex = reinterpret_cast<MultiDrawElementsBaseVertex>(
+            context()->getProcAddress("glMultiDrawElementsBaseVertex"));
+    }
+    if (mp_multiDrawElementsBaseVertex != nullptr) {
+        mp_multiDrawElementsBaseVertex(mode, count, type, indices, drawcount, basevertex);
+        return 1;
+    }
+    for (GLsizei i = 0; i < drawcount; i++) {
+        glDrawElementsBaseVertex(mode, count[i], type, indices[i], basevertex[i]);
+    }
+    return drawcount;
+}
+
 inline const char *glGS(GLenum e)
 {
     return reinterpret_cast<const char *>(glGetString(e));
@@ -18,4 +18,16 @@ public:
     void printGLErrorLog();
     void printLinkInfoLog(int prog);
     void printShaderInfoLog(int shader);
+
+    // glMultiDrawElementsBaseVertex, which QOpenGLExtraFunctions does not
+    // wrap. Falls back to one glDrawElementsBaseVertex per draw if the
+    // driver does not have it. Returns the number of GL draw calls made.
+    int multiDrawElementsBaseVertex(GLenum mode, const GLsizei *count, GLenum type,
+                                    const void *const *indices, GLsizei drawcount, const GLint *basevertex);
+
+private:
+    typedef void (QOPENGLF_APIENTRYP MultiDrawElementsBaseVertex)(GLenum, const GLsizei*, GLenum,
+                                                                  const void *const *, GLsizei, const GLint*);
+    MultiDrawElementsBaseVertex mp_multiDrawElementsBaseVertex;
+    bool m_multiDrawResolved;
 };
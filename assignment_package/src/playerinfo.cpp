@@ -35,4 +35,13 @@ void PlayerInfo::slot_setChunkText(QString s) {
 void PlayerInfo::slot_setZoneText(QString s) {
     ui->zoneLabel->setText(s);
 }
+void PlayerInfo::slot_setMeshMemoryText(QString s) {
+    ui->meshMemoryLabel->setText(s);
+}
+void PlayerInfo::slot_setGpuMemoryText(QString s) {
+    ui->gpuMemoryLabel->setText(s);
+}
+void PlayerInfo::slot_setShadowCacheText(QString s) {
+    ui->shadowCacheLabel->setText(s);
+}
 
@@ -20,6 +20,9 @@ public slots:
     void slot_setLookText(QString);
     void slot_setChunkText(QString);
     void slot_setZoneText(QString);
+    void slot_setMeshMemoryText(QString);
+    void slot_setGpuMemoryText(QString);
+    void slot_setShadowCacheText(QString);
 
 private:
     Ui::PlayerInfo *ui;
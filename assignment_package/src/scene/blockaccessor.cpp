@@ -0,0 +1,24 @@
+#include "blockaccessor.h"
+#include "terrain.h"
+
+BlockAccessor::BlockAccessor(const Terrain &terrain)
+    : mcr_terrain(terrain), mp_chunk(nullptr), m_cx(INT_MIN), m_cz(INT_MIN)
+{}
+
+bool BlockAccessor::seekSlow(int cx, int cz)
+{
+    const Chunk *next = nullptr;
+    // One step, diagonals included, from a chunk we have: follow its link
+    if (mp_chunk != nullptr && std::abs(cx - m_cx) <= 1 && std::abs(cz - m_cz) <= 1) {
+        next = mp_chunk->getNeighbor(cx - m_cx, cz - m_cz);
+    }
+    // A missing link may just mean the neighbor was never linked, so
+    // only trust it when it points somewhere
+    if (next == nullptr) {
+        next = mcr_terrain.findChunk(16 * cx, 16 * cz);
+    }
+    mp_chunk = next;
+    m_cx = cx;
+    m_cz = cz;
+    return mp_chunk != nullptr;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "chunk.h"
+#include "chunkgrid.h"
+#include <optional>
+
+class Terrain;
+
+// A read cursor over the Terrain for code that asks about many nearby
+// blocks in a row, like raycasts and the player's ground checks.
+// It remembers the last Chunk it read from, and reaches the eight
+// chunks around it through their neighbor links, so coherent queries
+// never touch the chunk map. Nothing here throws: blocks in chunks
+// that do not exist come back as std::nullopt.
+// Like Terrain's own lookups it is for the GUI thread only, and must
+// not outlive a change to the set of loaded chunks.
+class BlockAccessor {
+public:
+    explicit BlockAccessor(const Terrain &terrain);
+
+    // The block at world coordinates (x, y, z). Heights outside
+    // [0, 256) read as EMPTY, the same as Terrain::getBlockAt().
+    std::optional<BlockType> get(int x, int y, int z) {
+        if (!seek(ChunkGrid::chunkCoord(x), ChunkGrid::chunkCoord(z))) {
+            return std::nullopt;
+        }
+        if (y < 0 || y >= 256) {
+            return EMPTY;
+        }
+        return mp_chunk->getLocalBlockAt(x & 15, y, z & 15);
+    }
+    // Truncates p the same way Terrain::getBlockAt(glm::vec3) does
+    std::optional<BlockType> get(glm::vec3 p) {
+        return get(static_cast<int>(p.x), static_cast<int>(p.y), static_cast<int>(p.z));
+    }
+
+private:
+    const Terrain &mcr_terrain;
+    const Chunk *mp_chunk;
+    int m_cx, m_cz;
+
+    // Points mp_chunk at chunk (cx, cz); false if it does not exist
+    bool seek(int cx, int cz) {
+        if (cx == m_cx && cz == m_cz) {
+            return mp_chunk != nullptr;
+        }
+        return seekSlow(cx, cz);
+    }
+    bool seekSlow(int cx, int cz);
+};
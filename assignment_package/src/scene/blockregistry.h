@@ -0,0 +1,78 @@
+#pragma once
+#include "chunkhelper.h"
+
+// Everything the game needs to know about a BlockType, in one table.
+// The mesher, the face mask kernel and the player's physics all read
+// these flat arrays, so adding a block type means adding an enum value
+// and a row below, and nothing else.
+
+// One face of a block: its tile in the 16 x 16 texture atlas and the
+// material code the mesher writes into uv.z for the shaders
+struct BlockFace {
+    unsigned char col, row;
+    float material;
+};
+
+struct BlockInfo {
+    bool opaque;      // hides the faces of the blocks next to it
+    bool transparent; // drawn in the transparent pass (only its top face shows)
+    bool liquid;      // the player swims in it rather than standing on it
+    bool collidable;  // the player collides with it, and raycasts stop at it
+    BlockFace faces[6]; // indexed by Direction
+};
+
+namespace BlockRegistry {
+
+// Material codes, see uv.z in Chunk::appendFace()
+constexpr float MAT_NONE = 0.f, MAT_GRASS_TOP = 0.2f, MAT_GRASS_SIDE = 0.3f,
+                MAT_LAVA = 0.5f, MAT_WATER = 1.f;
+
+constexpr BlockInfo sameFaces(bool opaque, bool transparent, bool liquid, bool collidable,
+                              unsigned char col, unsigned char row, float material) {
+    return {opaque, transparent, liquid, collidable,
+            {{col, row, material}, {col, row, material}, {col, row, material},
+             {col, row, material}, {col, row, material}, {col, row, material}}};
+}
+
+// Indexed by BlockType; faces in Direction order XPOS, XNEG, YPOS, YNEG, ZPOS, ZNEG
+constexpr BlockInfo INFO[] = {
+    /* EMPTY */ sameFaces(false, false, false, false, 0, 0, MAT_NONE),
+    /* GRASS */ {true, false, false, true,
+                 {{4, 11, MAT_GRASS_SIDE}, {4, 11, MAT_GRASS_SIDE}, {0, 15, MAT_GRASS_TOP},
+                  {2, 11, MAT_NONE}, {4, 11, MAT_GRASS_SIDE}, {4, 11, MAT_GRASS_SIDE}}},
+    /* DIRT  */ sameFaces(true, false, false, true, 2, 15, MAT_NONE),
+    /* STONE */ sameFaces(true, false, false, true, 1, 15, MAT_NONE),
+    /* WATER */ sameFaces(false, true, true, false, 14, 2, MAT_WATER),
+    /* LAVA  */ sameFaces(true, false, true, false, 14, 0, MAT_LAVA),
+    /* TRUNK */ {true, false, false, true,
+                 {{4, 14, MAT_NONE}, {4, 14, MAT_NONE}, {5, 14, MAT_NONE},
+                  {5, 14, MAT_NONE}, {4, 14, MAT_NONE}, {4, 14, MAT_NONE}}},
+    /* LEAF  */ sameFaces(true, false, false, true, 5, 12, MAT_NONE),
+};
+constexpr int COUNT = sizeof(INFO) / sizeof(INFO[0]);
+static_assert(COUNT == LEAF + 1, "every BlockType needs a row in BlockRegistry::INFO");
+
+// True when EMPTY and WATER are the only blocks that are not opaque and
+// WATER is the only transparent one, which lets the face mask kernel
+// classify 16 blocks at once with two SSE2 compares
+constexpr bool onlyEmptyAndWaterSeeThrough() {
+    for (int t = 0; t < COUNT; t++) {
+        bool expectOpaque = t != EMPTY && t != WATER;
+        if (INFO[t].opaque != expectOpaque || INFO[t].transparent != (t == WATER)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace BlockRegistry
+
+inline const BlockInfo& blockInfo(BlockType t) {
+    return BlockRegistry::INFO[t];
+}
+
+// Atlas UV of a block face, with the material code in z
+inline glm::vec4 blockFaceUV(BlockType t, Direction d) {
+    const BlockFace &f = BlockRegistry::INFO[t].faces[d];
+    return glm::vec4(f.col * GRID, f.row * GRID, f.material, 0);
+}
@@ -21,4 +21,6 @@ public:
     void tick(float dT, InputBundle &input) override;
 
     glm::mat4 getViewProj() const;
+    float getNearClip() const { return m_near_clip; }
+    float getFarClip() const { return m_far_clip; }
 };
@@ -1,10 +1,118 @@
 #include "chunk.h"
+#include "chunkresidency.h"
+#include "evictedmesh.h"
 #include <iostream>
 
-Chunk::Chunk(int x, int z, OpenGLContext* context)
-    : Drawable(context), m_blocks(), minX(x), minZ(z), m_neighbors{{XPOS, nullptr}, {XNEG, nullptr}, {ZPOS, nullptr}, {ZNEG, nullptr}}, vboData(this)
+namespace {
+std::atomic<uint64_t> nextSerial(1);
+
+// Mixes the world seed with a position into a seed for one generator,
+// so that every chunk and column gets its own repeatable randomness
+uint32_t hashSeed(uint32_t seed, int x, int z) {
+    uint64_t h = seed;
+    h = (h ^ static_cast<uint32_t>(x)) * 0x9E3779B97F4A7C15ull;
+    h = (h ^ static_cast<uint32_t>(z)) * 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 31;
+    return static_cast<uint32_t>(h ^ (h >> 32));
+}
+}
+
+Chunk::Chunk(int x, int z, OpenGLContext* context, MeshArena* arena, MeshArena* depthArena,
+             ChunkResidency* residency)
+    : Drawable(context), m_blocks(), minX(x), minZ(z), m_serial(nextSerial.fetch_add(1)), m_neighbors{},
+      m_blockDataReady(false),
+      m_meshVersion(0), m_uploadedVersion(0), m_dirtySections(0), mp_pendingMesh(nullptr),
+      m_unsaved(false), m_staleBlocks(false), mp_edited(nullptr),
+      mp_arena(arena), m_meshOpq(MeshArena::NONE), m_meshTra(MeshArena::NONE),
+      mp_depthArena(depthArena), m_meshDepth(MeshArena::NONE), m_meshShadow(MeshArena::NONE), m_gpuBytes(0), mp_residency(residency), m_savedEdits(), m_editsTracked(true)
 {
     std::fill_n(m_blocks.begin(), 65536, EMPTY);
+    m_neighbors[neighborIndex(0, 0)] = this;
+}
+
+void Chunk::reset(int x, int z)
+{
+    minX = x;
+    minZ = z;
+    m_serial = nextSerial.fetch_add(1);
+    m_neighbors.fill(nullptr);
+    m_neighbors[neighborIndex(0, 0)] = this;
+    m_blockDataReady.store(false, std::memory_order_relaxed);
+    m_meshVersion = m_uploadedVersion = 0;
+    m_dirtySections = 0;
+    MeshBufferPool::release(std::move(mp_pendingMesh));
+    m_countOpq = m_countTra = 0;
+    m_unsaved = false;
+    // Now, not when the new blocks are generated: lookups, and the meshes
+    // of its neighbors, read the chunk before then
+    m_blocks.fill(EMPTY);
+    m_staleBlocks = false;
+    mp_edited.reset();
+    m_savedEdits.clear();
+    m_editsTracked = true;
+}
+
+void Chunk::setGpuBytes(size_t bytes)
+{
+    if (mp_residency != nullptr) {
+        mp_residency->noteGpuBytes(m_gpuBytes, bytes);
+    }
+    m_gpuBytes = bytes;
+}
+
+void Chunk::destroyVBOdata()
+{
+    // The Drawable buffers are never generated; the mesh is in the arena
+    if (mp_arena != nullptr) {
+        if (m_meshOpq != MeshArena::NONE || m_meshTra != MeshArena::NONE) {
+            mp_arena->noteChange(glm::ivec2(minX, minZ));
+        }
+        mp_arena->release(m_meshOpq);
+        mp_arena->release(m_meshTra);
+    }
+    if (mp_depthArena != nullptr) {
+        mp_depthArena->release(m_meshDepth);
+        mp_depthArena->release(m_meshShadow);
+    }
+    m_meshOpq = m_meshTra = m_meshDepth = m_meshShadow = MeshArena::NONE;
+    m_countOpq = m_countTra = 0;
+    setGpuBytes(0);
+}
+
+void Chunk::recordEdit(int x, int y, int z)
+{
+    if (mp_edited == nullptr) {
+        mp_edited = mkU<std::bitset<65536>>();
+    }
+    mp_edited->set(x + 16 * y + 4096 * z);
+}
+
+std::vector<BlockEdit> Chunk::edits() const
+{
+    std::vector<BlockEdit> out;
+    if (mp_edited == nullptr) {
+        return out;
+    }
+    for (size_t i = 0; i < mp_edited->size(); i++) {
+        if (mp_edited->test(i)) {
+            out.push_back({static_cast<uint16_t>(i), m_blocks[i]});
+        }
+    }
+    return out;
+}
+
+void Chunk::publishBlockData(bool unsaved)
+{
+    m_unsaved = unsaved;
+    m_blockDataReady.store(true, std::memory_order_release);
+}
+
+void Chunk::clearStaleBlocks()
+{
+    if (m_staleBlocks) {
+        m_blocks.fill(EMPTY);
+        m_staleBlocks = false;
+    }
 }
 
 // Does bounds checking with at()
@@ -23,19 +131,22 @@ void Chunk::setBlockAt(unsigned int x, unsigned int y, unsigned int z, BlockType
 }
 
 
-const static std::unordered_map<Direction, Direction, EnumHash> oppositeDirection {
-    {XPOS, XNEG},
-    {XNEG, XPOS},
-    {YPOS, YNEG},
-    {YNEG, YPOS},
-    {ZPOS, ZNEG},
-    {ZNEG, ZPOS}
-};
-
-void Chunk::linkNeighbor(uPtr<Chunk> &neighbor, Direction dir) {
+void Chunk::linkNeighbor(Chunk* neighbor, int dx, int dz) {
     if(neighbor != nullptr) {
-        this->m_neighbors[dir] = neighbor.get();
-        neighbor->m_neighbors[oppositeDirection.at(dir)] = this;
+        this->m_neighbors[neighborIndex(dx, dz)] = neighbor;
+        neighbor->m_neighbors[neighborIndex(-dx, -dz)] = this;
+    }
+}
+
+void Chunk::unlinkNeighbors() {
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            Chunk* &n = m_neighbors[neighborIndex(dx, dz)];
+            if (n != nullptr && n != this) {
+                n->m_neighbors[neighborIndex(-dx, -dz)] = nullptr;
+                n = nullptr;
+            }
+        }
     }
 }
 
@@ -61,18 +172,18 @@ int Chunk::is_boundary(int x, int y, int z) const
     }
 
     // x neg face direction
-    if ((x == 0 && m_neighbors.at(XNEG) == nullptr) ||
-        (x == 0 && m_neighbors.at(XNEG)->getBlockAt(15, y, z) == EMPTY) ||
+    if ((x == 0 && getNeighbor(XNEG) == nullptr) ||
+        (x == 0 && getNeighbor(XNEG)->getBlockAt(15, y, z) == EMPTY) ||
         (x != 0 && getBlockAt(x - 1, y, z) == EMPTY) ||
-        (x == 0 && m_neighbors.at(XNEG)->getBlockAt(15, y, z) == WATER) ||
+        (x == 0 && getNeighbor(XNEG)->getBlockAt(15, y, z) == WATER) ||
         (x != 0 && getBlockAt(x - 1, y, z) == WATER))
         res = res | 0b100000;
 
     // x pos face direction
-    if ((x == 15 && m_neighbors.at(XPOS) == nullptr) ||
-        (x == 15 && m_neighbors.at(XPOS)->getBlockAt(0, y, z) == EMPTY) ||
+    if ((x == 15 && getNeighbor(XPOS) == nullptr) ||
+        (x == 15 && getNeighbor(XPOS)->getBlockAt(0, y, z) == EMPTY) ||
         (x != 15 && getBlockAt(x + 1, y, z) == EMPTY) ||
-        (x == 15 && m_neighbors.at(XPOS)->getBlockAt(0, y, z) == WATER) ||
+        (x == 15 && getNeighbor(XPOS)->getBlockAt(0, y, z) == WATER) ||
         (x != 15 && getBlockAt(x + 1, y, z) == WATER))
         res = res | 0b010000;
 
@@ -89,18 +200,18 @@ int Chunk::is_boundary(int x, int y, int z) const
         res = res | 0b000100;
 
     // z neg face direction
-    if ((z == 0 && m_neighbors.at(ZNEG) == nullptr) ||
-        (z == 0 && m_neighbors.at(ZNEG)->getBlockAt(x, y, 15) == EMPTY) ||
+    if ((z == 0 && getNeighbor(ZNEG) == nullptr) ||
+        (z == 0 && getNeighbor(ZNEG)->getBlockAt(x, y, 15) == EMPTY) ||
         (z != 0 && getBlockAt(x, y, z - 1) == EMPTY) ||
-        (z == 0 && m_neighbors.at(ZNEG)->getBlockAt(x, y, 15) == WATER) ||
+        (z == 0 && getNeighbor(ZNEG)->getBlockAt(x, y, 15) == WATER) ||
         (z != 0 && getBlockAt(x, y, z - 1) == WATER))
         res = res | 0b000010;
 
     // z pos face direction
-    if ((z == 15 && m_neighbors.at(ZPOS) == nullptr) ||
-        (z == 15 && m_neighbors.at(ZPOS)->getBlockAt(x, y, 0) == EMPTY) ||
+    if ((z == 15 && getNeighbor(ZPOS) == nullptr) ||
+        (z == 15 && getNeighbor(ZPOS)->getBlockAt(x, y, 0) == EMPTY) ||
         (z != 15 && getBlockAt(x, y, z + 1) == EMPTY) ||
-        (z == 15 && m_neighbors.at(ZPOS)->getBlockAt(x, y, 0) == WATER) ||
+        (z == 15 && getNeighbor(ZPOS)->getBlockAt(x, y, 0) == WATER) ||
         (z != 15 && getBlockAt(x, y, z + 1) == WATER))
         res = res | 0b000001;
 
@@ -108,246 +219,264 @@ int Chunk::is_boundary(int x, int y, int z) const
 }
 
 
-void Chunk::createVBOdata()
+uPtr<ChunkSnapshot> Chunk::snapshot()
 {
+    uPtr<ChunkSnapshot> s = mkU<ChunkSnapshot>();
+    s->capture(*this);
+    s->version = ++m_meshVersion;
+    m_dirtySections = 0;
+    return s;
+}
 
-    for (unsigned int x = 0; x < 16; x++)
-        for (unsigned int y = 0; y < 256; y++)
-            for (unsigned int z = 0; z < 16; z++)
-            {
-                int boundary_info = is_boundary(x, y, z);
-
-                // empty block or no boundaries. No need to draw
-                if (boundary_info == 0)
-                    continue;
-
-                BlockType t = getBlockAt(x, y, z);
-
-                // choose the correct data buffer according to whther the block is opaque
-                // should change to a set for futhre work
-                std::vector<glm::vec4>& data_to_push = (t == WATER) ? vboData.m_vboDataTransparent : vboData.m_vboDataOpaque;
-
-                glm::vec4 uv;
-                // draw x neg face
-                if ((boundary_info & 0b100000) != 0)
-                {
-                    uv = glm::vec4(blockFaceUVs.at(t).at(XNEG), 0, 0);
-                    if (t == WATER)  // WATER
-                        uv[2] = 1.0;
-                    if (t == LAVA)  // LAVA
-                        uv[2] = 0.5;
-                    if (t == GRASS)  // GRASSSIDE
-                        uv[2] = 0.3;
-
-                    data_to_push.push_back(glm::vec4(0.0 + x + minX, 1.0 + y, 1.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(-1.0, 0.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(0, GRID, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(0.0 + x + minX, 0.0 + y, 1.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(-1.0, 0.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(0, 0, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(0.0 + x + minX, 0.0 + y, 0.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(-1.0, 0.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(GRID, 0, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(0.0 + x + minX, 1.0 + y, 0.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(-1.0, 0.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(GRID, GRID, 0, 0));
-                }
-
-                // draw x pos face
-                if ((boundary_info & 0b010000) != 0)
-                {
-                    uv = glm::vec4(blockFaceUVs.at(t).at(XPOS), 0, 0);
-                    if (t == WATER)  // WATER
-                        uv[2] = 1.0;
-                    if (t == LAVA)  // LAVA
-                        uv[2] = 0.5;
-                    if (t == GRASS)  // GRASSSIDE
-                        uv[2] = 0.3;
-
-                    data_to_push.push_back(glm::vec4(1.0 + x + minX, 1.0 + y, 0.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(1.0, 0.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(0, GRID, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(1.0 + x + minX, 0.0 + y, 0.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(1.0, 0.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(0, 0, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(1.0 + x + minX, 0.0 + y, 1.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(1.0, 0.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(GRID, 0, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(1.0 + x + minX, 1.0 + y, 1.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(1.0, 0.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(GRID, GRID, 0, 0));
-                }
-
-                // draw y neg face
-                if ((boundary_info & 0b001000) != 0)
-                {
-                    uv = glm::vec4(blockFaceUVs.at(t).at(YNEG), 0, 0);
-                    if (t == WATER)  // WATER
-                        uv[2] = 1.0;
-                    if (t == LAVA)  // LAVA
-                        uv[2] = 0.5;
-
-                    data_to_push.push_back(glm::vec4(1.0 + x + minX, 0.0 + y, 1.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, -1.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(0, GRID, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(1.0 + x + minX, 0.0 + y, 0.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, -1.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(0, 0, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(0.0 + x + minX, 0.0 + y, 0.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, -1.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(GRID, 0, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(0.0 + x + minX, 0.0 + y, 1.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, -1.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(GRID, GRID, 0, 0));
-                }
-
-                // draw y pos face
-                if ((boundary_info & 0b000100) != 0)
-                {
-                    uv = glm::vec4(blockFaceUVs.at(t).at(YPOS), 0, 0);
-                    if (t == WATER)  // WATER
-                        uv[2] = 1.0;
-                    if (t == LAVA)  // LAVA
-                        uv[2] = 0.5;
-                    if (t == GRASS)  // GRASSTOP
-                        uv[2] = 0.2;
-
-                    data_to_push.push_back(glm::vec4(1.0 + x + minX, 1.0 + y, 0.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, 1.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(0, GRID, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(1.0 + x + minX, 1.0 + y, 1.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, 1.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(0, 0, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(0.0 + x + minX, 1.0 + y, 1.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, 1.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(GRID, 0, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(0.0 + x + minX, 1.0 + y, 0.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, 1.0, 0.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(GRID, GRID, 0, 0));
-                }
+void Chunk::markDirty(int yMin, int yMax)
+{
+    // bits yMin / 16 through yMax / 16
+    int lo = yMin >> 4, hi = yMax >> 4;
+    m_dirtySections |= static_cast<uint16_t>(((2u << hi) - 1) & ~((1u << lo) - 1));
+    m_unsaved = true;
+}
 
-                // draw z neg face
-                if ((boundary_info & 0b000010) != 0)
-                {
-                    uv = glm::vec4(blockFaceUVs.at(t).at(ZNEG), 0, 0);
-                    if (t == WATER)  // WATER
-                        uv[2] = 1.0;
-                    if (t == LAVA)  // LAVA
-                        uv[2] = 0.5;
-                    if (t == GRASS)  // GRASSSIDE
-                        uv[2] = 0.3;
-
-                    data_to_push.push_back(glm::vec4(0.0 + x + minX, 1.0 + y, 0.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, 0.0, -1.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(0, GRID, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(0.0 + x + minX, 0.0 + y, 0.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, 0.0, -1.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(0, 0, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(1.0 + x + minX, 0.0 + y, 0.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, 0.0, -1.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(GRID, 0, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(1.0 + x + minX, 1.0 + y, 0.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, 0.0, -1.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(GRID, GRID, 0, 0));
-                }
+void Chunk::createVBOdata()
+{
+    // A mesh that was never bound is simply replaced
+    MeshBufferPool::release(std::move(mp_pendingMesh));
+    mp_pendingMesh = createMesh(*snapshot());
+}
 
-                // draw z pos face
-                if ((boundary_info & 0b000001) != 0)
-                {
-                    uv = glm::vec4(blockFaceUVs.at(t).at(ZPOS), 0, 0);
-                    if (t == WATER)  // WATER
-                        uv[2] = 1.0;
-                    if (t == LAVA)  // LAVA
-                        uv[2] = 0.5;
-                    if (t == GRASS)  // GRASSSIDE
-                        uv[2] = 0.3;
-
-                    data_to_push.push_back(glm::vec4(1.0 + x + minX, 1.0 + y, 1.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, 0.0, 1.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(0, GRID, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(1.0 + x + minX, 0.0 + y, 1.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, 0.0, 1.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(0, 0, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(0.0 + x + minX, 0.0 + y, 1.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, 0.0, 1.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(GRID, 0, 0, 0));
-
-                    data_to_push.push_back(glm::vec4(0.0 + x + minX, 1.0 + y, 1.0 + z + minZ, 1.0));
-                    data_to_push.push_back(glm::vec4(0.0, 0.0, 1.0, 0.0));
-                    data_to_push.push_back(uv + glm::vec4(GRID, GRID, 0, 0));
-                }
-            }
+uPtr<ChunkOpaqueTransparentVBOData> Chunk::createMesh(const ChunkSnapshot &snapshot)
+{
+    uPtr<ChunkOpaqueTransparentVBOData> data = MeshBufferPool::acquire(this);
+    data->m_version = snapshot.version;
+    buildMesh(snapshot, *data);
+    return data;
+}
 
-    // generate index data according to the number of face to render
-    int num_faces_opaque = vboData.m_vboDataOpaque.size() / 4 / 3;
-    for (int i = 0; i < num_faces_opaque; i++)
-    {
-        vboData.m_idxDataOpaque.push_back(i * 4);
-        vboData.m_idxDataOpaque.push_back(i * 4 + 1);
-        vboData.m_idxDataOpaque.push_back(i * 4 + 2);
-        vboData.m_idxDataOpaque.push_back(i * 4);
-        vboData.m_idxDataOpaque.push_back(i * 4 + 2);
-        vboData.m_idxDataOpaque.push_back(i * 4 + 3);
-    }
-    int num_faces_transparent = vboData.m_vboDataTransparent.size() / 4 / 3;
-    for (int i = 0; i < num_faces_transparent; i++)
+void Chunk::buildMesh(const ChunkSnapshot &snapshot, ChunkOpaqueTransparentVBOData &out) const
+{
+    // One thread-local set of masks per worker; they are 64 KB, too big
+    // to want on a worker's stack and too hot to reallocate per chunk.
+    static thread_local ChunkFaceMasks masks;
+    masks.compute(snapshot);
+
+    // The masks tell us exactly how many faces we are about to emit
+    int num_faces_transparent = masks.waterFaceCount();
+    int num_faces_opaque = masks.faceCount() - num_faces_transparent;
+    out.reserve(num_faces_opaque, num_faces_transparent, num_faces_opaque);
+
+    static const Direction faceOrder[6] = {XNEG, XPOS, YNEG, YPOS, ZNEG, ZPOS};
+    for (Direction d : faceOrder)
     {
-        vboData.m_idxDataTransparent.push_back(i * 4);
-        vboData.m_idxDataTransparent.push_back(i * 4 + 1);
-        vboData.m_idxDataTransparent.push_back(i * 4 + 2);
-        vboData.m_idxDataTransparent.push_back(i * 4);
-        vboData.m_idxDataTransparent.push_back(i * 4 + 2);
-        vboData.m_idxDataTransparent.push_back(i * 4 + 3);
+        const auto &faces = masks.m_faces[d];
+        for (int slab = 0; slab < ChunkFaceMasks::SLAB_COUNT; slab++)
+        {
+            // visit every set bit of the slab, i.e. every exposed face
+            for (uint64_t bits = faces[slab]; bits != 0; bits &= bits - 1)
+            {
+                int bit = lowestSetBit(bits);
+                int x = ChunkFaceMasks::slabX(bit);
+                int y = ChunkFaceMasks::slabY(slab);
+                int z = ChunkFaceMasks::slabZ(slab, bit);
+                BlockType t = snapshot.at(x, y, z);
+
+                // choose the correct data buffer according to whether the block is transparent
+                std::vector<glm::vec4>& data_to_push = blockInfo(t).transparent ? out.m_vboDataTransparent : out.m_vboDataOpaque;
+                appendFace(data_to_push, d, t, x, y, z);
+            }
+        }
     }
 
-    m_countOpq = vboData.m_idxDataOpaque.size();
-    m_countTra = vboData.m_idxDataTransparent.size();
+    // The depth-only passes read nothing but positions: the opaque ones
+    // as they are for the prepass, and merged for the shadow maps
+    for (size_t v = 0; v < out.m_vboDataOpaque.size(); v += 3) {
+        out.m_vboDataDepth.push_back(glm::vec3(out.m_vboDataOpaque[v]));
+    }
+    masks.appendMergedOpaqueFaces(minX, minZ, out.m_vboDataShadow);
 }
 
-void Chunk::bindVBOdata()
+void Chunk::appendFace(std::vector<glm::vec4> &data_to_push, Direction d, BlockType t, int x, int y, int z) const
 {
-    // buff vertex data and indices into proper VBOs.
-    if (m_countOpq > 0)
+    // atlas tile in xy, material code in z
+    glm::vec4 uv = blockFaceUV(t, d);
+    switch (d)
     {
-        generateIdxOpq();
-        mp_context->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_bufIdxOpq);
-        mp_context->glBufferData(GL_ELEMENT_ARRAY_BUFFER, vboData.m_idxDataOpaque.size() * sizeof(GLuint), vboData.m_idxDataOpaque.data(), GL_STATIC_DRAW);
-
-        generateDataOpq();
-        mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_bufDataOpq);
-        mp_context->glBufferData(GL_ARRAY_BUFFER, vboData.m_vboDataOpaque.size() * sizeof(glm::vec4), vboData.m_vboDataOpaque.data(), GL_STATIC_DRAW);
+    case XNEG:
+        data_to_push.push_back(glm::vec4(0.0 + x + minX, 1.0 + y, 1.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(-1.0, 0.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(0, GRID, 0, 0));
+
+        data_to_push.push_back(glm::vec4(0.0 + x + minX, 0.0 + y, 1.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(-1.0, 0.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(0, 0, 0, 0));
+
+        data_to_push.push_back(glm::vec4(0.0 + x + minX, 0.0 + y, 0.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(-1.0, 0.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(GRID, 0, 0, 0));
+
+        data_to_push.push_back(glm::vec4(0.0 + x + minX, 1.0 + y, 0.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(-1.0, 0.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(GRID, GRID, 0, 0));
+        break;
+    case XPOS:
+        data_to_push.push_back(glm::vec4(1.0 + x + minX, 1.0 + y, 0.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(1.0, 0.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(0, GRID, 0, 0));
+
+        data_to_push.push_back(glm::vec4(1.0 + x + minX, 0.0 + y, 0.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(1.0, 0.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(0, 0, 0, 0));
+
+        data_to_push.push_back(glm::vec4(1.0 + x + minX, 0.0 + y, 1.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(1.0, 0.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(GRID, 0, 0, 0));
+
+        data_to_push.push_back(glm::vec4(1.0 + x + minX, 1.0 + y, 1.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(1.0, 0.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(GRID, GRID, 0, 0));
+        break;
+    case YNEG:
+        data_to_push.push_back(glm::vec4(1.0 + x + minX, 0.0 + y, 1.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, -1.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(0, GRID, 0, 0));
+
+        data_to_push.push_back(glm::vec4(1.0 + x + minX, 0.0 + y, 0.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, -1.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(0, 0, 0, 0));
+
+        data_to_push.push_back(glm::vec4(0.0 + x + minX, 0.0 + y, 0.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, -1.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(GRID, 0, 0, 0));
+
+        data_to_push.push_back(glm::vec4(0.0 + x + minX, 0.0 + y, 1.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, -1.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(GRID, GRID, 0, 0));
+        break;
+    case YPOS:
+        data_to_push.push_back(glm::vec4(1.0 + x + minX, 1.0 + y, 0.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, 1.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(0, GRID, 0, 0));
+
+        data_to_push.push_back(glm::vec4(1.0 + x + minX, 1.0 + y, 1.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, 1.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(0, 0, 0, 0));
+
+        data_to_push.push_back(glm::vec4(0.0 + x + minX, 1.0 + y, 1.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, 1.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(GRID, 0, 0, 0));
+
+        data_to_push.push_back(glm::vec4(0.0 + x + minX, 1.0 + y, 0.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, 1.0, 0.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(GRID, GRID, 0, 0));
+        break;
+    case ZNEG:
+        data_to_push.push_back(glm::vec4(0.0 + x + minX, 1.0 + y, 0.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, 0.0, -1.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(0, GRID, 0, 0));
+
+        data_to_push.push_back(glm::vec4(0.0 + x + minX, 0.0 + y, 0.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, 0.0, -1.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(0, 0, 0, 0));
+
+        data_to_push.push_back(glm::vec4(1.0 + x + minX, 0.0 + y, 0.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, 0.0, -1.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(GRID, 0, 0, 0));
+
+        data_to_push.push_back(glm::vec4(1.0 + x + minX, 1.0 + y, 0.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, 0.0, -1.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(GRID, GRID, 0, 0));
+        break;
+    case ZPOS:
+        data_to_push.push_back(glm::vec4(1.0 + x + minX, 1.0 + y, 1.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, 0.0, 1.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(0, GRID, 0, 0));
+
+        data_to_push.push_back(glm::vec4(1.0 + x + minX, 0.0 + y, 1.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, 0.0, 1.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(0, 0, 0, 0));
+
+        data_to_push.push_back(glm::vec4(0.0 + x + minX, 0.0 + y, 1.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, 0.0, 1.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(GRID, 0, 0, 0));
+
+        data_to_push.push_back(glm::vec4(0.0 + x + minX, 1.0 + y, 1.0 + z + minZ, 1.0));
+        data_to_push.push_back(glm::vec4(0.0, 0.0, 1.0, 0.0));
+        data_to_push.push_back(uv + glm::vec4(GRID, GRID, 0, 0));
+        break;
     }
+}
 
-    if (m_countTra > 0)
+void Chunk::bindVBOdata()
+{
+    bindVBOdata(std::move(mp_pendingMesh));
+}
+
+void Chunk::bindVBOdata(uPtr<ChunkOpaqueTransparentVBOData> vboData)
+{
+    if (vboData == nullptr)
+        return;
+    if (vboData->m_version < m_uploadedVersion)
     {
-        generateIdxTra();
-        mp_context->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_bufIdxTra);
-        mp_context->glBufferData(GL_ELEMENT_ARRAY_BUFFER, vboData.m_idxDataTransparent.size() * sizeof(GLuint), vboData.m_idxDataTransparent.data(), GL_STATIC_DRAW);
+        MeshBufferPool::release(std::move(vboData));
+        return;
+    }
+    m_uploadedVersion = vboData->m_version;
+    m_countOpq = 6 * vboData->opaqueFaces();
+    m_countTra = 6 * vboData->transparentFaces();
+
+    // Free the space of the old mesh first, so the new one can reuse it
+    mp_arena->release(m_meshOpq);
+    mp_arena->release(m_meshTra);
+    mp_depthArena->release(m_meshDepth);
+    mp_depthArena->release(m_meshShadow);
+    m_meshOpq = mp_arena->upload(vboData->m_vboDataOpaque);
+    m_meshTra = mp_arena->upload(vboData->m_vboDataTransparent);
+    m_meshDepth = mp_depthArena->upload(vboData->m_vboDataDepth);
+    m_meshShadow = mp_depthArena->upload(vboData->m_vboDataShadow);
+    mp_arena->noteChange(glm::ivec2(minX, minZ));
+    setGpuBytes(vboData->gpuBytes());
+
+    // The GPU has its own copy now
+    MeshBufferPool::release(std::move(vboData));
+}
 
-        generateDataTra();
-        mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_bufDataTra);
-        mp_context->glBufferData(GL_ARRAY_BUFFER, vboData.m_vboDataTransparent.size() * sizeof(glm::vec4), vboData.m_vboDataTransparent.data(), GL_STATIC_DRAW);
+uPtr<EvictedMesh> Chunk::evictMesh()
+{
+    uPtr<EvictedMesh> evicted = nullptr;
+    if (mp_context != nullptr && hasVBOdata()) {
+        uPtr<ChunkOpaqueTransparentVBOData> copy = MeshBufferPool::acquire(this);
+        copy->m_version = m_uploadedVersion;
+        int opaque = mp_arena->faces(m_meshOpq), transparent = mp_arena->faces(m_meshTra);
+        int shadow = mp_depthArena->faces(m_meshShadow);
+        copy->reserve(opaque, transparent, shadow);
+        copy->m_vboDataOpaque.resize(MeshArena::VEC4S_PER_FACE * opaque);
+        copy->m_vboDataTransparent.resize(MeshArena::VEC4S_PER_FACE * transparent);
+        copy->m_vboDataDepth.resize(4 * mp_depthArena->faces(m_meshDepth));
+        copy->m_vboDataShadow.resize(4 * shadow);
+
+        // All four passes, one after the other, in a buffer of their own
+        size_t offsets[4] = {0};
+        offsets[1] = offsets[0] + copy->m_vboDataOpaque.size() * sizeof(glm::vec4);
+        offsets[2] = offsets[1] + copy->m_vboDataTransparent.size() * sizeof(glm::vec4);
+        offsets[3] = offsets[2] + copy->m_vboDataDepth.size() * sizeof(glm::vec3);
+        size_t bytes = offsets[3] + copy->m_vboDataShadow.size() * sizeof(glm::vec3);
+        GLuint buffer;
+        mp_context->glGenBuffers(1, &buffer);
+        mp_context->glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        mp_context->glBufferData(GL_COPY_WRITE_BUFFER, bytes, nullptr, GL_STREAM_READ);
+        mp_arena->copyOut(m_meshOpq, buffer, offsets[0]);
+        mp_arena->copyOut(m_meshTra, buffer, offsets[1]);
+        mp_depthArena->copyOut(m_meshDepth, buffer, offsets[2]);
+        mp_depthArena->copyOut(m_meshShadow, buffer, offsets[3]);
+        evicted = mkU<EvictedMesh>(mp_context, std::move(copy), buffer);
+        destroyVBOdata();
     }
+    m_countOpq = m_countTra = 0;
+    m_uploadedVersion = 0;
+    setGpuBytes(0);
+    return evicted;
 }
 
-void Chunk::createChunkBlockData(){
+void Chunk::createChunkBlockData(uint32_t seed){
+    clearStaleBlocks();
     std::vector<std::vector<int>> heights(16, std::vector<int>(16));
     std::vector<std::vector<BiomeType>> biomes(16, std::vector<BiomeType>(16));
 
@@ -355,22 +484,29 @@ void Chunk::createChunkBlockData(){
         for(int z = minZ; z < minZ + 16; ++z) {
             BiomeType biome;
             int height;
-            getHeight(x,z,height,biome);
+            getHeight(x,z,height,biome,seed);
             heights[x-minX][z-minZ] = height;
             biomes[x-minX][z-minZ] = biome;
             fillTerrainBlocks(x, z, biome, height);
         }
     }
 
-    placeTree(heights, biomes);
-
-
+    placeTree(heights, biomes, seed);
 
+    // Put back what the player changed, if this chunk was saved as edits
+    for (const BlockEdit &e : m_savedEdits) {
+        m_blocks[e.index] = e.type;
+        recordEdit(e.index & 15, (e.index >> 4) & 255, e.index >> 12);
+    }
+    m_savedEdits.clear();
+    m_editsTracked = true;
 }
 
-void Chunk::placeTree(std::vector<std::vector<int>>& heights, std::vector<std::vector<BiomeType>>& biomes){
-    std::srand(std::time(nullptr) + minX + minZ);
-    int numTrees = std::rand() % 3;
+void Chunk::placeTree(std::vector<std::vector<int>>& heights, std::vector<std::vector<BiomeType>>& biomes, uint32_t seed){
+    // mt19937's output is fixed by the standard, unlike std::rand()'s,
+    // which is also shared by every worker thread
+    std::mt19937 gen(hashSeed(seed, minX, minZ));
+    int numTrees = gen() % 3;
     std::vector<glm::vec2> treesPos;
     auto isValid = [&treesPos](const glm::vec2& newPoint) {
         for (const auto& point : treesPos) {
@@ -385,7 +521,8 @@ void Chunk::placeTree(std::vector<std::vector<int>>& heights, std::vector<std::v
     int tryTimes = 0;
     while (treesPos.size() < numTrees && tryTimes < maxTry) {
         tryTimes++;
-        glm::vec2 newPoint = {std::rand() % 11 + 3, std::rand() % 11 + 3};
+        int px = gen() % 11 + 3, pz = gen() % 11 + 3;
+        glm::vec2 newPoint(px, pz);
         if (isValid(newPoint))
             treesPos.push_back(newPoint);
     }
@@ -523,15 +660,7 @@ void Chunk::refreshChunkVBOData(){
     bindVBOdata();
 }
 
-void Chunk::refreshAdjacentChunkVBOData(){
-
-    m_neighbors[XNEG]->refreshChunkVBOData();
-    m_neighbors[XPOS]->refreshChunkVBOData();
-    m_neighbors[ZNEG]->refreshChunkVBOData();
-    m_neighbors[ZPOS]->refreshChunkVBOData();
-}
-
-void Chunk::getHeight(int x, int z, int& y, BiomeType& b) {
+void Chunk::getHeight(int x, int z, int& y, BiomeType& b, uint32_t seed) {
     x += 10000;
     z += 10000;
     // Noise settings for biome determination and height variation.
@@ -561,10 +690,15 @@ void Chunk::getHeight(int x, int z, int& y, BiomeType& b) {
         float smoothStepResult = glm::smoothstep(0.0f, 1.0f, smoothStepInput);
         height += plainsHeight * (1.0f - smoothStepResult) + desertHeight * smoothStepResult;
 
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::normal_distribution<> dis(0.5, 0.2);
-        float u = dis(gen);
+        // Roughly normal around 0.5 with deviation 0.2: the sum of four
+        // uniform samples, since std::normal_distribution's results
+        // differ between standard libraries
+        std::mt19937 gen(hashSeed(seed, x, z));
+        float sum = 0.f;
+        for (int i = 0; i < 4; i++) {
+            sum += gen() / 4294967296.f;
+        }
+        float u = 0.5f + (sum - 2.f) * 1.7320508f * 0.2f;
 
         b = smoothStepResult < u ? BiomeType::PLAIN : BiomeType::DESSERT;
     }
@@ -1,9 +1,16 @@
 #pragma once
 #include "chunkhelper.h"
+#include "blockregistry.h"
+#include "chunkmesher.h"
+#include "meshpool.h"
+#include "mesharena.h"
 #include <random>
+#include <bitset>
+#include <atomic>
 
 class Terrain;
-struct ChunkOpaqueTransparentVBOData;
+class ChunkResidency;
+class EvictedMesh;
 //using namespace std;
 
 // C++ 11 allows us to define the size of an enum. This lets us use only one byte
@@ -12,19 +19,6 @@ struct ChunkOpaqueTransparentVBOData;
 // block types, but in the scope of this project we'll never get anywhere near that many.
 
 
-//Leave for opaque and transparent data
-class Chunk;
-struct ChunkOpaqueTransparentVBOData {
-    Chunk* mp_chunk;
-    std::vector<glm::vec4> m_vboDataOpaque, m_vboDataTransparent;
-    std::vector<GLuint> m_idxDataOpaque, m_idxDataTransparent;
-
-    ChunkOpaqueTransparentVBOData(Chunk* c) :
-        mp_chunk(c), m_vboDataOpaque{}, m_vboDataTransparent{},
-        m_idxDataOpaque{}, m_idxDataTransparent{}
-    {}
-};
-
 // One Chunk is a 16 x 256 x 16 section of the world,
 // containing all the Minecraft blocks in that area.
 // We divide the world into Chunks in order to make
@@ -39,36 +33,176 @@ private:
     // All of the blocks contained within this Chunk
     std::array<BlockType, 65536> m_blocks;
     int minX, minZ;
-    // This Chunk's four neighbors to the north, south, east, and west
-    // The third input to this map just lets us use a Direction as
-    // a key for this map.
-    // These allow us to properly determine
-    std::unordered_map<Direction, Chunk*, EnumHash> m_neighbors;
+    // Unique to this Chunk, so that work addressed to an unloaded chunk
+    // is not mistaken for work on one loaded later at the same corner.
+    // A recycled Chunk gets a new one.
+    uint64_t m_serial;
+    // The eight Chunks around this one, diagonals included, indexed by
+    // neighborIndex(). The middle slot holds this Chunk itself, so that
+    // an offset of (0, 0) needs no special case. nullptr where no Chunk
+    // is loaded.
+    std::array<Chunk*, 9> m_neighbors;
+    // Set by BlockGenerateWorker once m_blocks has been filled in,
+    // so that other threads know when they may read it
+    std::atomic<bool> m_blockDataReady;
+    // Bumped for every snapshot taken, and the version of the mesh that is
+    // on the GPU now. Meshes older than what is uploaded are dropped, e.g.
+    // a VBOWorker finishing after the player already edited the chunk.
+    int m_meshVersion, m_uploadedVersion;
+    // One bit per 16-block-high section whose blocks changed since the
+    // last snapshot() was taken for meshing
+    uint16_t m_dirtySections;
+    // Mesh made by createVBOdata() for the next bindVBOdata()
+    uPtr<ChunkOpaqueTransparentVBOData> mp_pendingMesh;
+    // Blocks that differ from what is saved on disk: set once generated
+    // and on every edit, cleared when loaded or saved. Written by the
+    // worker that fills m_blocks before it sets m_blockDataReady, and by
+    // the GUI thread after that.
+    bool m_unsaved;
+    // Set when fillBlocks() gave up part way: m_blocks holds whatever the
+    // decode wrote, and is cleared when the blocks are generated instead
+    bool m_staleBlocks;
+    // One bit per block changed through Terrain since generation, so that
+    // only those need saving. Allocated on the first edit.
+    uPtr<std::bitset<65536>> mp_edited;
+    // Where the mesh goes on the GPU, and its two passes there
+    MeshArena* mp_arena;
+    MeshArena::Handle m_meshOpq, m_meshTra;
+    // Where its positions alone go, and the depth prepass's and shadow
+    // maps' shares of them; see ChunkOpaqueTransparentVBOData
+    MeshArena* mp_depthArena;
+    MeshArena::Handle m_meshDepth, m_meshShadow;
+    // Bytes of arena the mesh takes up, counted in mp_residency until
+    // it is released
+    size_t m_gpuBytes;
+    ChunkResidency* mp_residency;
+    // Edits read from disk, replayed over the blocks once generated
+    std::vector<BlockEdit> m_savedEdits;
+    // False when the blocks were loaded whole from disk: what was edited
+    // since generation is not known, so the chunk must be saved whole
+    bool m_editsTracked;
 
 public:
     Chunk();
-    Chunk(int x, int z, OpenGLContext* context);
+    // Meshes are uploaded to arena, and their positions to depthArena,
+    // which only a chunk that is never drawn may leave out, and counted
+    // in residency, if given
+    Chunk(int x, int z, OpenGLContext* context, MeshArena* arena = nullptr, MeshArena* depthArena = nullptr,
+          ChunkResidency* residency = nullptr);
+    // Turns this into a fresh, unlinked chunk at (x, z) for ChunkPool,
+    // whose mesh was released already. Empties the blocks too: until the
+    // new ones are generated, lookups read the chunk as air, never as the
+    // chunk it used to be. GUI thread only.
+    void reset(int x, int z);
+    // Empties m_blocks if fillBlocks() left part of a decode there. Block
+    // generation calls it first, on whichever thread it runs.
+    void clearStaleBlocks();
+    // Lets decode(m_blocks) write every block in place, e.g. straight from
+    // a region file. If it returns false the blocks are left for
+    // clearStaleBlocks() to empty.
+    template <typename F>
+    bool fillBlocks(F decode) {
+        bool filled = decode(m_blocks);
+        m_staleBlocks = !filled;
+        m_editsTracked = !filled;
+        return filled;
+    }
+    // Edits to replay at the end of createChunkBlockData()
+    void setSavedEdits(std::vector<BlockEdit> edits) { m_savedEdits = std::move(edits); }
+    bool hasSavedEdits() const { return !m_savedEdits.empty(); }
+    // Notes that Terrain changed the block at local (x, y, z)
+    void recordEdit(int x, int y, int z);
+    bool editsTracked() const { return m_editsTracked; }
+    bool hasEdits() const { return mp_edited != nullptr; }
+    // Every recorded edit with the block there now, in index order
+    std::vector<BlockEdit> edits() const;
+    const std::array<BlockType, 65536>& allBlocks() const { return m_blocks; }
+    bool isBlockDataReady() const { return m_blockDataReady.load(std::memory_order_acquire); }
+    // Whether a mesh of this chunk has been uploaded yet
+    bool hasMesh() const { return m_uploadedVersion > 0; }
+    // Marks m_blocks ready for other threads to read; see m_blockDataReady
+    void publishBlockData(bool unsaved);
+    bool isUnsaved() const { return m_unsaved; }
+    void markSaved() { m_unsaved = false; }
     BlockType getBlockAt(unsigned int x, unsigned int y, unsigned int z) const;
     BlockType getBlockAt(int x, int y, int z) const;
+    // No bounds checking, for callers that have already done it
+    BlockType getLocalBlockAt(int x, int y, int z) const {
+        return m_blocks[x + 16 * y + 16 * 256 * z];
+    }
     void setBlockAt(unsigned int x, unsigned int y, unsigned int z, BlockType t);
-    void linkNeighbor(uPtr<Chunk>& neighbor, Direction dir);
-
+    // Links this chunk and the one dx, dz chunks away, both ways
+    void linkNeighbor(Chunk* neighbor, int dx, int dz);
+    // Clears the links both ways, before this chunk is unloaded
+    void unlinkNeighbors();
+    uint64_t serial() const { return m_serial; }
+    // The chunk dx, dz chunks away, for dx and dz in [-1, 1], or nullptr
+    // if not linked. (0, 0) is this chunk.
+    Chunk* getNeighbor(int dx, int dz) const { return m_neighbors[neighborIndex(dx, dz)]; }
+    // The chunk holding the block next to ours in this direction, if it
+    // were on our border: this chunk itself for YPOS and YNEG
+    Chunk* getNeighbor(Direction dir) const { return m_neighbors[neighborIndex(dir)]; }
+    static int neighborIndex(int dx, int dz) { return (dx + 1) + 3 * (dz + 1); }
+    static int neighborIndex(Direction dir) {
+        // XPOS, XNEG, YPOS, YNEG, ZPOS, ZNEG
+        static constexpr int INDEX[6] = {5, 3, 4, 4, 7, 1};
+        return INDEX[dir];
+    }
+
+    // Per-block reference version of the face test that ChunkFaceMasks
+    // computes for the whole chunk at once. No longer used by the mesher.
     int is_boundary(int x, int y, int z) const;
 
-    ~Chunk() override {};
-
+    // Its mesh is released by now, or goes with the arena; either way no
+    // longer counted
+    ~Chunk() override { setGpuBytes(0); };
+
+    // Releases the mesh's arena space and takes it off the count
+    void destroyVBOdata() override;
+    bool hasVBOdata() const override { return m_meshOpq != MeshArena::NONE || m_meshTra != MeshArena::NONE; }
+    // Queues the pass of the mesh for the arena's next drawBatch()
+    void addToBatch(bool opaque) const { mp_arena->addToBatch(opaque ? m_meshOpq : m_meshTra); }
+    // Queues the positions of the opaque pass for the depth arena's next
+    // drawBatch(): merged for the shadow maps, or as the opaque pass has
+    // them for the depth prepass
+    void addToDepthBatch(bool shadow) const { mp_depthArena->addToBatch(shadow ? m_meshShadow : m_meshDepth); }
+    size_t gpuBytes() const { return m_gpuBytes; }
+
+    // Uploads the mesh from createVBOdata()
     void bindVBOdata();
-
-    int get_minX(){return minX;}
-    int get_minZ(){return minZ;}
-
-    ChunkOpaqueTransparentVBOData vboData;
-    void createChunkBlockData();
+    // Uploads a mesh to the arena, unless a newer one is on the GPU
+    // already, and returns its buffers to MeshBufferPool. GUI thread only.
+    void bindVBOdata(uPtr<ChunkOpaqueTransparentVBOData> data);
+    // Takes the mesh off the GPU, returning a copy of it on its way back
+    // from the arena, or nullptr if there was none. GUI thread only.
+    uPtr<EvictedMesh> evictMesh();
+
+    int get_minX() const {return minX;}
+    int get_minZ() const {return minZ;}
+
+    // Fills the blocks from noise and the world seed, which alone decides
+    // everything random, so the same seed always gives the same chunk
+    void createChunkBlockData(uint32_t seed);
+    // Copies the chunk and its borders for meshing, and clears the
+    // dirty sections. GUI thread only.
+    uPtr<ChunkSnapshot> snapshot();
+    // Flags the sections holding heights yMin..yMax (inclusive) as edited,
+    // and the chunk as unsaved
+    void markDirty(int yMin, int yMax);
+    uint16_t dirtySections() const { return m_dirtySections; }
+    // Meshes the chunk on the calling thread from a fresh snapshot
     void createVBOdata() override;
+    // Meshes a snapshot into buffers from MeshBufferPool; this is what
+    // VBOWorker runs. Reads nothing but the snapshot.
+    uPtr<ChunkOpaqueTransparentVBOData> createMesh(const ChunkSnapshot &snapshot);
+    // Writes the mesh of a snapshot into out, which must be empty
+    void buildMesh(const ChunkSnapshot &snapshot, ChunkOpaqueTransparentVBOData &out) const;
+    // Pushes the four interleaved vertices of one block face
+    void appendFace(std::vector<glm::vec4> &data_to_push, Direction d, BlockType t, int x, int y, int z) const;
 
     void fillTerrainBlocks(int x, int z, BiomeType biome, int height);
-    void getHeight(int x, int z, int& y, BiomeType& b);
-    void placeTree(std::vector<std::vector<int>>& heights, std::vector<std::vector<BiomeType>>& biomes);
+    void getHeight(int x, int z, int& y, BiomeType& b, uint32_t seed);
+    void placeTree(std::vector<std::vector<int>>& heights, std::vector<std::vector<BiomeType>>& biomes, uint32_t seed);
     float perlinNoiseSingle(glm::vec2 uv);
     float PerlinNoise2D(float x, float z, float frequency, int octaves);
     float WorleyNoise(float x, float y);
@@ -83,7 +217,11 @@ public:
     float min(float a, float b);
 
     void refreshChunkVBOData();
-    void refreshAdjacentChunkVBOData();
+
+private:
+    // Keeps m_gpuBytes and mp_residency's count in step
+    void setGpuBytes(size_t bytes);
 
     friend class BlockGenerateWorker;
+    friend struct ChunkSnapshot;
 };
@@ -0,0 +1,113 @@
+#include "chunkdirectory.h"
+#include "chunk.h"
+#include <QThread>
+
+ChunkDirectory::ChunkDirectory()
+    : m_size(0), m_epoch(1)
+{
+    for (auto &e : m_readerEpochs) {
+        e.store(0);
+    }
+}
+
+// By now no other thread may be reading, so every retired chunk can go
+ChunkDirectory::~ChunkDirectory() = default;
+
+ChunkDirectory::ReadGuard::ReadGuard(const ChunkDirectory &dir)
+    : mcr_dir(dir), m_slot(-1)
+{
+    // Claim a free slot and publish the current epoch in it. If every
+    // slot is busy, wait for one; guards are only held for one job.
+    for (;;) {
+        for (int i = 0; i < MAX_READERS; i++) {
+            uint64_t expected = 0;
+            if (mcr_dir.m_readerEpochs[i].compare_exchange_strong(expected, mcr_dir.m_epoch.load())) {
+                m_slot = i;
+                return;
+            }
+        }
+        QThread::yieldCurrentThread();
+    }
+}
+
+ChunkDirectory::ReadGuard::~ReadGuard()
+{
+    mcr_dir.m_readerEpochs[m_slot].store(0);
+}
+
+Chunk* ChunkDirectory::find(int64_t key) const
+{
+    const Shard &s = m_shards[shardOf(key)];
+    QMutexLocker locker(&s.lock);
+    auto it = s.chunks.find(key);
+    return it != s.chunks.end() ? it->second.get() : nullptr;
+}
+
+Chunk* ChunkDirectory::find(const ChunkRef &ref) const
+{
+    Chunk *c = find(ref.key);
+    return (c != nullptr && c->serial() == ref.serial) ? c : nullptr;
+}
+
+Chunk* ChunkDirectory::insert(int64_t key, uPtr<Chunk> c)
+{
+    Chunk *ptr = c.get();
+    uPtr<Chunk> old;
+    {
+        Shard &s = m_shards[shardOf(key)];
+        QMutexLocker locker(&s.lock);
+        uPtr<Chunk> &slot = s.chunks[key];
+        old = std::move(slot);
+        slot = std::move(c);
+    }
+    if (old) {
+        m_retired.push_back({m_epoch.fetch_add(1), std::move(old)});
+    } else {
+        m_size.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ptr;
+}
+
+bool ChunkDirectory::remove(int64_t key)
+{
+    uPtr<Chunk> old;
+    {
+        Shard &s = m_shards[shardOf(key)];
+        QMutexLocker locker(&s.lock);
+        auto it = s.chunks.find(key);
+        if (it == s.chunks.end()) {
+            return false;
+        }
+        old = std::move(it->second);
+        s.chunks.erase(it);
+    }
+    m_size.fetch_sub(1, std::memory_order_relaxed);
+    // The chunk is unreachable from here on, so only guards that started
+    // in this epoch or before can be holding it
+    m_retired.push_back({m_epoch.fetch_add(1), std::move(old)});
+    return true;
+}
+
+std::vector<uPtr<Chunk>> ChunkDirectory::collect()
+{
+    std::vector<uPtr<Chunk>> freed;
+    if (m_retired.empty()) {
+        return freed;
+    }
+
+    uint64_t oldestReader = UINT64_MAX;
+    for (const auto &e : m_readerEpochs) {
+        uint64_t v = e.load();
+        if (v != 0 && v < oldestReader) {
+            oldestReader = v;
+        }
+    }
+
+    // m_retired is in epoch order
+    auto it = m_retired.begin();
+    for (; it != m_retired.end() && it->epoch < oldestReader; ++it) {
+        freed.push_back(std::move(it->chunk));
+    }
+    m_retired.erase(m_retired.begin(), it);
+    return freed;
+}
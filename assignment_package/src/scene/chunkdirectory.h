@@ -0,0 +1,108 @@
+#pragma once
+#include "smartpointerhelp.h"
+#include <array>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <QMutex>
+
+class Chunk;
+
+// Names one particular Chunk for work queued on another thread: its key
+// and its Chunk::serial(), so that the work is dropped if the chunk is
+// unloaded and another one loaded at the same corner in the meantime
+struct ChunkRef {
+    int64_t key;
+    uint64_t serial;
+};
+
+// Every Chunk in the world, keyed by toKey() of its corner.
+// The map is split into SHARDS smaller maps, each behind its own mutex,
+// so worker threads looking chunks up rarely wait on each other or on
+// the GUI thread inserting new ones.
+//
+// Removal uses epoch-based reclamation. A thread that wants to use the
+// chunks it finds holds a ReadGuard while it does; remove() only takes
+// a chunk out of the map, and the Chunk itself is freed by a later
+// collect() once every guard that could have seen it is gone.
+// Pointers must be looked up inside the guard that protects them:
+// a Chunk* found before the guard was taken may already be retired.
+//
+// find(), size() and ReadGuard are safe on any thread. insert(),
+// remove(), collect() and forEach() belong to the GUI thread.
+class ChunkDirectory {
+public:
+    static constexpr int SHARDS_LOG2 = 4;
+    static constexpr int SHARDS = 1 << SHARDS_LOG2;
+    // Guards that can be held at once, across all threads
+    static constexpr int MAX_READERS = 64;
+
+    ChunkDirectory();
+    ~ChunkDirectory();
+
+    // Marks this thread as reading from the directory until destroyed
+    class ReadGuard {
+    public:
+        explicit ReadGuard(const ChunkDirectory &dir);
+        ~ReadGuard();
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+    private:
+        const ChunkDirectory &mcr_dir;
+        int m_slot;
+    };
+
+    // The chunk with this key, or nullptr
+    Chunk* find(int64_t key) const;
+    // The chunk ref names, or nullptr if it is no longer loaded
+    Chunk* find(const ChunkRef &ref) const;
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+    // Stores c under key and returns it. Any chunk already there is removed.
+    Chunk* insert(int64_t key, uPtr<Chunk> c);
+    // Takes the chunk with this key out of the map and retires it.
+    // Returns false if there was none.
+    bool remove(int64_t key);
+    // Hands back every retired chunk that no guard can still see, for the
+    // caller to forget about before it lets them be freed
+    std::vector<uPtr<Chunk>> collect();
+    // Chunks removed but not yet collected
+    size_t retiredCount() const { return m_retired.size(); }
+
+    // Calls f(key, chunk) for every chunk, one shard at a time
+    template <typename F>
+    void forEach(F f) const {
+        for (const Shard &s : m_shards) {
+            QMutexLocker locker(&s.lock);
+            for (const auto &kv : s.chunks) {
+                f(kv.first, kv.second.get());
+            }
+        }
+    }
+
+private:
+    struct Shard {
+        mutable QMutex lock;
+        std::unordered_map<int64_t, uPtr<Chunk>> chunks;
+    };
+    std::array<Shard, SHARDS> m_shards;
+    std::atomic<size_t> m_size;
+
+    // Bumped by every remove(). A guard records the epoch it started in,
+    // and 0 marks a free slot.
+    std::atomic<uint64_t> m_epoch;
+    mutable std::array<std::atomic<uint64_t>, MAX_READERS> m_readerEpochs;
+
+    struct Retired {
+        uint64_t epoch;
+        uPtr<Chunk> chunk;
+    };
+    std::vector<Retired> m_retired;
+
+    static int shardOf(int64_t key) {
+        // Neighboring chunks differ in the low bits of x or z, so mix the
+        // whole key before taking the top bits
+        return static_cast<int>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> (64 - SHARDS_LOG2));
+    }
+};
@@ -0,0 +1,45 @@
+#include "chunkgrid.h"
+#include "terrain.h"
+#include <cstdlib>
+
+ChunkGrid::ChunkGrid()
+    : m_minX(-SIZE / 2), m_minZ(-SIZE / 2)
+{
+    m_slots.fill({INT_MIN, INT_MIN, nullptr});
+}
+
+void ChunkGrid::insert(int cx, int cz, Chunk* c)
+{
+    if (inWindow(cx, cz)) {
+        m_slots[slotIndex(cx, cz)] = {cx, cz, c};
+    }
+}
+
+void ChunkGrid::erase(int cx, int cz)
+{
+    if (inWindow(cx, cz)) {
+        m_slots[slotIndex(cx, cz)].chunk = nullptr;
+    }
+}
+
+void ChunkGrid::recenter(int cx, int cz, const ChunkDirectory &chunks)
+{
+    int centreX = m_minX + SIZE / 2;
+    int centreZ = m_minZ + SIZE / 2;
+    if (std::abs(cx - centreX) <= SLACK && std::abs(cz - centreZ) <= SLACK) {
+        return;
+    }
+
+    m_minX = cx - SIZE / 2;
+    m_minZ = cz - SIZE / 2;
+    for (int z = m_minZ; z < m_minZ + SIZE; z++) {
+        for (int x = m_minX; x < m_minX + SIZE; x++) {
+            Slot &s = m_slots[slotIndex(x, z)];
+            // Slots that already hold this coordinate are still valid
+            if (s.cx == x && s.cz == z) {
+                continue;
+            }
+            s = {x, z, chunks.find(toKey(16 * x, 16 * z))};
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "smartpointerhelp.h"
+#include <array>
+#include <climits>
+#include <cstdint>
+
+class Chunk;
+class ChunkDirectory;
+
+// A SIZE x SIZE window of chunk slots around the player, addressed by
+// chunk coordinates modulo SIZE (a ring buffer in both x and z), so that
+// finding a resident chunk is two shifts, two masks and a compare rather
+// than a float floor and a hash lookup.
+// The grid owns nothing: Terrain::m_chunks still stores every Chunk, and
+// is what lookups outside the window fall back to.
+// GUI thread only, like m_chunks itself.
+class ChunkGrid {
+public:
+    static constexpr int SIZE_LOG2 = 6;
+    static constexpr int SIZE = 1 << SIZE_LOG2;
+    // How far the window's centre may lag behind the player, in chunks,
+    // before recenter() moves it
+    static constexpr int SLACK = 8;
+
+    ChunkGrid();
+
+    // Chunk coordinates of the chunk holding world x or z
+    static int chunkCoord(int worldCoord) { return worldCoord >> 4; }
+
+    // Is this chunk coordinate covered by the window?
+    bool inWindow(int cx, int cz) const {
+        return static_cast<unsigned>(cx - m_minX) < SIZE &&
+               static_cast<unsigned>(cz - m_minZ) < SIZE;
+    }
+    // The chunk at these chunk coordinates, or nullptr if there is none.
+    // Only meaningful when inWindow(cx, cz).
+    Chunk* find(int cx, int cz) const {
+        const Slot &s = m_slots[slotIndex(cx, cz)];
+        return (s.cx == cx && s.cz == cz) ? s.chunk : nullptr;
+    }
+
+    // Records a newly created chunk, if it falls inside the window
+    void insert(int cx, int cz, Chunk* c);
+    // Forgets a chunk that is being unloaded
+    void erase(int cx, int cz);
+    // Moves the window so that it is centred on (cx, cz) once the player
+    // has drifted more than SLACK chunks from its centre, refilling the
+    // slots from the chunk map
+    void recenter(int cx, int cz, const ChunkDirectory &chunks);
+
+private:
+    struct Slot {
+        int cx, cz;
+        Chunk* chunk;
+    };
+    std::array<Slot, SIZE * SIZE> m_slots;
+    // Chunk coordinates of the window's lower corner
+    int m_minX, m_minZ;
+
+    static int slotIndex(int cx, int cz) {
+        return (cx & (SIZE - 1)) + ((cz & (SIZE - 1)) << SIZE_LOG2);
+    }
+};
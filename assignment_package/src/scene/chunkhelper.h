@@ -6,6 +6,7 @@
 #include <array>
 #include <unordered_map>
 #include <cstddef>
+#include <cstdint>
 #include <stdio.h>
 #include <stdexcept>
 #include <set>
@@ -26,6 +27,13 @@ enum BlockType : unsigned char
     EMPTY, GRASS, DIRT, STONE, WATER, LAVA, TRUNK, LEAF
 };
 
+// A block changed since its chunk was generated; index is
+// x + 16 * y + 4096 * z within the chunk
+struct BlockEdit {
+    uint16_t index;
+    BlockType type;
+};
+
 // The six cardinal directions in 3D space
 enum Direction : unsigned char
 {
@@ -42,56 +50,3 @@ enum class BiomeType : unsigned char{
 };
 
 #define GRID 0.0625
-
-const static std::unordered_map<BlockType, std::unordered_map<Direction, glm::vec2, EnumHash>, EnumHash> blockFaceUVs
-{
-    {GRASS, std::unordered_map<Direction, glm::vec2, EnumHash>{
-           {XPOS, glm::vec2(4 * GRID, 11 * GRID)},
-           {XNEG, glm::vec2(4 * GRID, 11 * GRID)},
-           {YPOS, glm::vec2(0 * GRID, 15 * GRID)},
-           {YNEG, glm::vec2(2 * GRID, 11 * GRID)},
-           {ZPOS, glm::vec2(4 * GRID, 11 * GRID)},
-           {ZNEG, glm::vec2(4 * GRID, 11 * GRID)}}},
-    {DIRT, std::unordered_map<Direction, glm::vec2, EnumHash>{
-           {XPOS, glm::vec2(2 * GRID, 15 * GRID)},
-           {XNEG, glm::vec2(2 * GRID, 15 * GRID)},
-           {YPOS, glm::vec2(2 * GRID, 15 * GRID)},
-           {YNEG, glm::vec2(2 * GRID, 15 * GRID)},
-           {ZPOS, glm::vec2(2 * GRID, 15 * GRID)},
-           {ZNEG, glm::vec2(2 * GRID, 15 * GRID)}}},
-    {STONE, std::unordered_map<Direction, glm::vec2, EnumHash>{
-           {XPOS, glm::vec2(1 * GRID, 15 * GRID)},
-           {XNEG, glm::vec2(1 * GRID, 15 * GRID)},
-           {YPOS, glm::vec2(1 * GRID, 15 * GRID)},
-           {YNEG, glm::vec2(1 * GRID, 15 * GRID)},
-           {ZPOS, glm::vec2(1 * GRID, 15 * GRID)},
-           {ZNEG, glm::vec2(1 * GRID, 15 * GRID)}}},
-    {WATER, std::unordered_map<Direction, glm::vec2, EnumHash>{
-           {XPOS, glm::vec2(14 * GRID, 2 * GRID)},
-           {XNEG, glm::vec2(14 * GRID, 2 * GRID)},
-           {YPOS, glm::vec2(14 * GRID, 2 * GRID)},
-           {YNEG, glm::vec2(14 * GRID, 2 * GRID)},
-           {ZPOS, glm::vec2(14 * GRID, 2 * GRID)},
-           {ZNEG, glm::vec2(14 * GRID, 2 * GRID)}}},
-    {LAVA, std::unordered_map<Direction, glm::vec2, EnumHash>{
-           {XPOS, glm::vec2(14 * GRID, 0 * GRID)},
-           {XNEG, glm::vec2(14 * GRID, 0 * GRID)},
-           {YPOS, glm::vec2(14 * GRID, 0 * GRID)},
-           {YNEG, glm::vec2(14 * GRID, 0 * GRID)},
-           {ZPOS, glm::vec2(14 * GRID, 0 * GRID)},
-           {ZNEG, glm::vec2(14 * GRID, 0 * GRID)}}},
-    {TRUNK, std::unordered_map<Direction, glm::vec2, EnumHash>{
-            {XPOS, glm::vec2(4 * GRID, 14 * GRID)},
-            {XNEG, glm::vec2(4 * GRID, 14 * GRID)},
-            {YPOS, glm::vec2(5 * GRID, 14 * GRID)},
-            {YNEG, glm::vec2(5 * GRID, 14 * GRID)},
-            {ZPOS, glm::vec2(4 * GRID, 14 * GRID)},
-            {ZNEG, glm::vec2(4 * GRID, 14 * GRID)}}},
-    {LEAF, std::unordered_map<Direction, glm::vec2, EnumHash>{
-            {XPOS, glm::vec2(5 * GRID, 12 * GRID)},
-            {XNEG, glm::vec2(5 * GRID, 12 * GRID)},
-            {YPOS, glm::vec2(5 * GRID, 12 * GRID)},
-            {YNEG, glm::vec2(5 * GRID, 12 * GRID)},
-            {ZPOS, glm::vec2(5 * GRID, 12 * GRID)},
-            {ZNEG, glm::vec2(5 * GRID, 12 * GRID)}}}
-};
@@ -0,0 +1,289 @@
+#include "chunkmesher.h"
+#include "chunk.h"
+#include "blockregistry.h"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CHUNKMESHER_SSE2
+#endif
+
+namespace {
+
+// Lane masks selecting x = 0 and x = 15 of each 16-bit row in a slab
+constexpr uint64_t LANE_LOW  = 0x0001000100010001ull;
+constexpr uint64_t LANE_HIGH = 0x8000800080008000ull;
+
+inline bool isOccluder(BlockType t) {
+    return blockInfo(t).opaque;
+}
+
+// Packs the 16 blocks of one x-row into an opaque and a transparent bitmask.
+// While the registry's only see-through blocks are EMPTY and WATER, SSE2
+// does this with two byte compares and two movemasks.
+inline void packRow(const BlockType *row, uint16_t &opaque, uint16_t &water) {
+#ifdef CHUNKMESHER_SSE2
+    if constexpr (BlockRegistry::onlyEmptyAndWaterSeeThrough()) {
+        __m128i blocks = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+        int empty = _mm_movemask_epi8(_mm_cmpeq_epi8(blocks, _mm_setzero_si128()));
+        int wet = _mm_movemask_epi8(_mm_cmpeq_epi8(blocks, _mm_set1_epi8(WATER)));
+        opaque = static_cast<uint16_t>(~(empty | wet));
+        water = static_cast<uint16_t>(wet);
+        return;
+    }
+#endif
+    opaque = water = 0;
+    for (int x = 0; x < 16; ++x) {
+        const BlockInfo &info = blockInfo(row[x]);
+        opaque |= info.opaque << x;
+        water |= info.transparent << x;
+    }
+}
+
+inline int slabIndex(int y, int z) {
+    return (y << 2) + (z >> 2);
+}
+
+inline int laneShift(int z) {
+    return (z & 3) << 4;
+}
+
+// The corners of each face of a block, by Direction, in the order
+// Chunk::appendFace() gives them: 1 on an axis is the block's far side
+constexpr int FACE_CORNERS[6][4][3] = {
+    {{1, 1, 0}, {1, 0, 0}, {1, 0, 1}, {1, 1, 1}}, // XPOS
+    {{0, 1, 1}, {0, 0, 1}, {0, 0, 0}, {0, 1, 0}}, // XNEG
+    {{1, 1, 0}, {1, 1, 1}, {0, 1, 1}, {0, 1, 0}}, // YPOS
+    {{1, 0, 1}, {1, 0, 0}, {0, 0, 0}, {0, 0, 1}}, // YNEG
+    {{1, 1, 1}, {1, 0, 1}, {0, 0, 1}, {0, 1, 1}}, // ZPOS
+    {{0, 1, 0}, {0, 0, 0}, {1, 0, 0}, {1, 1, 0}}, // ZNEG
+};
+
+} // namespace
+
+void ChunkSnapshot::capture(const Chunk &c)
+{
+    minX = c.minX;
+    minZ = c.minZ;
+    serial = c.m_serial;
+    version = 0;
+    m_blocks.fill(EMPTY);
+
+    // The chunk itself, one 16-block x-row at a time
+    for (int z = 0; z < 16; ++z) {
+        for (int y = 0; y < 256; ++y) {
+            std::memcpy(&m_blocks[index(0, y, z)], &c.m_blocks[16 * y + 4096 * z], 16);
+        }
+    }
+
+    // Neighbors that are still being generated on a worker thread are left
+    // EMPTY: reading them here would race with BlockGenerateWorker.
+    auto ready = [](const Chunk *n) {
+        return n != nullptr && n->m_blockDataReady.load(std::memory_order_acquire);
+    };
+
+    const Chunk *n = c.getNeighbor(ZNEG);
+    if (ready(n)) {
+        for (int y = 0; y < 256; ++y) {
+            std::memcpy(&m_blocks[index(0, y, -1)], &n->m_blocks[16 * y + 4096 * 15], 16);
+        }
+    }
+    n = c.getNeighbor(ZPOS);
+    if (ready(n)) {
+        for (int y = 0; y < 256; ++y) {
+            std::memcpy(&m_blocks[index(0, y, 16)], &n->m_blocks[16 * y], 16);
+        }
+    }
+    n = c.getNeighbor(XNEG);
+    if (ready(n)) {
+        for (int z = 0; z < 16; ++z)
+            for (int y = 0; y < 256; ++y)
+                m_blocks[index(-1, y, z)] = n->m_blocks[15 + 16 * y + 4096 * z];
+    }
+    n = c.getNeighbor(XPOS);
+    if (ready(n)) {
+        for (int z = 0; z < 16; ++z)
+            for (int y = 0; y < 256; ++y)
+                m_blocks[index(16, y, z)] = n->m_blocks[16 * y + 4096 * z];
+    }
+
+    // And the single columns of the four diagonal neighbors
+    for (int dz = -1; dz <= 1; dz += 2) {
+        for (int dx = -1; dx <= 1; dx += 2) {
+            n = c.getNeighbor(dx, dz);
+            if (!ready(n)) {
+                continue;
+            }
+            int x = dx < 0 ? -1 : 16, z = dz < 0 ? -1 : 16;
+            int nx = dx < 0 ? 15 : 0, nz = dz < 0 ? 15 : 0;
+            for (int y = 0; y < 256; ++y)
+                m_blocks[index(x, y, z)] = n->m_blocks[nx + 16 * y + 4096 * nz];
+        }
+    }
+}
+
+void ChunkFaceMasks::compute(const ChunkSnapshot &s)
+{
+    m_opaque.fill(0);
+    m_water.fill(0);
+    for (int z = 0; z < 16; ++z) {
+        for (int y = 0; y < 256; ++y) {
+            uint16_t opaque, water;
+            packRow(&s.m_blocks[ChunkSnapshot::index(0, y, z)], opaque, water);
+            m_opaque[slabIndex(y, z)] |= uint64_t(opaque) << laneShift(z);
+            m_water[slabIndex(y, z)] |= uint64_t(water) << laneShift(z);
+        }
+    }
+
+    // Opaque blocks along the snapshot's border, i.e. the edges of the
+    // four neighboring chunks
+    std::array<uint16_t, 256> zNegRow, zPosRow;
+    std::array<uint64_t, SLAB_COUNT> xNegEdge{}, xPosEdge{};
+    for (int y = 0; y < 256; ++y) {
+        uint16_t water;
+        packRow(&s.m_blocks[ChunkSnapshot::index(0, y, -1)], zNegRow[y], water);
+        packRow(&s.m_blocks[ChunkSnapshot::index(0, y, 16)], zPosRow[y], water);
+    }
+    for (int z = 0; z < 16; ++z) {
+        for (int y = 0; y < 256; ++y) {
+            if (isOccluder(s.at(-1, y, z))) {
+                xNegEdge[slabIndex(y, z)] |= 1ull << laneShift(z);
+            }
+            if (isOccluder(s.at(16, y, z))) {
+                xPosEdge[slabIndex(y, z)] |= 1ull << (laneShift(z) + 15);
+            }
+        }
+    }
+
+    // A face is exposed when its block is opaque and the block it faces is not.
+    // Each direction becomes a shift of the opaque mask toward that neighbor.
+    for (int slab = 0; slab < SLAB_COUNT; ++slab) {
+        const int y = slab >> 2;
+        const int zQuad = slab & 3;
+        const uint64_t opq = m_opaque[slab];
+
+        // x neighbors are in the same 16-bit row, except at the chunk's edge
+        m_faces[XNEG][slab] = opq & ~(((opq << 1) & ~LANE_LOW) | xNegEdge[slab]);
+        m_faces[XPOS][slab] = opq & ~(((opq >> 1) & ~LANE_HIGH) | xPosEdge[slab]);
+
+        // y neighbors are the same slab one layer down or up.
+        // The bottom and top of the world are always exposed.
+        m_faces[YNEG][slab] = y == 0 ? opq : opq & ~m_opaque[slab - 4];
+        m_faces[YPOS][slab] = y == 255 ? opq : opq & ~m_opaque[slab + 4];
+
+        // z neighbors are the adjacent 16-bit row, which for the first and
+        // last row of a slab lives in the neighboring slab or chunk
+        uint64_t prevRow = zQuad == 0 ? zNegRow[y] : m_opaque[slab - 1] >> 48;
+        uint64_t nextRow = zQuad == 3 ? zPosRow[y] : m_opaque[slab + 1] & 0xFFFF;
+        m_faces[ZNEG][slab] = opq & ~((opq << 16) | prevRow);
+        m_faces[ZPOS][slab] = opq & ~((opq >> 16) | (nextRow << 48));
+
+        // Water only renders its surface, i.e. when the block above is EMPTY
+        const uint64_t wet = m_water[slab];
+        m_faces[YPOS][slab] |= y == 255 ? wet : wet & ~(m_opaque[slab + 4] | m_water[slab + 4]);
+    }
+}
+
+int ChunkFaceMasks::faceCount(Direction d) const
+{
+    int count = 0;
+    for (uint64_t bits : m_faces[d]) {
+        count += popCount(bits);
+    }
+    return count;
+}
+
+int ChunkFaceMasks::faceCount() const
+{
+    int count = 0;
+    for (int d = 0; d < 6; ++d) {
+        count += faceCount(static_cast<Direction>(d));
+    }
+    return count;
+}
+
+int ChunkFaceMasks::waterFaceCount() const
+{
+    int count = 0;
+    for (int slab = 0; slab < SLAB_COUNT; ++slab) {
+        count += popCount(m_faces[YPOS][slab] & m_water[slab]);
+    }
+    return count;
+}
+
+int ChunkFaceMasks::appendMergedOpaqueFaces(int minX, int minZ, std::vector<glm::vec3> &out) const
+{
+    int appended = 0;
+    // The faces of one direction as 16-bit rows: layers across the
+    // direction, each of rowCount rows along a second axis, with a bit
+    // for every block along a third. Y faces lie in layers of y with rows
+    // of z, Z faces in layers of z with rows of y, and X faces in layers
+    // of x with rows of y, whose bits run along z.
+    std::array<uint16_t, 4096> rows;
+    for (int d = 0; d < 6; ++d) {
+        const bool alongY = d == YPOS || d == YNEG;
+        const bool alongX = d == XPOS || d == XNEG;
+        const int rowCount = alongY ? 16 : 256;
+        rows.fill(0);
+        for (int slab = 0; slab < SLAB_COUNT; ++slab) {
+            // Water faces are left to the transparent pass
+            uint64_t faces = m_faces[d][slab] & m_opaque[slab];
+            if (faces == 0) {
+                continue;
+            }
+            const int y = slabY(slab);
+            for (int lane = 0; lane < 4; ++lane) {
+                const int z = slabZ(slab, lane << 4);
+                uint16_t row = static_cast<uint16_t>(faces >> (lane << 4));
+                if (alongY) {
+                    rows[y * 16 + z] = row;
+                } else if (!alongX) {
+                    rows[z * 256 + y] = row;
+                } else {
+                    for (uint64_t bits = row; bits != 0; bits &= bits - 1) {
+                        rows[lowestSetBit(bits) * 256 + y] |= static_cast<uint16_t>(1u << z);
+                    }
+                }
+            }
+        }
+
+        const int (&corners)[4][3] = FACE_CORNERS[d];
+        for (int layer = 0; layer < 4096 / rowCount; ++layer) {
+            uint16_t *layerRows = &rows[layer * rowCount];
+            for (int v = 0; v < rowCount; ++v) {
+                while (layerRows[v] != 0) {
+                    // The first run of faces in the row, grown over every
+                    // following row that has all of it
+                    uint32_t bits = layerRows[v];
+                    int u = lowestSetBit(bits);
+                    int width = lowestSetBit(~(bits >> u));
+                    uint16_t run = static_cast<uint16_t>(((1u << width) - 1) << u);
+                    int height = 0;
+                    while (v + height < rowCount && (layerRows[v + height] & run) == run) {
+                        layerRows[v + height] &= ~run;
+                        height++;
+                    }
+
+                    // The box the merged faces are the side of
+                    glm::ivec3 lo, size;
+                    if (alongY) {
+                        lo = glm::ivec3(u, layer, v);
+                        size = glm::ivec3(width, 1, height);
+                    } else if (!alongX) {
+                        lo = glm::ivec3(u, v, layer);
+                        size = glm::ivec3(width, height, 1);
+                    } else {
+                        lo = glm::ivec3(layer, v, u);
+                        size = glm::ivec3(1, height, width);
+                    }
+                    lo += glm::ivec3(minX, 0, minZ);
+                    for (const int (&c)[3] : corners) {
+                        out.push_back(glm::vec3(lo + glm::ivec3(c[0], c[1], c[2]) * size));
+                    }
+                    appended++;
+                }
+            }
+        }
+    }
+    return appended;
+}
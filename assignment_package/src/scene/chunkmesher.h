@@ -0,0 +1,91 @@
+#pragma once
+#include "chunkhelper.h"
+#include <cstdint>
+#include <vector>
+
+class Chunk;
+
+// Returns the index of the lowest set bit of a non-zero word.
+inline int lowestSetBit(uint64_t bits) {
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, bits);
+    return static_cast<int>(idx);
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+inline int popCount(uint64_t bits) {
+#if defined(_MSC_VER)
+    return static_cast<int>(__popcnt64(bits));
+#else
+    return __builtin_popcountll(bits);
+#endif
+}
+
+// An immutable copy of one chunk's blocks plus a one-block border copied
+// from its neighbors. It is taken on the GUI thread when a meshing job is
+// scheduled, so the worker thread that meshes it never reads live chunks,
+// and the hot loops can index it without bounds checks or neighbor lookups.
+// Border blocks of missing or not yet generated neighbors are EMPTY.
+struct ChunkSnapshot {
+    static constexpr int SIZE_X = 18, SIZE_Y = 256, SIZE_Z = 18;
+
+    int minX, minZ;
+    // Chunk::serial() of the chunk it was taken from
+    uint64_t serial;
+    // Chunk::m_meshVersion when this was taken, see Chunk::snapshot()
+    int version;
+    // Indexed by (x + 1) + 18 * y + 18 * 256 * (z + 1) for x, z in [-1, 16]
+    std::array<BlockType, SIZE_X * SIZE_Y * SIZE_Z> m_blocks;
+
+    void capture(const Chunk &c);
+
+    static int index(int x, int y, int z) {
+        return (x + 1) + SIZE_X * (y + SIZE_Y * (z + 1));
+    }
+    BlockType at(int x, int y, int z) const {
+        return m_blocks[index(x, y, z)];
+    }
+};
+
+// Bitmask front-end of the chunk mesher.
+// Instead of asking every block about its six neighbors one getBlockAt()
+// at a time, we pack the chunk into opacity bitmasks and derive all six
+// face masks with word-wide shifts and ANDs.
+//
+// Every mask covers the 16 x 256 x 16 chunk as 1024 64-bit "column slabs":
+// slab (y * 4 + z / 4) holds the four 16-bit x-rows z..z+3 of layer y,
+// and bit ((z % 4) * 16 + x) of that slab is the block at (x, y, z).
+class ChunkFaceMasks {
+public:
+    static constexpr int SLAB_COUNT = 256 * 4;
+
+    // Blocks that hide the faces of their neighbors (BlockInfo::opaque)
+    std::array<uint64_t, SLAB_COUNT> m_opaque;
+    // Transparent blocks, whose only visible face is the water surface
+    std::array<uint64_t, SLAB_COUNT> m_water;
+    // Exposed faces, indexed by Direction
+    std::array<std::array<uint64_t, SLAB_COUNT>, 6> m_faces;
+
+    // Fills every mask from a snapshot of the chunk and its borders
+    void compute(const ChunkSnapshot &s);
+
+    // Number of faces set for a direction, or for all of them
+    int faceCount(Direction d) const;
+    int faceCount() const;
+    // Number of those faces that belong to water, i.e. the transparent pass
+    int waterFaceCount() const;
+
+    // Appends the faces of the opaque pass as positions, four to a face,
+    // in the winding of Chunk::appendFace(), with each run of faces that
+    // share a plane and a direction merged greedily into rectangles.
+    // minX and minZ are the chunk's corner. Returns the faces appended.
+    int appendMergedOpaqueFaces(int minX, int minZ, std::vector<glm::vec3> &out) const;
+
+    // Decode a slab index and bit position back to chunk-local coordinates
+    static int slabY(int slab) { return slab >> 2; }
+    static int slabZ(int slab, int bit) { return ((slab & 3) << 2) + (bit >> 4); }
+    static int slabX(int bit) { return bit & 15; }
+};
@@ -0,0 +1,69 @@
+#include "chunkpool.h"
+#include "chunk.h"
+#include <chrono>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double msSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+} // namespace
+
+ChunkPool::ChunkPool(OpenGLContext* context, MeshArena* arena, MeshArena* depthArena, ChunkResidency* residency)
+    : mp_context(context), mp_arena(arena), mp_depthArena(depthArena), mp_residency(residency), m_free(), m_stats{0, 0, 0.0, 0.0, 0}
+{}
+
+ChunkPool::~ChunkPool()
+{
+    trim();
+}
+
+uPtr<Chunk> ChunkPool::acquire(int x, int z)
+{
+    Clock::time_point start = Clock::now();
+    if (m_free.empty()) {
+        uPtr<Chunk> c = mkU<Chunk>(x, z, mp_context, mp_arena, mp_depthArena, mp_residency);
+        m_stats.misses++;
+        m_stats.missMs += msSince(start);
+        return c;
+    }
+
+    uPtr<Chunk> c = std::move(m_free.back());
+    m_free.pop_back();
+    c->reset(x, z);
+    m_stats.hits++;
+    m_stats.hitMs += msSince(start);
+    return c;
+}
+
+void ChunkPool::release(uPtr<Chunk> c)
+{
+    if (c == nullptr) {
+        return;
+    }
+    if (m_free.size() < MAX_POOLED) {
+        m_free.push_back(std::move(c));
+    } else if (c->hasVBOdata()) {
+        c->destroyVBOdata();
+    }
+}
+
+void ChunkPool::trim()
+{
+    for (uPtr<Chunk> &c : m_free) {
+        if (c->hasVBOdata()) {
+            c->destroyVBOdata();
+        }
+    }
+    m_free.clear();
+}
+
+ChunkPool::Stats ChunkPool::stats() const
+{
+    Stats s = m_stats;
+    s.pooled = m_free.size();
+    return s;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "smartpointerhelp.h"
+#include "openglcontext.h"
+#include "mesharena.h"
+#include <vector>
+
+class Chunk;
+class ChunkResidency;
+
+// A free list of unloaded Chunks, so that streaming terrain in and out
+// recycles them instead of allocating 64 KB and more for every new
+// chunk. A recycled Chunk has its blocks emptied by Chunk::reset(); its
+// mesh went back to the MeshArenas when it was unloaded.
+// GUI thread only: chunks come back through Terrain::reclaimChunks(),
+// once no worker can still be using them.
+class ChunkPool {
+public:
+    // Keep at most this many idle chunks, about 16 MB of blocks
+    static constexpr size_t MAX_POOLED = 256;
+
+    // Chunks are made with their meshes in arena and depthArena, counted
+    // in residency
+    ChunkPool(OpenGLContext* context, MeshArena* arena, MeshArena* depthArena, ChunkResidency* residency);
+    ~ChunkPool();
+
+    // A chunk at (x, z), recycled if the pool has one
+    uPtr<Chunk> acquire(int x, int z);
+    // Takes back an unloaded chunk; beyond MAX_POOLED it is freed
+    void release(uPtr<Chunk> c);
+    // Frees every pooled chunk
+    void trim();
+
+    struct Stats {
+        long long hits;   // acquire() calls served from the pool
+        long long misses; // of which had to construct a new Chunk
+        double hitMs;     // total time spent in acquire() on hits
+        double missMs;    // and on misses
+        size_t pooled;    // chunks waiting in the pool now
+    };
+    Stats stats() const;
+
+private:
+    OpenGLContext* mp_context;
+    MeshArena* mp_arena;
+    MeshArena* mp_depthArena;
+    ChunkResidency* mp_residency;
+    std::vector<uPtr<Chunk>> m_free;
+    Stats m_stats;
+};
@@ -0,0 +1,135 @@
+#include "chunkresidency.h"
+#include "terrain.h"
+
+ChunkResidency::ChunkResidency()
+    : m_resident(), m_everResident(), m_cache(), m_cacheIndex(), m_cacheBytes(0),
+      m_budget(0), m_gpuBytes(0), m_gpuChunks(0), m_overBudget(),
+      m_stats{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+{}
+
+ChunkResidency::~ChunkResidency()
+{
+    for (Entry &e : m_cache) {
+        MeshBufferPool::release(std::move(e.mesh));
+    }
+}
+
+void ChunkResidency::update(glm::ivec2 playerZone, int radius,
+                            std::vector<int64_t> &entered, std::vector<int64_t> &evicted)
+{
+    // Distance in zones, along whichever axis is further
+    auto zonesAway = [playerZone](int64_t zone) {
+        glm::ivec2 d = glm::abs(toCoords(zone) - playerZone) / 64;
+        return std::max(d.x, d.y);
+    };
+
+    for (auto it = m_resident.begin(); it != m_resident.end();) {
+        if (zonesAway(*it) > radius + HYSTERESIS) {
+            evicted.push_back(*it);
+            m_stats.evictions++;
+            it = m_resident.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (int dz = -radius; dz <= radius; dz++) {
+        for (int dx = -radius; dx <= radius; dx++) {
+            int64_t zone = toKey(playerZone.x + 64 * dx, playerZone.y + 64 * dz);
+            if (m_resident.insert(zone).second) {
+                entered.push_back(zone);
+                if (!m_everResident.insert(zone).second) {
+                    m_stats.restores++;
+                }
+            }
+        }
+    }
+}
+
+void ChunkResidency::cacheMesh(const ChunkRef &ref, uPtr<ChunkOpaqueTransparentVBOData> mesh)
+{
+    dropMesh(ref.key);
+    size_t bytes = mesh->capacityBytes();
+    m_cache.push_front({ref, std::move(mesh), bytes});
+    m_cacheIndex[ref.key] = m_cache.begin();
+    m_cacheBytes += bytes;
+
+    while (m_cacheBytes > MAX_CACHE_BYTES && m_cache.size() > 1) {
+        Entry &oldest = m_cache.back();
+        m_cacheBytes -= oldest.bytes;
+        m_cacheIndex.erase(oldest.ref.key);
+        MeshBufferPool::release(std::move(oldest.mesh));
+        m_cache.pop_back();
+        m_stats.dropped++;
+    }
+}
+
+uPtr<ChunkOpaqueTransparentVBOData> ChunkResidency::takeMesh(const ChunkRef &ref)
+{
+    auto it = m_cacheIndex.find(ref.key);
+    if (it == m_cacheIndex.end() || it->second->ref.serial != ref.serial) {
+        // A mesh of another chunk that was at this corner is of no use
+        dropMesh(ref.key);
+        m_stats.misses++;
+        return nullptr;
+    }
+    uPtr<ChunkOpaqueTransparentVBOData> mesh = std::move(it->second->mesh);
+    m_cacheBytes -= it->second->bytes;
+    m_cache.erase(it->second);
+    m_cacheIndex.erase(it);
+    m_stats.hits++;
+    return mesh;
+}
+
+void ChunkResidency::dropMesh(int64_t key)
+{
+    auto it = m_cacheIndex.find(key);
+    if (it == m_cacheIndex.end()) {
+        return;
+    }
+    m_cacheBytes -= it->second->bytes;
+    MeshBufferPool::release(std::move(it->second->mesh));
+    m_cache.erase(it->second);
+    m_cacheIndex.erase(it);
+}
+
+void ChunkResidency::noteGpuBytes(size_t before, size_t after)
+{
+    m_gpuBytes += after - before;
+    m_gpuChunks += (after > 0) - (before > 0);
+}
+
+void ChunkResidency::markOverBudget(const ChunkRef &ref, size_t bytes)
+{
+    if (m_overBudget.insert({ref.key, {ref, bytes}}).second) {
+        m_stats.budgetEvictions++;
+    }
+}
+
+void ChunkResidency::clearOverBudget(int64_t key, bool restored)
+{
+    if (m_overBudget.erase(key) > 0 && restored) {
+        m_stats.budgetRestores++;
+    }
+}
+
+std::vector<ChunkResidency::OverBudget> ChunkResidency::overBudget() const
+{
+    std::vector<OverBudget> out;
+    out.reserve(m_overBudget.size());
+    for (const auto &kv : m_overBudget) {
+        out.push_back(kv.second);
+    }
+    return out;
+}
+
+ChunkResidency::Stats ChunkResidency::stats() const
+{
+    Stats s = m_stats;
+    s.overBudget = m_overBudget.size();
+    s.gpuBytes = m_gpuBytes;
+    s.gpuChunks = m_gpuChunks;
+    s.cachedMeshes = m_cache.size();
+    s.cachedBytes = m_cacheBytes;
+    return s;
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include "smartpointerhelp.h"
+#include "glm_includes.h"
+#include "chunkdirectory.h"
+#include "meshpool.h"
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Which terrain generation zones should have their chunks' meshes on the
+// GPU. This is kept apart from which zones are generated: a zone the
+// player leaves stays generated, but its meshes are evicted, and they
+// must be put back when the player returns.
+//
+// Zones within the load radius of the player become resident. They are
+// evicted only once more than HYSTERESIS zones beyond it, so that going
+// back and forth over a zone border does not evict and restore the same
+// meshes each time.
+//
+// Evicted meshes, and meshes finished for chunks that are not resident,
+// wait in a least recently used cache of up to MAX_CACHE_BYTES, so that
+// they can be uploaded again without meshing the chunk.
+//
+// There is also a budget for the bytes of mesh on the GPU. Terrain keeps
+// within it by evicting the meshes of the chunks farthest from the
+// player, even in resident zones, and notes them here as over budget;
+// they come back, nearest first, once there is room again. What the GPU
+// holds is counted here, over this Terrain's chunks alone, so that
+// another Terrain's meshes do not eat into the budget.
+// GUI thread only.
+class ChunkResidency {
+public:
+    static constexpr int HYSTERESIS = 1;
+    static constexpr size_t MAX_CACHE_BYTES = size_t(64) << 20;
+    // Over-budget chunks come back only while the GPU holds less than
+    // this share of the budget, so that one coming back does not push
+    // another out straight away
+    static constexpr double RESTORE_BELOW = 0.9;
+
+    ChunkResidency();
+    ~ChunkResidency();
+
+    // Makes the zones within radius of playerZone resident. Appends the
+    // ones that were not to entered, and those now too far away, which
+    // are no longer resident, to evicted.
+    void update(glm::ivec2 playerZone, int radius,
+                std::vector<int64_t> &entered, std::vector<int64_t> &evicted);
+    bool isResident(int64_t zone) const { return m_resident.count(zone) > 0; }
+
+    // Keeps a mesh of the chunk ref for later, replacing any older one
+    void cacheMesh(const ChunkRef &ref, uPtr<ChunkOpaqueTransparentVBOData> mesh);
+    // Takes the cached mesh of ref out of the cache, or returns nullptr.
+    // The caller checks that it is still up to date.
+    uPtr<ChunkOpaqueTransparentVBOData> takeMesh(const ChunkRef &ref);
+    // Forgets the cached mesh of the chunk at key, if any
+    void dropMesh(int64_t key);
+
+    // Bytes of chunk mesh the GPU may hold, 0 for no limit
+    void setBudget(size_t bytes) { m_budget = bytes; }
+    size_t budget() const { return m_budget; }
+    // Called by Chunk when a chunk made for this Terrain goes from before
+    // to after bytes of mesh on the GPU
+    void noteGpuBytes(size_t before, size_t after);
+    // Bytes of chunk mesh on the GPU now
+    size_t gpuBytes() const { return m_gpuBytes; }
+    // Notes that the chunk ref, in a resident zone, has no mesh on the GPU
+    // for want of room, and that its mesh takes bytes
+    void markOverBudget(const ChunkRef &ref, size_t bytes);
+    // Forgets the chunk at key: restored if it is going back on the GPU,
+    // else because it is no longer resident
+    void clearOverBudget(int64_t key, bool restored);
+    struct OverBudget {
+        ChunkRef ref;
+        size_t bytes;
+    };
+    // Every chunk marked over budget, in no particular order
+    std::vector<OverBudget> overBudget() const;
+    bool anyOverBudget() const { return !m_overBudget.empty(); }
+
+    struct Stats {
+        long long hits;        // takeMesh() calls that found a mesh
+        long long misses;      // and that did not
+        long long evictions;   // zones evicted by update()
+        long long restores;    // zones made resident again by update()
+        long long dropped;     // meshes pushed out of the full cache
+        long long budgetEvictions; // meshes evicted to keep within budget
+        long long budgetRestores;  // and brought back
+        size_t overBudget;     // chunks waiting for room now
+        size_t gpuBytes;       // bytes of mesh on the GPU now
+        size_t gpuChunks;      // and chunks holding any
+        size_t cachedMeshes;
+        size_t cachedBytes;
+    };
+    Stats stats() const;
+
+private:
+    std::unordered_set<int64_t> m_resident;
+    // Zones that have been resident before, to tell restores apart
+    std::unordered_set<int64_t> m_everResident;
+
+    struct Entry {
+        ChunkRef ref;
+        uPtr<ChunkOpaqueTransparentVBOData> mesh;
+        size_t bytes;
+    };
+    // Most recently cached first
+    std::list<Entry> m_cache;
+    std::unordered_map<int64_t, std::list<Entry>::iterator> m_cacheIndex;
+    size_t m_cacheBytes;
+
+    size_t m_budget;
+    size_t m_gpuBytes;
+    size_t m_gpuChunks;
+    std::unordered_map<int64_t, OverBudget> m_overBudget;
+    Stats m_stats;
+};
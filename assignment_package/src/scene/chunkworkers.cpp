@@ -1,18 +1,31 @@
 #include "chunkworkers.h"
 #include <iostream>
+#include <chrono>
 
-BlockGenerateWorker::BlockGenerateWorker(int x, int z, std::vector<Chunk*> chunksToFill,
+BlockGenerateWorker::BlockGenerateWorker(int x, int z, std::vector<ChunkRef> chunksToFill,
                      std::unordered_set<Chunk*>* chunksCompleted, QMutex* ChunksCompletedLock, Terrain *m) :
     m_xCorner(x), m_zCorner(z), m_chunksToFill(chunksToFill), m_terrain(m),
     mp_chunksCompleted(chunksCompleted), mp_chunksCompletedLock(ChunksCompletedLock)
 {}
 
 void BlockGenerateWorker::run() {
+    ChunkDirectory::ReadGuard guard(m_terrain->m_chunks);
+    std::vector<Chunk*> chunks;
+    for (const ChunkRef &ref : m_chunksToFill) {
+        if (Chunk* chunk = m_terrain->m_chunks.find(ref)) {
+            chunks.push_back(chunk);
+        }
+    }
+
     try{
-        for (Chunk* chunk : m_chunksToFill) {
+        for (Chunk* chunk : chunks) {
 //            mp_chunksCompletedLock->lock();
 //            mp_chunksCompletedLock->unlock();
-            chunk->createChunkBlockData();
+            // Freshly generated blocks are unsaved, but ones rebuilt from
+            // saved edits match the disk already
+            bool fromDisk = chunk->hasSavedEdits();
+            chunk->createChunkBlockData(m_terrain->seed());
+            chunk->publishBlockData(!fromDisk);
 //            mp_chunksCompletedLock->lock();
 //            mp_chunksCompleted->insert(chunk);
 //            mp_chunksCompletedLock->unlock();
@@ -25,7 +38,7 @@ void BlockGenerateWorker::run() {
 
     try{
         mp_chunksCompletedLock->lock();
-        for (Chunk* chunk : m_chunksToFill) {
+        for (Chunk* chunk : chunks) {
             if (chunk->m_blocks[0] != STONE)
                 printf("here");
             mp_chunksCompleted->insert(chunk);
@@ -37,16 +50,24 @@ void BlockGenerateWorker::run() {
     }
 }
 
-VBOWorker::VBOWorker(Chunk* c, std::vector<ChunkOpaqueTransparentVBOData*>* dat, QMutex * datLock, Terrain* m) :
-    mp_chunk(c), mp_chunkVBOsCompleted(dat), mp_chunkVBOsCompletedLock(datLock), m_terrain(m)
+VBOWorker::VBOWorker(uPtr<ChunkSnapshot> snapshot, std::vector<uPtr<ChunkOpaqueTransparentVBOData>>* dat, QMutex * datLock, Terrain* m) :
+    mp_snapshot(std::move(snapshot)), mp_chunkVBOsCompleted(dat), mp_chunkVBOsCompletedLock(datLock), m_terrain(m)
 {}
 
 void VBOWorker::run() {
     try{
         //std::cout << "VBO, Thread " << QThread::currentThreadId() << " start." << std::endl;
-        mp_chunk->createVBOdata();
+        // Stay inside the guard until the mesh is queued, so that
+        // Terrain::reclaimChunks() sees it if the chunk was unloaded
+        ChunkDirectory::ReadGuard guard(m_terrain->m_chunks);
+        Chunk* chunk = m_terrain->m_chunks.find(toKey(mp_snapshot->minX, mp_snapshot->minZ));
+        if (chunk == nullptr || chunk->serial() != mp_snapshot->serial) {
+            return;
+        }
+        uPtr<ChunkOpaqueTransparentVBOData> mesh = chunk->createMesh(*mp_snapshot);
+        mp_snapshot.reset();
         mp_chunkVBOsCompletedLock->lock();
-        mp_chunkVBOsCompleted->push_back(&mp_chunk->vboData);
+        mp_chunkVBOsCompleted->push_back(std::move(mesh));
         mp_chunkVBOsCompletedLock->unlock();
         //std::cout << "VBO, Thread " << QThread::currentThreadId() << " end." << std::endl;
     }
@@ -55,3 +76,85 @@ void VBOWorker::run() {
     }
 }
 
+
+ChunkLoadWorker::ChunkLoadWorker(int x, int z, std::vector<ChunkRef> chunksToLoad, RegionStore* regions,
+                                 std::unordered_set<Chunk*>* chunksCompleted, QMutex* chunksCompletedLock, Terrain* m,
+                                 int priority) :
+    m_xCorner(x), m_zCorner(z), m_chunksToLoad(chunksToLoad), mp_regions(regions),
+    mp_chunksCompleted(chunksCompleted), mp_chunksCompletedLock(chunksCompletedLock), m_terrain(m),
+    m_priority(priority)
+{}
+
+void ChunkLoadWorker::run() {
+    std::vector<ChunkRef> toGenerate;
+    try{
+        ChunkDirectory::ReadGuard guard(m_terrain->m_chunks);
+        for (const ChunkRef &ref : m_chunksToLoad) {
+            Chunk* chunk = m_terrain->m_chunks.find(ref);
+            if (chunk == nullptr) {
+                continue;
+            }
+            // Decoded from the mapped file directly into the chunk
+            RegionStore::Saved saved = RegionStore::Saved::NOTHING;
+            std::vector<BlockEdit> edits;
+            bool loaded = chunk->fillBlocks([&](std::array<BlockType, 65536> &blocks) {
+                saved = mp_regions->load(chunk->get_minX(), chunk->get_minZ(), blocks, edits);
+                return saved == RegionStore::Saved::BLOCKS;
+            });
+            if (!loaded) {
+                // Generation replays any saved edits
+                chunk->setSavedEdits(std::move(edits));
+                toGenerate.push_back(ref);
+                continue;
+            }
+            chunk->publishBlockData(false);
+            mp_chunksCompletedLock->lock();
+            mp_chunksCompleted->insert(chunk);
+            mp_chunksCompletedLock->unlock();
+        }
+    }
+    catch(const std::exception& e){
+        std::cout << "Exception in ChunkLoadWorker:" << e.what() << std::endl;
+    }
+
+    if (!toGenerate.empty()) {
+        QThreadPool::globalInstance()->start(new BlockGenerateWorker(
+            m_xCorner, m_zCorner, toGenerate, mp_chunksCompleted, mp_chunksCompletedLock, m_terrain), m_priority);
+    }
+}
+
+ChunkSaveWorker::ChunkSaveWorker(std::vector<ChunkSave> saves, const char* reason, RegionStore* regions,
+                                 std::atomic<int>* batchesInFlight) :
+    m_saves(std::move(saves)), m_reason(reason), mp_regions(regions), mp_batchesInFlight(batchesInFlight)
+{}
+
+void ChunkSaveWorker::run() {
+    auto start = std::chrono::steady_clock::now();
+    qint64 bytesBefore = mp_regions->bytesWritten();
+    for (const ChunkSave &save : m_saves) {
+        bool saved = save.blocks != nullptr ? mp_regions->save(save.x, save.z, *save.blocks)
+                                            : mp_regions->saveEdits(save.x, save.z, save.edits);
+        if (!saved) {
+            std::cout << "Failed to save chunk " << save.x << ", " << save.z << std::endl;
+        }
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "[save] " << m_reason << ": " << m_saves.size() << " chunks, "
+              << (mp_regions->bytesWritten() - bytesBefore) / 1024.0 << " KB in " << ms << " ms" << std::endl;
+    mp_batchesInFlight->fetch_sub(1);
+}
+
+RegionPrefetchWorker::RegionPrefetchWorker(std::vector<int64_t> zones, RegionStore* regions) :
+    m_zones(zones), mp_regions(regions)
+{}
+
+void RegionPrefetchWorker::run() {
+    for (int64_t zone : m_zones) {
+        glm::ivec2 coord = toCoords(zone);
+        for (int x = coord.x; x < coord.x + 64; x += 16) {
+            for (int z = coord.y; z < coord.y + 64; z += 16) {
+                mp_regions->prefetch(x, z);
+            }
+        }
+    }
+}
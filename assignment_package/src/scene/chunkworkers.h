@@ -2,35 +2,92 @@
 #ifndef CHUNKWORKERS_H
 #define CHUNKWORKERS_H
 #include "chunk.h"
+#include "chunkdirectory.h"
 #include <unordered_set>
+#include <atomic>
 #include <QRunnable>
 #include <QMutex>
 #include "terrain.h"
+#include "regionfile.h"
 
 // BlockTypeWorkers
+// The chunks to fill are looked up when the job runs, inside a
+// ChunkDirectory::ReadGuard, so a zone unloaded while the job was queued
+// is simply skipped
 class BlockGenerateWorker : public QRunnable {
 private:
     // Coords of the terrain zone being generated
     int m_xCorner, m_zCorner;
-    std::vector<Chunk*> m_chunksToFill;
+    std::vector<ChunkRef> m_chunksToFill;
     std::unordered_set<Chunk*>* mp_chunksCompleted;
     QMutex* mp_chunksCompletedLock;
     Terrain* m_terrain;
 public:
-    BlockGenerateWorker(int x, int z, std::vector<Chunk*> chunksToFill,
+    BlockGenerateWorker(int x, int z, std::vector<ChunkRef> chunksToFill,
                         std::unordered_set<Chunk*>* chunksCompleted, QMutex* ChunksCompletedLock, Terrain* m);
     void run() override;
 
 };
 
+// Meshes one chunk from a snapshot taken when the job was scheduled,
+// so it never reads the live chunk or its neighbors. The chunk itself is
+// only looked up, by the snapshot's corner, to address the mesh to it.
 class VBOWorker : public QRunnable {
 private:
-    Chunk* mp_chunk;
-    std::vector<ChunkOpaqueTransparentVBOData*>* mp_chunkVBOsCompleted;
+    uPtr<ChunkSnapshot> mp_snapshot;
+    std::vector<uPtr<ChunkOpaqueTransparentVBOData>>* mp_chunkVBOsCompleted;
     QMutex *mp_chunkVBOsCompletedLock;
     Terrain* m_terrain;
 public:
-    VBOWorker(Chunk* c, std::vector<ChunkOpaqueTransparentVBOData*>* dat, QMutex * datLock, Terrain* m) ;
+    VBOWorker(uPtr<ChunkSnapshot> snapshot, std::vector<uPtr<ChunkOpaqueTransparentVBOData>>* dat, QMutex * datLock, Terrain* m) ;
+    void run() override;
+};
+
+// Runs on Terrain's I/O thread: fills the chunks of a zone from their
+// region files, and passes the ones that were never saved on to a
+// BlockGenerateWorker
+class ChunkLoadWorker : public QRunnable {
+private:
+    int m_xCorner, m_zCorner;
+    std::vector<ChunkRef> m_chunksToLoad;
+    RegionStore* mp_regions;
+    std::unordered_set<Chunk*>* mp_chunksCompleted;
+    QMutex* mp_chunksCompletedLock;
+    Terrain* m_terrain;
+    // QThreadPool priority for the BlockGenerateWorker
+    int m_priority;
+public:
+    ChunkLoadWorker(int x, int z, std::vector<ChunkRef> chunksToLoad, RegionStore* regions,
+                    std::unordered_set<Chunk*>* chunksCompleted, QMutex* chunksCompletedLock, Terrain* m,
+                    int priority);
+    void run() override;
+};
+
+// Runs on Terrain's I/O thread: writes a batch of chunk saves, then
+// prints how long that took and how many bytes it wrote
+class ChunkSaveWorker : public QRunnable {
+private:
+    std::vector<ChunkSave> m_saves;
+    // What queued the batch, for the report: "autosave", "unload", ...
+    const char* m_reason;
+    RegionStore* mp_regions;
+    // Decremented once the batch is written
+    std::atomic<int>* mp_batchesInFlight;
+public:
+    ChunkSaveWorker(std::vector<ChunkSave> saves, const char* reason, RegionStore* regions,
+                    std::atomic<int>* batchesInFlight);
+    void run() override;
+};
+
+// Runs on Terrain's I/O thread: asks the OS to start reading the saved
+// chunks of zones the player is heading towards, so that loading them
+// later does not wait on the disk
+class RegionPrefetchWorker : public QRunnable {
+private:
+    std::vector<int64_t> m_zones;
+    RegionStore* mp_regions;
+public:
+    RegionPrefetchWorker(std::vector<int64_t> zones, RegionStore* regions);
     void run() override;
 };
 
@@ -0,0 +1,61 @@
+#include "evictedmesh.h"
+#include <cstring>
+
+namespace {
+
+// Fills out from data, and moves data past what it read
+template <typename T>
+void readInto(std::vector<T> &out, const char* &data) {
+    size_t bytes = out.size() * sizeof(T);
+    std::memcpy(out.data(), data, bytes);
+    data += bytes;
+}
+
+} // namespace
+
+EvictedMesh::EvictedMesh(OpenGLContext* context, uPtr<ChunkOpaqueTransparentVBOData> mesh, GLuint buffer)
+    : mp_context(context), mp_mesh(std::move(mesh)), m_buffer(buffer),
+      m_fence(context->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0))
+{}
+
+EvictedMesh::~EvictedMesh()
+{
+    mp_context->glDeleteSync(m_fence);
+    mp_context->glDeleteBuffers(1, &m_buffer);
+    MeshBufferPool::release(std::move(mp_mesh));
+}
+
+bool EvictedMesh::ready()
+{
+    GLenum status = mp_context->glClientWaitSync(m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    return status != GL_TIMEOUT_EXPIRED;
+}
+
+uPtr<ChunkOpaqueTransparentVBOData> EvictedMesh::take()
+{
+    GLenum status;
+    do {
+        status = mp_context->glClientWaitSync(m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while (status == GL_TIMEOUT_EXPIRED);
+    if (status == GL_WAIT_FAILED) {
+        return nullptr;
+    }
+
+    ChunkOpaqueTransparentVBOData &m = *mp_mesh;
+    size_t bytes = m.m_vboDataOpaque.size() * sizeof(glm::vec4) + m.m_vboDataTransparent.size() * sizeof(glm::vec4) +
+                   m.m_vboDataDepth.size() * sizeof(glm::vec3) + m.m_vboDataShadow.size() * sizeof(glm::vec3);
+    mp_context->glBindBuffer(GL_COPY_READ_BUFFER, m_buffer);
+    const char* data = static_cast<const char*>(
+        mp_context->glMapBufferRange(GL_COPY_READ_BUFFER, 0, bytes, GL_MAP_READ_BIT));
+    if (data == nullptr) {
+        return nullptr;
+    }
+    readInto(m.m_vboDataOpaque, data);
+    readInto(m.m_vboDataTransparent, data);
+    readInto(m.m_vboDataDepth, data);
+    readInto(m.m_vboDataShadow, data);
+    if (mp_context->glUnmapBuffer(GL_COPY_READ_BUFFER) != GL_TRUE) {
+        return nullptr;
+    }
+    return std::move(mp_mesh);
+}
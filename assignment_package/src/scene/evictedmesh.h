@@ -0,0 +1,30 @@
+#pragma once
+#include "smartpointerhelp.h"
+#include "openglcontext.h"
+#include "meshpool.h"
+
+// A mesh Chunk::evictMesh() took off the GPU, on its way back to the CPU.
+// Its vertices were copied, GPU to GPU, into one buffer of its own, which
+// is read once a fence says the GPU has got to the copy. Mapping the
+// arena's page instead would wait for every frame still drawing from it.
+// GUI thread only, with the context current.
+class EvictedMesh {
+public:
+    // mesh has its vectors sized for what buffer holds: the opaque,
+    // transparent, depth and shadow vertices, one after the other. The
+    // copies into buffer must have been issued already.
+    EvictedMesh(OpenGLContext* context, uPtr<ChunkOpaqueTransparentVBOData> mesh, GLuint buffer);
+    ~EvictedMesh();
+
+    // Whether the copy is done, so that take() will not wait for it
+    bool ready();
+    // Reads the mesh out of the buffer, waiting for the copy if need be,
+    // or nullptr if it could not be read
+    uPtr<ChunkOpaqueTransparentVBOData> take();
+
+private:
+    OpenGLContext* mp_context;
+    uPtr<ChunkOpaqueTransparentVBOData> mp_mesh;
+    GLuint m_buffer;
+    GLsync m_fence;
+};
@@ -0,0 +1,380 @@
+#include "mesharena.h"
+#include "shaderprogram.h"
+#include <algorithm>
+
+MeshArena::MeshArena(OpenGLContext* context, Format format)
+    : mp_context(context), m_format(format), m_pages(), m_meshes(), m_freeHandles(),
+      m_indexBuffer(0), m_indexFaces(0), m_useVAOs(true), m_changes(), m_stats{0, 0, 0, 0, 0, 0, 0, 0, 0}
+{}
+
+MeshArena::~MeshArena()
+{
+    if (mp_context == nullptr) {
+        return;
+    }
+    for (Page &page : m_pages) {
+        if (page.buffer != 0) {
+            mp_context->glDeleteBuffers(1, &page.buffer);
+        }
+        deleteVAOs(page);
+    }
+    if (m_indexBuffer != 0) {
+        mp_context->glDeleteBuffers(1, &m_indexBuffer);
+    }
+}
+
+MeshArena::Handle MeshArena::upload(const std::vector<glm::vec4> &vertices)
+{
+    return uploadFaces(vertices.data(), static_cast<int>(vertices.size() / VEC4S_PER_FACE));
+}
+
+MeshArena::Handle MeshArena::upload(const std::vector<glm::vec3> &positions)
+{
+    return uploadFaces(positions.data(), static_cast<int>(positions.size() / 4));
+}
+
+MeshArena::Handle MeshArena::uploadFaces(const void* vertices, int faces)
+{
+    if (faces == 0) {
+        return NONE;
+    }
+    size_t faceBytes = this->faceBytes();
+    reserveIndices(faces);
+    Mesh m = allocate(faces);
+    mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_pages[m.page].buffer);
+    mp_context->glBufferSubData(GL_ARRAY_BUFFER, m.first * faceBytes, faces * faceBytes, vertices);
+
+    Handle h;
+    if (!m_freeHandles.empty()) {
+        h = m_freeHandles.back();
+        m_freeHandles.pop_back();
+    } else {
+        h = static_cast<Handle>(m_meshes.size());
+        m_meshes.push_back({});
+    }
+    m_meshes[h] = m;
+    return h;
+}
+
+void MeshArena::release(Handle h)
+{
+    if (h == NONE) {
+        return;
+    }
+    Mesh &m = m_meshes[h];
+    giveBack(m.page, m.first, m.faces);
+    m = {-1, 0, 0};
+    m_freeHandles.push_back(h);
+}
+
+void MeshArena::copyOut(Handle h, GLuint buffer, size_t offset)
+{
+    if (h == NONE) {
+        return;
+    }
+    size_t faceBytes = this->faceBytes();
+    const Mesh &m = m_meshes[h];
+    mp_context->glBindBuffer(GL_COPY_READ_BUFFER, m_pages[m.page].buffer);
+    mp_context->glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    mp_context->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                    m.first * faceBytes, offset, m.faces * faceBytes);
+}
+
+bool MeshArena::shrink()
+{
+    int emptiest = -1;
+    long long freeFaces = 0;
+    for (size_t p = 0; p < m_pages.size(); p++) {
+        const Page &page = m_pages[p];
+        if (page.buffer == 0) {
+            continue;
+        }
+        freeFaces += page.faces - page.usedFaces;
+        if (emptiest < 0 || page.usedFaces < m_pages[emptiest].usedFaces) {
+            emptiest = static_cast<int>(p);
+        }
+    }
+    if (emptiest < 0 || freeFaces - (m_pages[emptiest].faces - m_pages[emptiest].usedFaces)
+                        < m_pages[emptiest].usedFaces + static_cast<long long>(SHRINK_FREE_PAGES) * PAGE_FACES) {
+        return false;
+    }
+
+    // Move its meshes, biggest first so they are the likeliest to fit,
+    // GPU to GPU
+    std::vector<Mesh*> live;
+    for (Mesh &m : m_meshes) {
+        if (m.page == emptiest) {
+            live.push_back(&m);
+        }
+    }
+    std::sort(live.begin(), live.end(), [](const Mesh *a, const Mesh *b) { return a->faces > b->faces; });
+    size_t faceBytes = this->faceBytes();
+    for (Mesh *m : live) {
+        Mesh to = allocate(m->faces, emptiest);
+        if (to.page < 0) {
+            return false;
+        }
+        mp_context->glBindBuffer(GL_COPY_READ_BUFFER, m_pages[emptiest].buffer);
+        mp_context->glBindBuffer(GL_COPY_WRITE_BUFFER, m_pages[to.page].buffer);
+        mp_context->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                        m->first * faceBytes, to.first * faceBytes, m->faces * faceBytes);
+        giveBack(m->page, m->first, m->faces);
+        *m = to;
+    }
+    m_stats.shrinks++;
+    return true;
+}
+
+void MeshArena::beginBatch()
+{
+    for (Page &page : m_pages) {
+        page.counts.clear();
+        page.baseVertices.clear();
+    }
+}
+
+void MeshArena::addToBatch(Handle h)
+{
+    if (h == NONE) {
+        return;
+    }
+    const Mesh &m = m_meshes[h];
+    Page &page = m_pages[m.page];
+    page.counts.push_back(6 * m.faces);
+    page.baseVertices.push_back(4 * m.first);
+}
+
+void MeshArena::drawBatch(ShaderProgram &prog, int textureSlot)
+{
+    GLint previous = -1;
+    for (size_t p = 0; p < m_pages.size(); p++) {
+        Page &page = m_pages[p];
+        if (page.counts.empty()) {
+            continue;
+        }
+        if (m_useVAOs) {
+            if (previous < 0) {
+                mp_context->glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+                m_stats.glCalls++;
+            }
+            bindVAO(p, prog);
+            m_stats.glCalls += 1 + prog.drawMulti(page.counts, page.baseVertices, textureSlot);
+        } else {
+            m_stats.glCalls += prog.drawInterleavedMulti(page.buffer, m_indexBuffer, page.counts,
+                                                         page.baseVertices, textureSlot, m_format == POSITIONS);
+        }
+        m_stats.drawCalls++;
+        m_stats.meshesDrawn += page.counts.size();
+    }
+    if (previous >= 0) {
+        mp_context->glBindVertexArray(previous);
+        m_stats.glCalls++;
+    }
+}
+
+std::vector<glm::ivec2> MeshArena::takeChanges()
+{
+    std::vector<glm::ivec2> changes;
+    changes.swap(m_changes);
+    return changes;
+}
+
+MeshArena::Stats MeshArena::stats() const
+{
+    Stats s = m_stats;
+    for (const Page &page : m_pages) {
+        if (page.buffer != 0) {
+            s.pages++;
+            s.usedBytes += page.usedFaces * faceBytes();
+            s.capacityBytes += page.faces * faceBytes();
+            s.vaos += page.vaos.size();
+        }
+    }
+    return s;
+}
+
+MeshArena::Mesh MeshArena::allocate(int faces, int exclude)
+{
+    for (size_t p = 0; p < m_pages.size(); p++) {
+        if (static_cast<int>(p) == exclude) {
+            continue;
+        }
+        for (const auto &range : m_pages[p].free) {
+            if (range.second >= faces) {
+                int first = range.first;
+                take(p, first, faces);
+                return {static_cast<int>(p), first, faces};
+            }
+        }
+    }
+    // Room enough in some page, only not in one piece
+    for (size_t p = 0; p < m_pages.size(); p++) {
+        Page &page = m_pages[p];
+        if (static_cast<int>(p) != exclude && page.buffer != 0 && page.faces - page.usedFaces >= faces) {
+            compact(p);
+            int first = page.usedFaces;
+            take(p, first, faces);
+            return {static_cast<int>(p), first, faces};
+        }
+    }
+    if (exclude >= 0) {
+        return {-1, 0, 0};
+    }
+    int p = addPage(std::max(PAGE_FACES, faces));
+    take(p, 0, faces);
+    return {p, 0, faces};
+}
+
+void MeshArena::take(int p, int first, int faces)
+{
+    Page &page = m_pages[p];
+    auto range = page.free.find(first);
+    int left = range->second - faces;
+    page.free.erase(range);
+    if (left > 0) {
+        page.free[first + faces] = left;
+    }
+    page.usedFaces += faces;
+}
+
+void MeshArena::giveBack(int p, int first, int faces)
+{
+    Page &page = m_pages[p];
+    page.usedFaces -= faces;
+
+    // Merge with the free ranges on either side
+    int length = faces;
+    auto next = page.free.lower_bound(first);
+    if (next != page.free.end() && first + length == next->first) {
+        length += next->second;
+        next = page.free.erase(next);
+    }
+    auto prev = next == page.free.begin() ? page.free.end() : std::prev(next);
+    if (prev != page.free.end() && prev->first + prev->second == first) {
+        prev->second += length;
+    } else {
+        page.free[first] = length;
+    }
+
+    if (page.usedFaces > 0) {
+        return;
+    }
+    // Keep the last page, which the next mesh would only add back
+    for (size_t other = 0; other < m_pages.size(); other++) {
+        if (static_cast<int>(other) != p && m_pages[other].buffer != 0) {
+            mp_context->glDeleteBuffers(1, &page.buffer);
+            deleteVAOs(page);
+            page.buffer = 0;
+            page.faces = 0;
+            page.free.clear();
+            return;
+        }
+    }
+}
+
+void MeshArena::compact(int p)
+{
+    Page &page = m_pages[p];
+    std::vector<Mesh*> live;
+    for (Mesh &m : m_meshes) {
+        if (m.page == p) {
+            live.push_back(&m);
+        }
+    }
+    std::sort(live.begin(), live.end(), [](const Mesh *a, const Mesh *b) { return a->first < b->first; });
+
+    // Copy every mesh down into a fresh buffer, GPU to GPU. The source
+    // and destination of one copy may not overlap, so it cannot be done
+    // in place.
+    size_t faceBytes = this->faceBytes();
+    GLuint fresh;
+    mp_context->glGenBuffers(1, &fresh);
+    mp_context->glBindBuffer(GL_COPY_WRITE_BUFFER, fresh);
+    mp_context->glBufferData(GL_COPY_WRITE_BUFFER, page.faces * faceBytes, nullptr, GL_STATIC_DRAW);
+    mp_context->glBindBuffer(GL_COPY_READ_BUFFER, page.buffer);
+    int next = 0;
+    for (Mesh *m : live) {
+        mp_context->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                        m->first * faceBytes, next * faceBytes, m->faces * faceBytes);
+        m->first = next;
+        next += m->faces;
+    }
+    mp_context->glDeleteBuffers(1, &page.buffer);
+    deleteVAOs(page);
+    page.buffer = fresh;
+
+    page.free.clear();
+    if (next < page.faces) {
+        page.free[next] = page.faces - next;
+    }
+    m_stats.compactions++;
+}
+
+int MeshArena::addPage(int faces)
+{
+    // Reuse the slot of a freed page, so handles' page numbers stay valid
+    size_t p = 0;
+    while (p < m_pages.size() && m_pages[p].buffer != 0) {
+        p++;
+    }
+    if (p == m_pages.size()) {
+        m_pages.push_back({0, 0, 0, {}, {}, {}, {}});
+    }
+    Page &page = m_pages[p];
+    mp_context->glGenBuffers(1, &page.buffer);
+    mp_context->glBindBuffer(GL_ARRAY_BUFFER, page.buffer);
+    mp_context->glBufferData(GL_ARRAY_BUFFER, faces * faceBytes(), nullptr, GL_STATIC_DRAW);
+    page.faces = faces;
+    page.usedFaces = 0;
+    page.free.clear();
+    page.free[0] = faces;
+    return static_cast<int>(p);
+}
+
+GLuint MeshArena::bindVAO(int p, ShaderProgram &prog)
+{
+    Page &page = m_pages[p];
+    glm::ivec3 layout = prog.interleavedLayout();
+    if (m_format == POSITIONS) {
+        // Only the position is fed
+        layout = glm::ivec3(layout.x, -1, -1);
+    }
+    for (const auto &vao : page.vaos) {
+        if (vao.first == layout) {
+            mp_context->glBindVertexArray(vao.second);
+            return vao.second;
+        }
+    }
+    // Any program with the same attribute locations can share it
+    GLuint vao = prog.createInterleavedVAO(page.buffer, m_indexBuffer, m_format == POSITIONS);
+    page.vaos.push_back({layout, vao});
+    return vao;
+}
+
+void MeshArena::deleteVAOs(Page &page)
+{
+    for (const auto &vao : page.vaos) {
+        mp_context->glDeleteVertexArrays(1, &vao.second);
+    }
+    page.vaos.clear();
+}
+
+void MeshArena::reserveIndices(int faces)
+{
+    if (faces <= m_indexFaces) {
+        return;
+    }
+    m_indexFaces = std::max(faces, std::max(2 * m_indexFaces, 1 << 16));
+    std::vector<GLuint> indices;
+    indices.reserve(6 * m_indexFaces);
+    for (GLuint i = 0; i < static_cast<GLuint>(m_indexFaces); i++) {
+        for (GLuint corner : {0u, 1u, 2u, 0u, 2u, 3u}) {
+            indices.push_back(4 * i + corner);
+        }
+    }
+    if (m_indexBuffer == 0) {
+        mp_context->glGenBuffers(1, &m_indexBuffer);
+    }
+    mp_context->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+    mp_context->glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include "glm_includes.h"
+#include "openglcontext.h"
+#include <map>
+#include <vector>
+
+class ShaderProgram;
+
+// One set of large vertex buffers holding the meshes of every chunk, so
+// that a pass is drawn with one multi-draw per buffer instead of a bind
+// and a draw per chunk.
+//
+// Meshes are allocated in whole faces of four vertices from pages of
+// PAGE_FACES faces, first fit from a free list that merges
+// neighbouring ranges back together. When no range is big enough but a
+// page has the room in total, that page is compacted into a fresh buffer
+// on the GPU; only when none has is a new page added. A page is freed
+// once empty, and shrink() empties the emptiest one into the others when
+// the arena holds much more than it needs. Meshes are named by handles,
+// which stay the same when they are moved.
+//
+// Every face is drawn with the same six indices, so one index buffer of
+// that pattern serves all meshes, offset by a base vertex.
+//
+// The vertices are either interleaved position, normal and UV, for the
+// passes that shade, or position alone, for the depth-only ones; an arena
+// holds one Format or the other.
+//
+// Each page keeps a VAO for every vertex layout it is drawn with, set up
+// the first time, so that a draw only binds it rather than pointing each
+// attribute at the page again.
+// GUI thread only, with the context current.
+class MeshArena {
+public:
+    using Handle = int;
+    static constexpr Handle NONE = -1;
+    enum Format {
+        INTERLEAVED, // position, normal and UV, a vec4 each
+        POSITIONS    // position alone, a vec3
+    };
+    // About 48 MB of interleaved vertices, 12 MB of positions. A mesh
+    // bigger than that gets a page of its own size.
+    static constexpr int PAGE_FACES = 1 << 18;
+    // Four vertices of position, normal and UV
+    static constexpr size_t VEC4S_PER_FACE = 4 * 3;
+    static constexpr size_t FACE_BYTES = VEC4S_PER_FACE * sizeof(glm::vec4);
+    // Four positions
+    static constexpr size_t POSITION_FACE_BYTES = 4 * sizeof(glm::vec3);
+    // Free space, in pages, that shrink() leaves alone, so that a page
+    // freed is not added back as soon as the next meshes come in
+    static constexpr int SHRINK_FREE_PAGES = 2;
+
+    explicit MeshArena(OpenGLContext* context, Format format = INTERLEAVED);
+    ~MeshArena();
+
+    Format format() const { return m_format; }
+    size_t faceBytes() const { return m_format == INTERLEAVED ? FACE_BYTES : POSITION_FACE_BYTES; }
+
+    // Copies in a mesh of interleaved vertices, VEC4S_PER_FACE to a face,
+    // or of positions, four to a face, as the arena's Format says.
+    // NONE for an empty one.
+    Handle upload(const std::vector<glm::vec4> &vertices);
+    Handle upload(const std::vector<glm::vec3> &positions);
+    // Gives the space of h back; NONE is ignored
+    void release(Handle h);
+    // Copies the vertices of h, GPU to GPU, to offset in buffer, which
+    // must have room for faces(h) * faceBytes() bytes there. Unlike
+    // mapping the page, this does not wait for the draws reading it.
+    void copyOut(Handle h, GLuint buffer, size_t offset);
+    // If more than SHRINK_FREE_PAGES pages' worth is free, moves the
+    // meshes of the emptiest page into the others and frees it.
+    // Returns whether a page was freed.
+    bool shrink();
+    int faces(Handle h) const { return h == NONE ? 0 : m_meshes[h].faces; }
+
+    // Collects meshes to draw and draws them, one multi-draw per page.
+    // drawBatch() leaves the VAO that was bound before bound.
+    void beginBatch();
+    void addToBatch(Handle h);
+    void drawBatch(ShaderProgram &prog, int textureSlot);
+    // Whether drawBatch() uses the pages' VAOs, or sets the attributes up
+    // on every draw, for Benchmark. On by default.
+    void setUseVAOs(bool use) { m_useVAOs = use; }
+
+    // Where the meshes have changed, for whatever keeps something drawn
+    // from them, as MyGL does its shadow maps. Chunks note the corner of
+    // every mesh they upload or release. takeChanges() hands each one
+    // over once; whoever draws takes them every frame.
+    void noteChange(glm::ivec2 corner) { m_changes.push_back(corner); }
+    std::vector<glm::ivec2> takeChanges();
+
+    struct Stats {
+        size_t pages;          // vertex buffers allocated now
+        size_t usedBytes;      // taken by meshes
+        size_t capacityBytes;  // of all pages
+        size_t vaos;           // set up for the pages now
+        long long compactions; // pages moved into a fresh buffer
+        long long shrinks;     // pages emptied by shrink()
+        long long drawCalls;   // multi-draws issued by drawBatch()
+        long long meshesDrawn; // meshes they drew
+        long long glCalls;     // GL calls drawBatch() made in all
+    };
+    Stats stats() const;
+
+private:
+    struct Page {
+        GLuint buffer; // 0 once freed
+        int faces;
+        int usedFaces;
+        // First face to length, of every free range
+        std::map<int, int> free;
+        // The batch being collected: index counts and base vertices
+        std::vector<GLsizei> counts;
+        std::vector<GLint> baseVertices;
+        // Vertex layout to the VAO for it, see ShaderProgram::interleavedLayout()
+        std::vector<std::pair<glm::ivec3, GLuint>> vaos;
+    };
+    struct Mesh {
+        int page; // -1 for an unused handle
+        int first;
+        int faces;
+    };
+
+    // Finds room for a mesh, compacting or adding a page if need be.
+    // With an exclude page, looks only in the others and adds none,
+    // returning page -1 if there is no room.
+    Mesh allocate(int faces, int exclude = -1);
+    // What upload() does for either Format
+    Handle uploadFaces(const void* vertices, int faces);
+    // Takes faces from the free range at first of page p
+    void take(int p, int first, int faces);
+    // Puts faces at first of page p back on its free list, and frees the
+    // page if that empties it and it is not the last one
+    void giveBack(int p, int first, int faces);
+    void compact(int p);
+    int addPage(int faces);
+    // The VAO of page p for the layout of prog, set up if there is none.
+    // Leaves it bound.
+    GLuint bindVAO(int p, ShaderProgram &prog);
+    // Deletes the VAOs of a page, once its buffer is gone
+    void deleteVAOs(Page &page);
+    // Makes the index buffer long enough for a mesh of faces
+    void reserveIndices(int faces);
+
+    OpenGLContext* mp_context;
+    Format m_format;
+    std::vector<Page> m_pages;
+    std::vector<Mesh> m_meshes;
+    std::vector<Handle> m_freeHandles;
+    GLuint m_indexBuffer;
+    int m_indexFaces;
+    bool m_useVAOs;
+    std::vector<glm::ivec2> m_changes;
+    Stats m_stats;
+};
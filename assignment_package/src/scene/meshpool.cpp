@@ -0,0 +1,121 @@
+#include "meshpool.h"
+#include <atomic>
+#include <QMutex>
+
+namespace {
+
+std::vector<uPtr<ChunkOpaqueTransparentVBOData>> sharedFreeList;
+QMutex sharedFreeListLock;
+
+std::atomic<long long> acquiredCount(0);
+std::atomic<long long> createdCount(0);
+std::atomic<long long> allocationCount(0);
+std::atomic<long long> meshBytes(0);
+std::atomic<long long> pooledBytes(0);
+
+template <typename T>
+void reserveCounted(std::vector<T> &v, size_t n) {
+    if (v.capacity() < n) {
+        v.reserve(n);
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+} // namespace
+
+ChunkOpaqueTransparentVBOData::~ChunkOpaqueTransparentVBOData()
+{
+    meshBytes.fetch_sub(m_accountedBytes, std::memory_order_relaxed);
+}
+
+void ChunkOpaqueTransparentVBOData::reserve(int opaqueFaces, int transparentFaces, int shadowFaces)
+{
+    // Every face is 4 vertices of (pos, nor, uv), or 4 positions
+    reserveCounted(m_vboDataOpaque, 12 * opaqueFaces);
+    reserveCounted(m_vboDataTransparent, 12 * transparentFaces);
+    reserveCounted(m_vboDataDepth, 4 * opaqueFaces);
+    reserveCounted(m_vboDataShadow, 4 * shadowFaces);
+    accountCapacity();
+}
+
+void ChunkOpaqueTransparentVBOData::clear()
+{
+    m_vboDataOpaque.clear();
+    m_vboDataTransparent.clear();
+    m_vboDataDepth.clear();
+    m_vboDataShadow.clear();
+}
+
+size_t ChunkOpaqueTransparentVBOData::capacityBytes() const
+{
+    return (m_vboDataOpaque.capacity() + m_vboDataTransparent.capacity()) * sizeof(glm::vec4) +
+           (m_vboDataDepth.capacity() + m_vboDataShadow.capacity()) * sizeof(glm::vec3);
+}
+
+size_t ChunkOpaqueTransparentVBOData::gpuBytes() const
+{
+    return (m_vboDataOpaque.size() + m_vboDataTransparent.size()) * sizeof(glm::vec4) +
+           (m_vboDataDepth.size() + m_vboDataShadow.size()) * sizeof(glm::vec3);
+}
+
+void ChunkOpaqueTransparentVBOData::accountCapacity()
+{
+    size_t bytes = capacityBytes();
+    meshBytes.fetch_add(static_cast<long long>(bytes) - static_cast<long long>(m_accountedBytes),
+                        std::memory_order_relaxed);
+    m_accountedBytes = bytes;
+}
+
+uPtr<ChunkOpaqueTransparentVBOData> MeshBufferPool::acquire(Chunk* c)
+{
+    acquiredCount.fetch_add(1, std::memory_order_relaxed);
+    uPtr<ChunkOpaqueTransparentVBOData> data = nullptr;
+    {
+        QMutexLocker locker(&sharedFreeListLock);
+        if (!sharedFreeList.empty()) {
+            data = std::move(sharedFreeList.back());
+            sharedFreeList.pop_back();
+            pooledBytes.fetch_sub(data->m_accountedBytes, std::memory_order_relaxed);
+        }
+    }
+    if (data == nullptr) {
+        createdCount.fetch_add(1, std::memory_order_relaxed);
+        return mkU<ChunkOpaqueTransparentVBOData>(c);
+    }
+    data->mp_chunk = c;
+    data->m_version = 0;
+    return data;
+}
+
+void MeshBufferPool::release(uPtr<ChunkOpaqueTransparentVBOData> data)
+{
+    if (data == nullptr) {
+        return;
+    }
+    data->clear();
+    data->mp_chunk = nullptr;
+    data->accountCapacity();
+
+    QMutexLocker locker(&sharedFreeListLock);
+    pooledBytes.fetch_add(data->m_accountedBytes, std::memory_order_relaxed);
+    sharedFreeList.push_back(std::move(data));
+}
+
+void MeshBufferPool::trim()
+{
+    std::vector<uPtr<ChunkOpaqueTransparentVBOData>> freed;
+    {
+        QMutexLocker locker(&sharedFreeListLock);
+        freed.swap(sharedFreeList);
+        for (const auto &data : freed) {
+            pooledBytes.fetch_sub(data->m_accountedBytes, std::memory_order_relaxed);
+        }
+    }
+    // The buffers themselves are freed here, outside the lock
+}
+
+MeshBufferPool::Stats MeshBufferPool::stats()
+{
+    return {acquiredCount.load(), createdCount.load(), allocationCount.load(),
+            meshBytes.load(), pooledBytes.load()};
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "smartpointerhelp.h"
+#include "glm_includes.h"
+#include "openglcontext.h"
+#include <vector>
+
+class Chunk;
+
+// The CPU-side mesh of one chunk, split into the opaque and the
+// transparent (water) pass, plus the positions alone of the opaque pass
+// for the depth-only passes. It doubles as the upload ticket: whoever
+// holds the uPtr owns the mesh, from the VBOWorker that fills it, through
+// Terrain's upload queue, to Chunk::bindVBOdata() which hands it back to
+// MeshBufferPool. Recycled instances keep their vectors' capacity.
+struct ChunkOpaqueTransparentVBOData {
+    Chunk* mp_chunk;
+    // ChunkSnapshot::version this mesh was built from
+    int m_version;
+    // Four interleaved vertices per face. There are no indices: every
+    // face is drawn from the same six, see MeshArena.
+    std::vector<glm::vec4> m_vboDataOpaque, m_vboDataTransparent;
+    // Four positions per face. Depth has those of m_vboDataOpaque as they
+    // are, for the depth prepass, whose depth the opaque pass must match
+    // bit for bit. Shadow has the same surface with coplanar neighbouring
+    // faces merged into one, for the shadow maps.
+    std::vector<glm::vec3> m_vboDataDepth, m_vboDataShadow;
+
+    ChunkOpaqueTransparentVBOData(Chunk* c) :
+        mp_chunk(c), m_version(0), m_vboDataOpaque{}, m_vboDataTransparent{},
+        m_vboDataDepth{}, m_vboDataShadow{}, m_accountedBytes(0)
+    {}
+    ~ChunkOpaqueTransparentVBOData();
+
+    // Makes room for exactly this many faces up front, so that meshing
+    // never reallocates halfway through a chunk. Merging never makes more
+    // shadow faces than there are opaque ones.
+    void reserve(int opaqueFaces, int transparentFaces, int shadowFaces);
+    // Empties every buffer but keeps its capacity
+    void clear();
+    // Heap memory held by the vectors
+    size_t capacityBytes() const;
+    // What the mesh takes up once uploaded
+    size_t gpuBytes() const;
+    int opaqueFaces() const { return static_cast<int>(m_vboDataOpaque.size() / 12); }
+    int transparentFaces() const { return static_cast<int>(m_vboDataTransparent.size() / 12); }
+    int shadowFaces() const { return static_cast<int>(m_vboDataShadow.size() / 4); }
+
+private:
+    // Our share of MeshBufferPool::Stats::meshBytes, kept up to date by
+    // accountCapacity() whenever the capacity may have changed
+    size_t m_accountedBytes;
+    void accountCapacity();
+    friend class MeshBufferPool;
+};
+
+// A free list of mesh buffers shared by every meshing thread.
+// Buffers are filled on VBOWorker threads and handed back on the GUI
+// thread once bindVBOdata() has uploaded them, so the list sits behind
+// a mutex. It is one shared list rather than per-thread caches so that
+// trim() can give every idle buffer back once terrain streaming settles.
+class MeshBufferPool {
+public:
+    static uPtr<ChunkOpaqueTransparentVBOData> acquire(Chunk* c);
+    static void release(uPtr<ChunkOpaqueTransparentVBOData> data);
+    // Frees every pooled buffer
+    static void trim();
+
+    struct Stats {
+        long long acquired;    // buffers handed out
+        long long created;     // of which newly constructed
+        long long allocations; // vector (re)allocations made by reserve()
+        long long meshBytes;   // CPU memory held by all mesh buffers
+        long long pooledBytes; // of which sitting idle in the pool
+    };
+    static Stats stats();
+};
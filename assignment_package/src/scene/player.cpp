@@ -1,4 +1,5 @@
 #include "player.h"
+#include "blockaccessor.h"
 #include <QString>
 #include <iostream>
 
@@ -73,22 +74,17 @@ void Player::processCameraRotation(float thetaChange, float phiChange){
     rotateOnUpGlobal(thetaChange);
     rotateOnRightLocal(phiChange);
 }
-bool Player::isBlockAt( glm::vec3& position, const Terrain& terrain) {
-    return terrain.getBlockAt(position) != EMPTY;
-}
-
 bool Player::isOnGround( const Terrain &terrain, InputBundle &input) {
     //std::cout << "entering isOnGround" << std::endl;
 
+    BlockAccessor blocks(terrain);
     glm::vec3 corner = this->m_position - glm::vec3(0.5f, 0, 0.5f);
     for (int x = 0; x <= 1; ++x) {
         for (int z = 0; z <= 1; ++z) {
             glm::vec3 checkPos = glm::vec3(floor(corner.x) + x,
                                            floor(corner.y) - 0.01f, // slightly below the player to ensure the block is indeed beneath
                                            floor(corner.z) + z);
-             if (terrain.m_chunks.size()>0 &&  isBlockAt(checkPos, terrain) && terrain.getBlockAt(checkPos) != EMPTY
-                && terrain.getBlockAt(checkPos) != WATER
-                && terrain.getBlockAt(checkPos) != LAVA) {
+             if (blockInfo(blocks.get(checkPos).value_or(EMPTY)).collidable) {
                 input.isOnGround = true;
                 //std::cout << "ground" << std::endl;
 
@@ -106,9 +102,10 @@ float Player::getHeight(const Terrain &terrain){
     glm::vec3 curr_pos = glm::vec3(
         floor(m_position.x - 0.5), floor(m_position.y), floor(m_position.z - 0.5)
     );
+    BlockAccessor blocks(terrain);
     float height = 0;
     while (curr_pos.y - height > 0.01f){
-        if (terrain.getBlockAt(curr_pos.x, curr_pos.y - height, curr_pos.z) != EMPTY)
+        if (blocks.get(glm::vec3(curr_pos.x, curr_pos.y - height, curr_pos.z)).value_or(EMPTY) != EMPTY)
             break;
         height += 1;
     }
@@ -118,13 +115,14 @@ float Player::getHeight(const Terrain &terrain){
 
 bool Player::isInWater( const Terrain &terrain, InputBundle &input) {
 
+    BlockAccessor blocks(terrain);
     glm::vec3 corner = this->m_position + glm::vec3(0.5f, 1.5f, 0.5f);
     for (int x = 0; x <= 1; ++x) {
         for (int z = 0; z <= 1; ++z) {
             glm::vec3 checkPos = glm::vec3(floor(corner.x) + x,
                                            floor(corner.y) - 0.01f, // slightly below the player to ensure the block is indeed beneath
                                            floor(corner.z) + z);
-            if (terrain.m_chunks.size()>0 && isBlockAt(checkPos, terrain) && terrain.getBlockAt(checkPos) == WATER) {
+            if (blocks.get(checkPos) == WATER) {
                  input.isInWater= true;
                    //std::cout << "water" << std::endl;
                 return true;
@@ -137,13 +135,14 @@ bool Player::isInWater( const Terrain &terrain, InputBundle &input) {
 bool Player::isInLava( const Terrain &terrain, InputBundle &input) {
 
 
+    BlockAccessor blocks(terrain);
     glm::vec3 corner = this->m_position + glm::vec3(0.5f, 1.5f, 0.5f);
     for (int x = 0; x <= 1; ++x) {
         for (int z = 0; z <= 1; ++z) {
             glm::vec3 checkPos = glm::vec3(floor(corner.x) + x,
                                            floor(corner.y) - 0.01f, // slightly below the player to ensure the block is indeed beneath
                                            floor(corner.z) + z);
-            if (terrain.m_chunks.size()>0 &&isBlockAt(checkPos, terrain) && terrain.getBlockAt(checkPos) == LAVA) {
+            if (blocks.get(checkPos) == LAVA) {
                  input.isInLava= true;
 
                 return true;
@@ -235,6 +234,8 @@ bool Player::gridMarch(glm::vec3 rayOrigin, glm::vec3 rayDirection, const Terrai
         *out_prevCell = currCell;
     }
 
+    // Consecutive cells are almost always in the same chunk
+    BlockAccessor blocks(terrain);
     float curr_t = 0.f;
     while(curr_t < maxLen) {
         float min_t = glm::sqrt(3.f);
@@ -268,10 +269,10 @@ bool Player::gridMarch(glm::vec3 rayOrigin, glm::vec3 rayDirection, const Terrai
             *out_prevCell = currCell;
         }
         currCell = glm::ivec3(glm::floor(rayOrigin)) + offset;
-        // If currCell contains something other than EMPTY, return
-        // curr_t
-        BlockType cellType = terrain.getBlockAt(currCell.x, currCell.y, currCell.z);
-        if(cellType != EMPTY & cellType != WATER && cellType != LAVA) {
+        // If currCell contains something solid, return
+        // curr_t. Unloaded chunks do not stop the ray.
+        BlockType cellType = blocks.get(currCell.x, currCell.y, currCell.z).value_or(EMPTY);
+        if(blockInfo(cellType).collidable) {
             *out_blockHit = currCell;
             *out_dist = glm::min(maxLen, curr_t);
             return true;
@@ -306,13 +307,14 @@ void Player::addBlock(Terrain *terrain){
 
     if (gridMarch(corner, rayDir, *terrain, &collDist, &collHit, &newBlockPos)) {
         if(collDist < maxDistance){
-            if(terrain->getBlockAt(newBlockPos.x, newBlockPos.y, newBlockPos.z) == EMPTY
+            if(terrain->tryGetBlockAt(newBlockPos.x, newBlockPos.y, newBlockPos.z) == EMPTY
                 && canPlaceBlock(newBlockPos,m_position)) {
                 BlockType blockType = GRASS;
-                terrain->setBlockAt(newBlockPos.x, newBlockPos.y, newBlockPos.z, blockType);
-                // update chunk
-                uPtr<Chunk>& chunk = terrain->getChunkAt(newBlockPos.x, newBlockPos.z);
-                chunk->refreshChunkVBOData();
+                BlockBox box{newBlockPos, newBlockPos + glm::ivec3(1)};
+                // update only the chunks whose faces changed
+                for (Chunk* c : terrain->writeRegion(box, {blockType})) {
+                    c->refreshChunkVBOData();
+                }
             }
         }
     }
@@ -331,13 +333,12 @@ void Player::removeBlock() {
 
     if (gridMarch(corner, rayDir, mcr_terrain, &collDist, &collHit)) {
         if(collDist < maxDistance){
-            BlockType removedBlockType = mcr_terrain.getBlockAt(collHit.x, collHit.y, collHit.z);
-            // Store it for future use.
-            // update the chunk containing this block
-            uPtr<Chunk>& chunk = mcr_terrain.getChunkAt(collHit.x, collHit.z);
-            chunk->setBlockAt(collHit.x - chunk->get_minX(), collHit.y, collHit.z - chunk->get_minZ(), EMPTY);
-            chunk->refreshChunkVBOData();
-            chunk->refreshAdjacentChunkVBOData();
+            BlockBox box{collHit, collHit + glm::ivec3(1)};
+            // update the chunk containing this block, and its neighbors
+            // only if the block was on their border
+            for (Chunk* c : mcr_terrain.writeRegion(box, {EMPTY})) {
+                c->refreshChunkVBOData();
+            }
         }
     }
 }
@@ -14,7 +14,6 @@ private:
     void processInputs(InputBundle &inputs);
     void computePhysics(float dT, const Terrain &terrain, InputBundle &input);
     void terrain_collision_check(glm::vec3 *rayDir, const Terrain &terrain);
-    bool isBlockAt(glm::vec3& position, const Terrain& terrain);
     bool isOnGround(const Terrain &terrain, InputBundle &input);
     bool gridMarch(glm::vec3 rayOrigin, glm::vec3 rayDirection, const Terrain &terrain, float *out_dist, glm::ivec3 *out_blockHit, glm::ivec3 *prevCell = nullptr);
     glm::ivec3 computeFaceNormal(const glm::ivec3 &blockPos, const glm::vec3 &collisionPoint);
@@ -0,0 +1,361 @@
+#include "regionfile.h"
+#include "terrain.h"
+#include "blockregistry.h"
+#include <QDir>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char MAGIC[4] = {'M', 'M', 'R', 'G'};
+const int RUN_BYTES = 3;
+const int EDIT_BYTES = 3;
+// First byte of every payload
+const char KIND_BLOCKS = 0;
+const char KIND_EDITS = 1;
+
+// Most of a chunk is long runs of STONE and EMPTY, so even this simple
+// encoding is a few KB per chunk, and decoding it is a handful of fills
+QByteArray encodeRuns(const std::array<BlockType, 65536> &blocks)
+{
+    QByteArray out(1, KIND_BLOCKS);
+    size_t i = 0;
+    while (i < blocks.size()) {
+        size_t end = i + 1;
+        while (end < blocks.size() && blocks[end] == blocks[i]) {
+            end++;
+        }
+        char run[RUN_BYTES];
+        run[0] = static_cast<char>(blocks[i]);
+        qToLittleEndian<uint16_t>(static_cast<uint16_t>(end - i - 1), run + 1);
+        out.append(run, RUN_BYTES);
+        i = end;
+    }
+    return out;
+}
+
+bool decodeRuns(const uchar *in, uint32_t length, std::array<BlockType, 65536> &blocks)
+{
+    if (length % RUN_BYTES != 0) {
+        return false;
+    }
+    size_t i = 0;
+    for (const uchar *run = in; run < in + length; run += RUN_BYTES) {
+        size_t count = qFromLittleEndian<uint16_t>(run + 1) + 1;
+        if (run[0] >= BlockRegistry::COUNT || count > blocks.size() - i) {
+            return false;
+        }
+        std::fill_n(blocks.begin() + i, count, static_cast<BlockType>(run[0]));
+        i += count;
+    }
+    return i == blocks.size();
+}
+
+QByteArray encodeEdits(const std::vector<BlockEdit> &edits)
+{
+    QByteArray out(1, KIND_EDITS);
+    for (const BlockEdit &e : edits) {
+        char entry[EDIT_BYTES];
+        qToLittleEndian<uint16_t>(e.index, entry);
+        entry[2] = static_cast<char>(e.type);
+        out.append(entry, EDIT_BYTES);
+    }
+    return out;
+}
+
+bool decodeEdits(const uchar *in, uint32_t length, std::vector<BlockEdit> &edits)
+{
+    if (length % EDIT_BYTES != 0) {
+        return false;
+    }
+    edits.clear();
+    edits.reserve(length / EDIT_BYTES);
+    for (const uchar *entry = in; entry < in + length; entry += EDIT_BYTES) {
+        if (entry[2] >= BlockRegistry::COUNT) {
+            return false;
+        }
+        edits.push_back({qFromLittleEndian<uint16_t>(entry), static_cast<BlockType>(entry[2])});
+    }
+    return true;
+}
+
+} // namespace
+
+RegionFile::RegionFile(const QString &path)
+    : m_file(path), m_entries{}, mp_map(nullptr), m_mapSize(0)
+{
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        std::cout << "Cannot open region file " << path.toStdString() << std::endl;
+        return;
+    }
+
+    QByteArray header = m_file.read(HEADER_BYTES);
+    if (header.size() == HEADER_BYTES && std::memcmp(header.constData(), MAGIC, 4) == 0 &&
+        qFromLittleEndian<uint32_t>(header.constData() + 4) == VERSION) {
+        for (size_t i = 0; i < m_entries.size(); i++) {
+            m_entries[i] = qFromLittleEndian<uint32_t>(header.constData() + 8 + 4 * i);
+        }
+        findFreeSpace();
+        return;
+    }
+
+    // New, truncated or from another version: start an empty region
+    if (m_file.size() > 0) {
+        std::cout << "Discarding unreadable region file " << path.toStdString() << std::endl;
+    }
+    QByteArray empty(HEADER_BYTES, '\0');
+    std::memcpy(empty.data(), MAGIC, 4);
+    qToLittleEndian<uint32_t>(VERSION, empty.data() + 4);
+    m_file.resize(0);
+    m_file.seek(0);
+    if (m_file.write(empty) != HEADER_BYTES) {
+        m_file.close();
+    }
+}
+
+void RegionFile::findFreeSpace()
+{
+    std::vector<std::pair<uint32_t, uint32_t>> used;
+    for (size_t i = 0; i < m_entries.size(); i += 2) {
+        if (m_entries[i + 1] > 0) {
+            used.push_back({m_entries[i], m_entries[i + 1]});
+        }
+    }
+    std::sort(used.begin(), used.end());
+    uint32_t end = static_cast<uint32_t>(HEADER_BYTES);
+    for (const auto &u : used) {
+        if (u.first > end) {
+            m_free[end] = u.first - end;
+        }
+        end = std::max(end, u.first + u.second);
+    }
+    if (m_file.size() > end) {
+        m_free[end] = static_cast<uint32_t>(m_file.size() - end);
+    }
+}
+
+uint32_t RegionFile::allocate(uint32_t length)
+{
+    uint32_t fileEnd = static_cast<uint32_t>(std::max(m_file.size(), HEADER_BYTES));
+    auto it = std::find_if(m_free.begin(), m_free.end(),
+                           [length](const auto &f) { return f.second >= length; });
+    // None big enough: grow the file, from the last gap if it ends there
+    if (it == m_free.end()) {
+        if (!m_free.empty() && std::prev(m_free.end())->first + std::prev(m_free.end())->second == fileEnd) {
+            it = std::prev(m_free.end());
+        } else {
+            return fileEnd;
+        }
+    }
+    uint32_t offset = it->first;
+    uint32_t left = it->second > length ? it->second - length : 0;
+    m_free.erase(it);
+    if (left > 0) {
+        m_free[offset + length] = left;
+    }
+    return offset;
+}
+
+void RegionFile::giveBack(uint32_t offset, uint32_t length)
+{
+    auto next = m_free.lower_bound(offset);
+    if (next != m_free.end() && offset + length == next->first) {
+        length += next->second;
+        next = m_free.erase(next);
+    }
+    if (next != m_free.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += length;
+            return;
+        }
+    }
+    m_free[offset] = length;
+}
+
+bool RegionFile::mapped(uint32_t offset, uint32_t length)
+{
+    qint64 end = static_cast<qint64>(offset) + length;
+    if (end <= m_mapSize) {
+        return true;
+    }
+    // The file grew since it was mapped, or was never mapped
+    if (mp_map != nullptr) {
+        m_file.unmap(mp_map);
+    }
+    m_file.flush();
+    m_mapSize = m_file.size();
+    mp_map = m_mapSize > 0 ? m_file.map(0, m_mapSize) : nullptr;
+    if (mp_map == nullptr) {
+        m_mapSize = 0;
+    }
+    return end <= m_mapSize;
+}
+
+const uchar* RegionFile::payload(int lx, int lz, uint32_t &length)
+{
+    int i = entryIndex(lx, lz);
+    uint32_t offset = m_entries[i];
+    length = m_entries[i + 1];
+    if (!isOpen() || length == 0 || !mapped(offset, length)) {
+        return nullptr;
+    }
+    return mp_map + offset;
+}
+
+void RegionFile::prefetch(int lx, int lz)
+{
+    uint32_t length;
+    const uchar *p = payload(lx, lz, length);
+    if (p == nullptr) {
+        return;
+    }
+#ifdef Q_OS_UNIX
+    // madvise() wants a page-aligned start
+    static const uintptr_t pageMask = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1;
+    uintptr_t start = reinterpret_cast<uintptr_t>(p) & ~pageMask;
+    madvise(reinterpret_cast<void*>(start), reinterpret_cast<uintptr_t>(p) + length - start, MADV_WILLNEED);
+#else
+    // No portable hint elsewhere; touching one byte per page faults the
+    // payload in on this (the I/O) thread instead of the loading one
+    volatile uchar sink = 0;
+    for (uint32_t b = 0; b < length; b += 4096) {
+        sink ^= p[b];
+    }
+    (void)sink;
+#endif
+}
+
+bool RegionFile::write(int lx, int lz, const QByteArray &payload)
+{
+    if (!isOpen()) {
+        return false;
+    }
+    int i = entryIndex(lx, lz);
+    uint32_t length = payload.size();
+    // Never over the old copy, which stays readable until the header
+    // entry points at the new one
+    uint32_t offset = allocate(length);
+    if (!m_file.seek(offset) || m_file.write(payload) != length) {
+        giveBack(offset, length);
+        return false;
+    }
+
+    // The payload is in place; now point the header at it
+    char entry[8];
+    qToLittleEndian<uint32_t>(offset, entry);
+    qToLittleEndian<uint32_t>(length, entry + 4);
+    if (!m_file.seek(8 + 4 * i) || m_file.write(entry, 8) != 8) {
+        giveBack(offset, length);
+        return false;
+    }
+    m_file.flush();
+    if (m_entries[i + 1] > 0) {
+        giveBack(m_entries[i], m_entries[i + 1]);
+    }
+    m_entries[i] = offset;
+    m_entries[i + 1] = length;
+    return true;
+}
+
+RegionStore::RegionStore(const QString &directory)
+    : m_directory(directory), m_regions(), m_bytesWritten(0)
+{}
+
+RegionFile* RegionStore::region(int cx, int cz, bool create)
+{
+    int rx = cx >> RegionFile::SIZE_LOG2, rz = cz >> RegionFile::SIZE_LOG2;
+    auto it = m_regions.find(toKey(rx, rz));
+    if (it != m_regions.end()) {
+        return it->second.get();
+    }
+    QString name = "r." + QString::number(rx) + "." + QString::number(rz) + ".dat";
+    QString path = QDir(m_directory).filePath(name);
+    if (!create && !QFile::exists(path)) {
+        return nullptr;
+    }
+    QDir().mkpath(m_directory);
+    uPtr<RegionFile> &r = m_regions[toKey(rx, rz)];
+    r = mkU<RegionFile>(path);
+    return r.get();
+}
+
+RegionStore::Saved RegionStore::load(int x, int z, std::array<BlockType, 65536> &blocks, std::vector<BlockEdit> &edits)
+{
+    int cx = x >> 4, cz = z >> 4;
+    RegionFile *r = region(cx, cz, false);
+    uint32_t length;
+    const uchar *p = r != nullptr ? r->payload(cx & (RegionFile::SIZE - 1), cz & (RegionFile::SIZE - 1), length) : nullptr;
+    if (p == nullptr) {
+        return Saved::NOTHING;
+    }
+    if (p[0] == KIND_BLOCKS && decodeRuns(p + 1, length - 1, blocks)) {
+        return Saved::BLOCKS;
+    }
+    if (p[0] == KIND_EDITS && decodeEdits(p + 1, length - 1, edits)) {
+        return Saved::EDITS;
+    }
+    std::cout << "Corrupt saved chunk at " << x << ", " << z << std::endl;
+    return Saved::NOTHING;
+}
+
+bool RegionStore::write(int cx, int cz, const QByteArray &payload)
+{
+    if (!region(cx, cz, true)->write(cx & (RegionFile::SIZE - 1), cz & (RegionFile::SIZE - 1), payload)) {
+        return false;
+    }
+    m_bytesWritten += payload.size() + 8;
+    return true;
+}
+
+bool RegionStore::save(int x, int z, const std::array<BlockType, 65536> &blocks)
+{
+    return write(x >> 4, z >> 4, encodeRuns(blocks));
+}
+
+bool RegionStore::saveEdits(int x, int z, const std::vector<BlockEdit> &edits)
+{
+    return write(x >> 4, z >> 4, encodeEdits(edits));
+}
+
+void RegionStore::prefetch(int x, int z)
+{
+    int cx = x >> 4, cz = z >> 4;
+    if (RegionFile *r = region(cx, cz, false)) {
+        r->prefetch(cx & (RegionFile::SIZE - 1), cz & (RegionFile::SIZE - 1));
+    }
+}
+
+uint32_t RegionStore::worldSeed(uint32_t fallback)
+{
+    QDir().mkpath(m_directory);
+    QFile file(QDir(m_directory).filePath("seed.dat"));
+    if (!file.open(QIODevice::ReadWrite)) {
+        return fallback;
+    }
+    QByteArray saved = file.read(4);
+    if (saved.size() == 4) {
+        return qFromLittleEndian<uint32_t>(saved.constData());
+    }
+    char bytes[4];
+    qToLittleEndian<uint32_t>(fallback, bytes);
+    file.resize(0);
+    file.seek(0);
+    file.write(bytes, 4);
+    return fallback;
+}
+
+qint64 RegionStore::diskUsage() const
+{
+    qint64 bytes = 0;
+    for (const auto &kv : m_regions) {
+        bytes += kv.second->size();
+    }
+    return bytes;
+}
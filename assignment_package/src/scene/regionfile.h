@@ -0,0 +1,127 @@
+#pragma once
+#include "smartpointerhelp.h"
+#include "chunkhelper.h"
+#include <QString>
+#include <QFile>
+#include <QByteArray>
+#include <array>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+// One region file: the saved blocks of a 32 x 32 square of chunks.
+//
+// Layout, all integers little-endian:
+//   "MMRG", uint32 format version
+//   32 x 32 entries of { uint32 offset, uint32 length }, indexed by
+//     (local chunk x) + 32 * (local chunk z); length 0 means not saved
+//   payloads: a uint8 kind, then
+//     BLOCKS: the chunk's 65536 blocks in index order, as runs of
+//       { uint8 block type, uint16 run length - 1 }
+//     EDITS: the blocks changed since generation, as a list of
+//       { uint16 block index, uint8 block type }; the rest of the chunk
+//       is regenerated from the world seed
+//
+// A saved payload goes in the first gap between payloads big enough for
+// it, or at the end of the file if there is none, never over the copy it
+// replaces. Its header entry is only rewritten once the payload is on
+// disk, so an interrupted save leaves the old copy readable; after that
+// the old copy's space is a gap for later saves. The gaps are not stored:
+// they are whatever the header entries leave uncovered, worked out when
+// the file is opened. So a chunk saved over and over, its edits growing
+// each time, reuses its old space instead of the file growing by a copy
+// per save.
+//
+// Payloads are read through a memory mapping of the whole file, so
+// loading a chunk decodes straight from the OS's pages with no read()
+// copy in between. Writes still go through the file, and the mapping
+// is redone when a payload lies past its end.
+class RegionFile {
+public:
+    static constexpr int SIZE_LOG2 = 5;
+    static constexpr int SIZE = 1 << SIZE_LOG2;
+    static constexpr uint32_t VERSION = 3;
+    static constexpr qint64 HEADER_BYTES = 8 + 8 * SIZE * SIZE;
+
+    // Opens the file, creating it with an empty header if needed
+    explicit RegionFile(const QString &path);
+
+    bool isOpen() const { return m_file.isOpen(); }
+    // The payload of local chunk (lx, lz) inside the mapping, valid until
+    // the next write(). nullptr if it was never saved or cannot be read.
+    const uchar* payload(int lx, int lz, uint32_t &length);
+    bool write(int lx, int lz, const QByteArray &payload);
+    qint64 size() const { return m_file.size(); }
+    // Hints to the OS that payload(lx, lz) will be read soon
+    void prefetch(int lx, int lz);
+
+private:
+    QFile m_file;
+    // The header, already byte-swapped: offset and length per chunk
+    std::array<uint32_t, 2 * SIZE * SIZE> m_entries;
+    uchar* mp_map;
+    qint64 m_mapSize;
+
+    // Unused space between payloads: offset to length
+    std::map<uint32_t, uint32_t> m_free;
+
+    static int entryIndex(int lx, int lz) { return 2 * (lx + SIZE * lz); }
+    // Fills m_free from the header entries and the file size
+    void findFreeSpace();
+    // Where to put a payload of length bytes; takes it from m_free
+    uint32_t allocate(uint32_t length);
+    // Puts [offset, offset + length) on m_free, merged with its neighbours
+    void giveBack(uint32_t offset, uint32_t length);
+    // Makes sure the mapping covers [offset, offset + length)
+    bool mapped(uint32_t offset, uint32_t length);
+};
+
+// All the region files of one world, in one directory.
+// Not thread safe: Terrain only uses it from its I/O thread.
+class RegionStore {
+public:
+    // What load() found for a chunk
+    enum class Saved { NOTHING, BLOCKS, EDITS };
+
+    explicit RegionStore(const QString &directory);
+
+    // Reads what was saved of the chunk whose corner is at (x, z): either
+    // all of its blocks, or the edits to replay over a generated chunk.
+    // When the result is not BLOCKS, blocks may have been partly written.
+    Saved load(int x, int z, std::array<BlockType, 65536> &blocks, std::vector<BlockEdit> &edits);
+    bool save(int x, int z, const std::array<BlockType, 65536> &blocks);
+    bool saveEdits(int x, int z, const std::vector<BlockEdit> &edits);
+    // Starts the OS reading the saved chunk at (x, z) in the background
+    void prefetch(int x, int z);
+
+    // The seed the world was generated with, kept next to the region
+    // files. A new world is given fallback.
+    uint32_t worldSeed(uint32_t fallback);
+    // Bytes in the region files opened so far
+    qint64 diskUsage() const;
+    // Payload and header bytes written by save() and saveEdits() so far
+    qint64 bytesWritten() const { return m_bytesWritten; }
+
+    const QString& directory() const { return m_directory; }
+
+private:
+    QString m_directory;
+    // Open region files, keyed by toKey() of their region coordinates
+    std::unordered_map<int64_t, uPtr<RegionFile>> m_regions;
+    qint64 m_bytesWritten;
+
+    // The region file holding chunk (cx, cz). Without create, nullptr if
+    // the file does not exist yet.
+    RegionFile* region(int cx, int cz, bool create);
+    bool write(int cx, int cz, const QByteArray &payload);
+};
+
+// What to write of one chunk, copied on the GUI thread so that the chunk
+// can change or be recycled while the save waits: all of its blocks, or
+// only its edits when blocks is nullptr
+struct ChunkSave {
+    int x, z;
+    uPtr<std::array<BlockType, 65536>> blocks;
+    std::vector<BlockEdit> edits;
+};
@@ -1,14 +1,36 @@
 #include "terrain.h"
 #include <stdexcept>
 #include <iostream>
-
-Terrain::Terrain(OpenGLContext *context)
-    : m_chunks(), m_generatedTerrain(), mp_context(context), mp_texture(nullptr)
-{}
+#include <cstring>
+#include <ctime>
+
+Terrain::Terrain(OpenGLContext *context, const QString &worldDirectory)
+    : m_chunks(), m_generatedTerrain(), m_residency(), mp_context(context), m_idleTicks(0),
+      m_zonePredictor(), m_predictedZones(), m_predictZones(true), m_meshFocus(0), mp_texture(nullptr),
+      m_meshArena(context), m_depthArena(context, MeshArena::POSITIONS),
+      m_chunkPool(context, &m_meshArena, &m_depthArena, &m_residency),
+      mp_regions(mkU<RegionStore>(worldDirectory)),
+      m_ioPool(), m_seed(0), m_saveMode(SaveMode::EDITS_ONLY), m_saveBatchesInFlight(0),
+      m_autosaveSeconds(30), m_lastAutosave(std::chrono::steady_clock::now())
+{
+    m_ioPool.setMaxThreadCount(1);
+    setGpuBudget(DEFAULT_GPU_BUDGET_MB);
+    // Nothing runs on m_ioPool yet, so the store is ours to use here
+    m_seed = mp_regions->worldSeed(static_cast<uint32_t>(std::time(nullptr)));
+}
 
 Terrain::~Terrain() {
-    for (auto &i : m_chunks)
-        i.second->destroyVBOdata();
+    // Loads may still hand chunks on to the generators
+    m_ioPool.waitForDone();
+    QThreadPool::globalInstance()->waitForDone();
+    saveDirty("exit");
+    m_ioPool.waitForDone();
+    m_chunks.forEach([](int64_t, Chunk *c) {
+        if (c->hasVBOdata()) {
+            c->destroyVBOdata();
+        }
+    });
+    m_evicting.clear();
 }
 
 // Combine two 32-bit ints into one 64-bit int
@@ -29,6 +51,10 @@ int64_t toKey(int x, int z) {
     return xz;
 }
 
+int64_t zoneKeyAt(int x, int z) {
+    return toKey(x & ~63, z & ~63);
+}
+
 glm::ivec2 toCoords(int64_t k) {
     // Z is lower 32 bits
     int64_t z = k & 0x00000000ffffffff;
@@ -47,18 +73,8 @@ glm::ivec2 toCoords(int64_t k) {
 // the coordinates at x, y, z have a corresponding Chunk
 BlockType Terrain::getBlockAt(int x, int y, int z) const
 {
-    if(hasChunkAt(x, z)) {
-        // Just disallow action below or above min/max height,
-        // but don't crash the game over it.
-        if(y < 0 || y >= 256) {
-            return EMPTY;
-        }
-        const uPtr<Chunk> &c = getChunkAt(x, z);
-
-        glm::vec2 chunkOrigin = glm::vec2(floor(x / 16.f) * 16, floor(z / 16.f) * 16);
-        return c->getBlockAt(static_cast<unsigned int>(x - chunkOrigin.x),
-                             static_cast<unsigned int>(y),
-                             static_cast<unsigned int>(z - chunkOrigin.y));
+    if(std::optional<BlockType> t = tryGetBlockAt(x, y, z)) {
+        return *t;
     }
     else {
         throw std::out_of_range("Coordinates " + std::to_string(x) +
@@ -67,54 +83,56 @@ BlockType Terrain::getBlockAt(int x, int y, int z) const
     }
 }
 
-BlockType Terrain::getBlockAt(glm::vec3 p) const {
-    return getBlockAt(p.x, p.y, p.z);
+std::optional<BlockType> Terrain::tryGetBlockAt(int x, int y, int z) const
+{
+    const Chunk* c = findChunk(x, z);
+    if(c == nullptr) {
+        return std::nullopt;
+    }
+    // Just disallow action below or above min/max height,
+    // but don't crash the game over it.
+    if(y < 0 || y >= 256) {
+        return EMPTY;
+    }
+    return c->getLocalBlockAt(x & 15, y, z & 15);
 }
 
-bool Terrain::hasChunkAt(int x, int z) const{
-    // Map x and z to their nearest Chunk corner
-    // By flooring x and z, then multiplying by 16,
-    // we clamp (x, z) to its nearest Chunk-space corner,
-    // then scale back to a world-space location.
-    // Note that floor() lets us handle negative numbers
-    // correctly, as floor(-1 / 16.f) gives us -1, as
-    // opposed to (int)(-1 / 16.f) giving us 0 (incorrect!).
-    int xFloor = static_cast<int>(glm::floor(x / 16.f));
-    int zFloor = static_cast<int>(glm::floor(z / 16.f));
-
-    //QMutexLocker locker(&m_chunksMutex);
-    bool ret = m_chunks.find(toKey(16 * xFloor, 16 * zFloor)) != m_chunks.end();
-    return ret;
+BlockType Terrain::getBlockAt(glm::vec3 p) const {
+    return getBlockAt(p.x, p.y, p.z);
 }
 
+Chunk* Terrain::findChunk(int x, int z) const {
+    // An arithmetic shift floors negative numbers too: -1 >> 4 is -1,
+    // the chunk whose corner is at -16, as opposed to (int)(-1 / 16.f)
+    // giving us 0 (incorrect!).
+    int cx = ChunkGrid::chunkCoord(x);
+    int cz = ChunkGrid::chunkCoord(z);
+    if (m_chunkGrid.inWindow(cx, cz)) {
+        return m_chunkGrid.find(cx, cz);
+    }
 
-uPtr<Chunk>& Terrain::getChunkAt(int x, int z) {
-    int xFloor = static_cast<int>(glm::floor(x / 16.f));
-    int zFloor = static_cast<int>(glm::floor(z / 16.f));
-    //QMutexLocker locker(&m_chunksMutex);
-    uPtr<Chunk>& ret = m_chunks[toKey(16 * xFloor, 16 * zFloor)];
-    return ret;
+    return m_chunks.find(toKey(16 * cx, 16 * cz));
 }
 
-
-const uPtr<Chunk>& Terrain::getChunkAt(int x, int z) const {
-    int xFloor = static_cast<int>(glm::floor(x / 16.f));
-    int zFloor = static_cast<int>(glm::floor(z / 16.f));
-    //QMutexLocker locker(&m_chunksMutex);
-    const uPtr<Chunk>& ret = m_chunks.at(toKey(16 * xFloor, 16 * zFloor));
-    return ret;
+bool Terrain::hasChunkAt(int x, int z) const{
+    return findChunk(x, z) != nullptr;
 }
 
 void Terrain::setBlockAt(int x, int y, int z, BlockType t)
 {
 
-    if(hasChunkAt(x, z)) {
-        uPtr<Chunk> &c = getChunkAt(x, z);
-        glm::vec2 chunkOrigin = glm::vec2(floor(x / 16.f) * 16, floor(z / 16.f) * 16);
-        c->setBlockAt(static_cast<unsigned int>(x - chunkOrigin.x),
+    if(Chunk* c = findChunk(x, z)) {
+        // Writing a block back unchanged is not an edit, and must not be
+        // saved as one
+        if (c->getBlockAt(x & 15, y, z & 15) == t) {
+            return;
+        }
+        c->setBlockAt(static_cast<unsigned int>(x & 15),
                       static_cast<unsigned int>(y),
-                      static_cast<unsigned int>(z - chunkOrigin.y),
+                      static_cast<unsigned int>(z & 15),
                       t);
+        c->recordEdit(x & 15, y, z & 15);
+        c->markDirty(y, y);
     }
     else {
         throw std::out_of_range("Coordinates " + std::to_string(x) +
@@ -124,39 +142,42 @@ void Terrain::setBlockAt(int x, int y, int z, BlockType t)
 
 }
 
+bool Terrain::readRegion(const BlockBox &box, std::vector<BlockType> &out) const
+{
+    out.assign(box.volume(), EMPTY);
+    return forEachChunkIn(box, [&](const Chunk* c, glm::ivec3 lo, glm::ivec3 hi) {
+        for (int z = lo.z; z < hi.z; z++) {
+            for (int y = lo.y; y < hi.y; y++) {
+                std::memcpy(&out[box.indexOf(lo.x, y, z)],
+                            &c->m_blocks[(lo.x & 15) + 16 * y + 4096 * (z & 15)],
+                            hi.x - lo.x);
+            }
+        }
+    });
+}
+
+std::vector<Chunk*> Terrain::writeRegion(const BlockBox &box, const std::vector<BlockType> &blocks)
+{
+    return writeRegion(box, [&](int x, int y, int z, BlockType) {
+        return blocks[box.indexOf(x, y, z)];
+    });
+}
+
 Chunk* Terrain::instantiateChunkAt(int x, int z) {
-    uPtr<Chunk> chunk = mkU<Chunk>(x, z, mp_context);
+    uPtr<Chunk> chunk = m_chunkPool.acquire(x, z);
     Chunk *cPtr = chunk.get();
     chunk->m_countOpq = 0;
     chunk->m_countTra = 0;
 
-    //QMutexLocker locker(&m_chunksMutex);
-    m_chunks[toKey(x, z)] = std::move(chunk);
-    //locker.unlock();
-    // Set the neighbor pointers of itself and its neighbors
-    if(hasChunkAt(x, z + 16)) {
-        //locker.relock();
-        auto &chunkNorth = m_chunks[toKey(x, z + 16)];
-        //locker.unlock();
-        cPtr->linkNeighbor(chunkNorth, ZPOS);
-    }
-    if(hasChunkAt(x, z - 16)) {
-        //locker.relock();
-        auto &chunkSouth = m_chunks[toKey(x, z - 16)];
-        //locker.unlock();
-        cPtr->linkNeighbor(chunkSouth, ZNEG);
-    }
-    if(hasChunkAt(x + 16, z)) {
-        //locker.relock();
-        auto &chunkEast = m_chunks[toKey(x + 16, z)];
-        //locker.unlock();
-        cPtr->linkNeighbor(chunkEast, XPOS);
-    }
-    if(hasChunkAt(x - 16, z)) {
-        //locker.relock();
-        auto &chunkWest = m_chunks[toKey(x - 16, z)];
-        //locker.unlock();
-        cPtr->linkNeighbor(chunkWest, XNEG);
+    m_chunks.insert(toKey(x, z), std::move(chunk));
+    m_chunkGrid.insert(ChunkGrid::chunkCoord(x), ChunkGrid::chunkCoord(z), cPtr);
+    // Set the neighbor pointers of itself and its eight neighbors
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            if (dx != 0 || dz != 0) {
+                cPtr->linkNeighbor(findChunk(x + 16 * dx, z + 16 * dz), dx, dz);
+            }
+        }
     }
     return cPtr;
 }
@@ -169,21 +190,30 @@ void Terrain::draw(int minX, int maxX, int minZ, int maxZ, ShaderProgram *shader
     // bind the texture
     mp_texture->bind(0);
 
-    // need optimize!
     // only draw chunk that has vbo data and within visible range!
+    m_meshArena.beginBatch();
+    for(int x = minX; x < maxX; x += 16) {
+        for(int z = minZ; z < maxZ; z += 16) {
+            if (Chunk* chunk = findChunk(x, z)){
+                chunk->addToBatch(opaque);
+            }
+        }
+    }
+    m_meshArena.drawBatch(*shaderProgram, 0);
+}
+
+void Terrain::drawDepth(int minX, int maxX, int minZ, int maxZ, ShaderProgram *shaderProgram, bool shadow)
+{
+    // No texture: depth alone needs nothing but positions
+    m_depthArena.beginBatch();
     for(int x = minX; x < maxX; x += 16) {
         for(int z = minZ; z < maxZ; z += 16) {
-            if (hasChunkAt(x, z)){
-                const uPtr<Chunk> &chunk = getChunkAt(x, z);
-                if (opaque && chunk->m_countOpq <= 0)
-                    continue;
-                if (!opaque && chunk->m_countTra <= 0)
-                    continue;
-
-                shaderProgram->drawInterleaved(chunk.get(), opaque, 0);
+            if (Chunk* chunk = findChunk(x, z)){
+                chunk->addToDepthBatch(shadow);
             }
         }
     }
+    m_depthArena.drawBatch(*shaderProgram, 0);
 }
 
 std::unordered_set<int64_t> Terrain::borderingZone(glm::ivec2 zone, int radius) const {
@@ -198,8 +228,11 @@ std::unordered_set<int64_t> Terrain::borderingZone(glm::ivec2 zone, int radius)
 }
 
 void Terrain::initialTerrainGeneration(glm::vec3 currentPlayerPos){
+    m_chunkGrid.recenter(ChunkGrid::chunkCoord(static_cast<int>(glm::floor(currentPlayerPos.x))),
+                         ChunkGrid::chunkCoord(static_cast<int>(glm::floor(currentPlayerPos.z))), m_chunks);
     glm::ivec2 currentZone(64.f * glm::floor(currentPlayerPos.x / 64.f), 64.f * glm::floor(currentPlayerPos.z / 64.f));
     std::unordered_set<int64_t> currentNearZones = borderingZone(currentZone, zoneRadius);
+    updateResidency(currentZone);
 
     for (auto id : currentNearZones) {
         //This zone id will alaways be ungenerated, but this is a check for safty's sake
@@ -209,6 +242,7 @@ void Terrain::initialTerrainGeneration(glm::vec3 currentPlayerPos){
         }
         //There is no previously generated block, obviously
     }
+    m_ioPool.waitForDone();
     QThreadPool::globalInstance()->waitForDone();
 
     //No need to destroy VBO data.
@@ -222,8 +256,8 @@ void Terrain::initialTerrainGeneration(glm::vec3 currentPlayerPos){
 
     // Binding VBO data
     m_chunksThatHaveVBOsLock.lock();
-    for (ChunkOpaqueTransparentVBOData* cd : m_chunksThatHaveVBOs) {
-        cd->mp_chunk->bindVBOdata();
+    for (auto &mesh : m_chunksThatHaveVBOs) {
+        uploadMesh(std::move(mesh));
     }
     if (m_chunkCreated < 25 * 4 * 4) {
         m_chunkCreated += m_chunksThatHaveVBOs.size();
@@ -233,8 +267,10 @@ void Terrain::initialTerrainGeneration(glm::vec3 currentPlayerPos){
 
 }
 
-void Terrain::multithreadedTerrainUpdate(glm::vec3 currentPlayerPos, glm::vec3 previousPlayerPos)
+void Terrain::multithreadedTerrainUpdate(glm::vec3 currentPlayerPos, glm::vec3 previousPlayerPos, glm::vec3 look)
 {
+    m_chunkGrid.recenter(ChunkGrid::chunkCoord(static_cast<int>(glm::floor(currentPlayerPos.x))),
+                         ChunkGrid::chunkCoord(static_cast<int>(glm::floor(currentPlayerPos.z))), m_chunks);
 
     glm::ivec2 currentZone(64.f * glm::floor(currentPlayerPos.x / 64.f), 64.f * glm::floor(currentPlayerPos.z / 64.f));
     glm::ivec2 previousZone(64.f * glm::floor(previousPlayerPos.x / 64.f), 64.f * glm::floor(previousPlayerPos.z / 64.f));
@@ -242,7 +278,6 @@ void Terrain::multithreadedTerrainUpdate(glm::vec3 currentPlayerPos, glm::vec3 p
     if (currentZone != previousZone){  // start generate new terrains
 
         std::unordered_set<int64_t> currentNearZones = borderingZone(currentZone, zoneRadius);
-        std::unordered_set<int64_t> previousNearZones = borderingZone(previousZone, zoneRadius);
 
         for (auto id : currentNearZones) {
             //This zone id is ungenerated
@@ -252,15 +287,30 @@ void Terrain::multithreadedTerrainUpdate(glm::vec3 currentPlayerPos, glm::vec3 p
             }
         }
 
-        for (auto id : previousNearZones) {
-            if (currentNearZones.count(id) == 0) {
-                glm::ivec2 coord = toCoords(id);
-                for (int x = coord.x; x < coord.x + 64; x += 16) {
-                    for (int z = coord.y; z < coord.y + 64; z += 16) {
-                        auto& chunk = getChunkAt(x, z);
-                        if(chunk) chunk->destroyVBOdata();
-                    }
-                }
+        // One more zone step the same way, for the region files to read ahead
+        glm::ivec2 step = glm::sign(currentZone - previousZone) * 64;
+        std::vector<int64_t> aheadZones;
+        for (auto id : borderingZone(currentZone + step, zoneRadius)) {
+            if (currentNearZones.count(id) == 0 && m_generatedTerrain.count(id) == 0) {
+                aheadZones.push_back(id);
+            }
+        }
+        if (!aheadZones.empty()) {
+            m_ioPool.start(new RegionPrefetchWorker(aheadZones, mp_regions.get()));
+        }
+
+        updateResidency(currentZone);
+    }
+
+    m_meshFocus = glm::ivec2(glm::floor(currentPlayerPos.x), glm::floor(currentPlayerPos.z));
+
+    // Zones the player is heading for, queued behind the ones needed now
+    m_predictedZones.clear();
+    if (m_predictZones) {
+        m_zonePredictor.update(currentPlayerPos, previousPlayerPos, look);
+        for (int64_t id : m_zonePredictor.predict(zoneRadius)) {
+            if (m_generatedTerrain.count(id) == 0) {
+                m_predictedZones.push_back(id);
             }
         }
     }
@@ -283,8 +333,8 @@ void Terrain::multithreadedTerrainUpdate(glm::vec3 currentPlayerPos, glm::vec3 p
     m_chunksThatHaveVBOsLock.lock();
     block_that_have_vbo_size = m_chunksThatHaveVBOs.size();
     bind_terrain_vbo_data(8);
-//    for (ChunkOpaqueTransparentVBOData* cd : m_chunksThatHaveVBOs) {
-//        cd->mp_chunk->bindVBOdata();
+//    for (auto &mesh : m_chunksThatHaveVBOs) {
+//        mesh->mp_chunk->bindVBOdata(std::move(mesh));
 //    }
 //    if (m_chunkCreated < 25 * 4 * 4) {
 //       m_chunkCreated += m_chunksThatHaveVBOs.size();
@@ -292,17 +342,158 @@ void Terrain::multithreadedTerrainUpdate(glm::vec3 currentPlayerPos, glm::vec3 p
 //    m_chunksThatHaveVBOs.clear();
     m_chunksThatHaveVBOsLock.unlock();
 
+    collectEvictedMeshes();
+    enforceGpuBudget();
+    // At most one page a tick, to spread the copies out
+    if (mp_context != nullptr) {
+        m_meshArena.shrink();
+        m_depthArena.shrink();
+    }
+    reclaimChunks();
+    autosaveIfDue();
+
+    // Once streaming has settled for a second, give the pooled mesh
+    // buffers back; the next burst of chunks will allocate new ones
+    if (block_to_generate_size + block_that_have_type_size + block_that_have_vbo_size == 0 &&
+        QThreadPool::globalInstance()->activeThreadCount() == 0) {
+        if (++m_idleTicks == 60) {
+            MeshBufferPool::trim();
+        }
+    } else {
+        m_idleTicks = 0;
+    }
+
     //if ((block_to_generate_size + block_that_have_type_size + block_that_have_vbo_size) != 0)
         //fprintf(stderr, "%d\t%d\t%d\n", block_to_generate_size, block_that_have_type_size, block_that_have_vbo_size);
 
 }
 
+void Terrain::unloadZone(int64_t zone) {
+    glm::ivec2 coord = toCoords(zone);
+    std::vector<ChunkSave> batch;
+    for (int x = coord.x; x < coord.x + 64; x += 16) {
+        for (int z = coord.y; z < coord.y + 64; z += 16) {
+            Chunk* c = findChunk(x, z);
+            if (c == nullptr) {
+                continue;
+            }
+            if (c->isBlockDataReady() && c->isUnsaved()) {
+                copyForSave(c, batch);
+            }
+            c->unlinkNeighbors();
+            m_evicting.erase(std::remove_if(m_evicting.begin(), m_evicting.end(),
+                                            [&](const Evicting &e) { return e.ref.key == toKey(x, z); }),
+                             m_evicting.end());
+            m_residency.dropMesh(toKey(x, z));
+            m_residency.clearOverBudget(toKey(x, z), false);
+            // Give its mesh's space back to the arena
+            if (c->hasVBOdata()) {
+                c->destroyVBOdata();
+            }
+            c->m_countOpq = c->m_countTra = 0;
+            m_chunkGrid.erase(ChunkGrid::chunkCoord(x), ChunkGrid::chunkCoord(z));
+            m_chunks.remove(toKey(x, z));
+        }
+    }
+    m_generatedTerrain.erase(zone);
+    queueSaves(std::move(batch), "unload");
+}
+
+void Terrain::copyForSave(Chunk* c, std::vector<ChunkSave> &batch) {
+    // Copy what to save now: the chunk may be edited or recycled before
+    // the save runs
+    if (m_saveMode == SaveMode::EDITS_ONLY && c->editsTracked()) {
+        if (c->hasEdits()) {
+            batch.push_back({c->get_minX(), c->get_minZ(), nullptr, c->edits()});
+        }
+    } else {
+        batch.push_back({c->get_minX(), c->get_minZ(),
+                         mkU<std::array<BlockType, 65536>>(c->allBlocks()), {}});
+    }
+    c->markSaved();
+}
+
+void Terrain::queueSaves(std::vector<ChunkSave> batch, const char* reason) {
+    if (batch.empty()) {
+        return;
+    }
+    m_saveBatchesInFlight.fetch_add(1);
+    m_ioPool.start(new ChunkSaveWorker(std::move(batch), reason, mp_regions.get(), &m_saveBatchesInFlight));
+}
+
+int Terrain::saveDirty(const char* reason) {
+    std::vector<ChunkSave> batch;
+    m_chunks.forEach([&](int64_t, Chunk *c) {
+        if (c->isBlockDataReady() && c->isUnsaved()) {
+            copyForSave(c, batch);
+        }
+    });
+    int queued = batch.size();
+    queueSaves(std::move(batch), reason);
+    return queued;
+}
+
+int Terrain::saveAll() {
+    return saveDirty("save");
+}
+
+void Terrain::autosaveIfDue() {
+    if (m_autosaveSeconds <= 0 ||
+        std::chrono::steady_clock::now() - m_lastAutosave < std::chrono::seconds(m_autosaveSeconds) ||
+        m_saveBatchesInFlight.load() > 0) {
+        return;
+    }
+    saveDirty("autosave");
+    m_lastAutosave = std::chrono::steady_clock::now();
+}
+
+void Terrain::reclaimChunks() {
+    std::vector<uPtr<Chunk>> freed = m_chunks.collect();
+    if (freed.empty()) {
+        return;
+    }
+    // Workers that saw these chunks have all finished, so nothing new can
+    // be queued for them; forget what already was before freeing them
+    auto isFreed = [&freed](const Chunk* c) {
+        return std::any_of(freed.begin(), freed.end(),
+                           [c](const uPtr<Chunk> &f) { return f.get() == c; });
+    };
+    m_chunksThatHaveBlockDataLock.lock();
+    for (auto it = m_chunksThatHaveBlockData.begin(); it != m_chunksThatHaveBlockData.end();) {
+        it = isFreed(*it) ? m_chunksThatHaveBlockData.erase(it) : std::next(it);
+    }
+    m_chunksThatHaveBlockDataLock.unlock();
+
+    m_chunksThatHaveVBOsLock.lock();
+    for (auto it = m_chunksThatHaveVBOs.begin(); it != m_chunksThatHaveVBOs.end();) {
+        if (isFreed((*it)->mp_chunk)) {
+            MeshBufferPool::release(std::move(*it));
+            it = m_chunksThatHaveVBOs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    m_chunksThatHaveVBOsLock.unlock();
+
+    for (uPtr<Chunk> &c : freed) {
+        m_chunkPool.release(std::move(c));
+    }
+}
+
 void Terrain::spawnVBOWorkers(int n) {
-    // each call, we only spwan n workers to process n chunks
-    while (n-- && m_chunksThatHaveBlockData.size() > 0){
-       // pop the first element
-       Chunk* c = *m_chunksThatHaveBlockData.begin();
-       m_chunksThatHaveBlockData.erase(m_chunksThatHaveBlockData.begin());
+    // each call, we only spwan n workers to process n chunks, the ones
+    // nearest the player first
+    std::vector<Chunk*> ready(m_chunksThatHaveBlockData.begin(), m_chunksThatHaveBlockData.end());
+    auto distance = [this](const Chunk* c) {
+        glm::ivec2 d = glm::ivec2(c->get_minX() + 8, c->get_minZ() + 8) - m_meshFocus;
+        return d.x * d.x + d.y * d.y;
+    };
+    size_t count = std::min(static_cast<size_t>(std::max(n, 0)), ready.size());
+    std::partial_sort(ready.begin(), ready.begin() + count, ready.end(),
+                      [&](const Chunk* a, const Chunk* b) { return distance(a) < distance(b); });
+    for (size_t i = 0; i < count; i++) {
+       Chunk* c = ready[i];
+       m_chunksThatHaveBlockData.erase(c);
        if (c->m_blocks[0] != STONE){
             printf("here");
             continue;
@@ -312,28 +503,42 @@ void Terrain::spawnVBOWorkers(int n) {
 }
 
 void Terrain::spawnVBOWorker(Chunk* chunkNeedingVBOData) {
+    // Copy the chunk and its borders now, on the GUI thread, so the worker
+    // is unaffected by block edits or neighbors linked while it runs
     VBOWorker* worker = new VBOWorker(
-        chunkNeedingVBOData, &m_chunksThatHaveVBOs, &m_chunksThatHaveVBOsLock, this
+        chunkNeedingVBOData->snapshot(), &m_chunksThatHaveVBOs, &m_chunksThatHaveVBOsLock, this
     );
     QThreadPool::globalInstance()->start(worker);
 }
 
 void Terrain::spawnBlockTypeWorkers(int n){
     // call n block type worker each time
-    while (n-- && block_to_generate_id.size() > 0){
+    while (n > 0 && block_to_generate_id.size() > 0){
        int64_t id = *block_to_generate_id.begin();
        block_to_generate_id.erase(block_to_generate_id.begin());
-       spawnBlockTypeWorker(id);
+       // It may have been queued twice, or predicted and spawned already
+       if (m_generatedTerrain.count(id) == 0) {
+           spawnBlockTypeWorker(id);
+           n--;
+       }
+    }
+    // Predicted zones only get what is left, and only while meshing keeps
+    // up, so they never hold back chunks the player can already see.
+    // Their jobs also run behind everything else queued on the pools.
+    m_chunksThatHaveBlockDataLock.lock();
+    bool meshingBehind = m_chunksThatHaveBlockData.size() > MAX_MESH_BACKLOG_FOR_PREDICTION;
+    m_chunksThatHaveBlockDataLock.unlock();
+    while (n > 0 && !meshingBehind && m_predictedZones.size() > 0){
+       int64_t id = m_predictedZones.front();
+       m_predictedZones.erase(m_predictedZones.begin());
+       spawnBlockTypeWorker(id, -1);
+       n--;
     }
 }
 
 void Terrain::bind_terrain_vbo_data(int n){
     while (n-- && m_chunksThatHaveVBOs.size() > 0){
-       ChunkOpaqueTransparentVBOData* cd = *m_chunksThatHaveVBOs.begin();
-       if (cd->m_vboDataOpaque.size() + cd->m_vboDataTransparent.size() == 0)
-            printf("here");
-
-       cd->mp_chunk->bindVBOdata();
+       uploadMesh(std::move(m_chunksThatHaveVBOs.front()));
 
        if (m_chunkCreated < 25 * 4 * 4) {
             m_chunkCreated += 1;
@@ -342,21 +547,195 @@ void Terrain::bind_terrain_vbo_data(int n){
     }
 }
 
-void Terrain::spawnBlockTypeWorker(int64_t zone) {
+void Terrain::uploadMesh(uPtr<ChunkOpaqueTransparentVBOData> mesh) {
+    Chunk* c = mesh->mp_chunk;
+    // A zone evicted while its chunks were being meshed, or one generated
+    // ahead of the player: keep the mesh until the zone is resident
+    if (!m_residency.isResident(zoneKeyAt(c->get_minX(), c->get_minZ()))) {
+        m_residency.cacheMesh({toKey(c->get_minX(), c->get_minZ()), c->serial()}, std::move(mesh));
+        return;
+    }
+    // No room for a chunk that has no mesh up yet; enforceGpuBudget()
+    // decides whether it should push a farther one out
+    size_t budget = m_residency.budget();
+    if (budget > 0 && !c->hasMesh() &&
+        m_residency.gpuBytes() + mesh->gpuBytes() > budget) {
+        ChunkRef ref{toKey(c->get_minX(), c->get_minZ()), c->serial()};
+        m_residency.markOverBudget(ref, mesh->gpuBytes());
+        m_residency.cacheMesh(ref, std::move(mesh));
+        return;
+    }
+    if (mp_context != nullptr) {
+        c->bindVBOdata(std::move(mesh));
+        return;
+    }
+    // A Terrain without a GL context, as in Benchmark::flight(), has
+    // nowhere to upload meshes: only note that the chunk has one, and
+    // what it would take up
+    c->m_uploadedVersion = std::max(c->m_uploadedVersion, mesh->m_version);
+    c->setGpuBytes(mesh->gpuBytes());
+    MeshBufferPool::release(std::move(mesh));
+}
+
+void Terrain::updateResidency(glm::ivec2 playerZone) {
+    std::vector<int64_t> entered, evicted;
+    m_residency.update(playerZone, zoneRadius, entered, evicted);
+    for (int64_t id : evicted) {
+        evictZone(id);
+    }
+    for (int64_t id : entered) {
+        // Zones not generated yet are meshed once they are
+        if (m_generatedTerrain.count(id) > 0) {
+            restoreZone(id);
+        }
+    }
+}
+
+void Terrain::evictZone(int64_t zone) {
+    glm::ivec2 coord = toCoords(zone);
+    for (int x = coord.x; x < coord.x + 64; x += 16) {
+        for (int z = coord.y; z < coord.y + 64; z += 16) {
+            m_residency.clearOverBudget(toKey(x, z), false);
+            Chunk* c = findChunk(x, z);
+            if (c != nullptr && c->hasMesh()) {
+                evictChunk(c);
+            }
+        }
+    }
+}
+
+void Terrain::evictChunk(Chunk* c) {
+    ChunkRef ref{toKey(c->get_minX(), c->get_minZ()), c->serial()};
+    if (uPtr<EvictedMesh> mesh = c->evictMesh()) {
+        m_evicting.push_back({ref, std::move(mesh)});
+    }
+}
+
+void Terrain::collectEvictedMeshes(std::optional<int64_t> key) {
+    for (auto it = m_evicting.begin(); it != m_evicting.end();) {
+        if (it->ref.key != key && !it->mesh->ready()) {
+            ++it;
+            continue;
+        }
+        if (uPtr<ChunkOpaqueTransparentVBOData> mesh = it->mesh->take()) {
+            m_residency.cacheMesh(it->ref, std::move(mesh));
+        }
+        it = m_evicting.erase(it);
+    }
+}
+
+void Terrain::restoreZone(int64_t zone) {
+    glm::ivec2 coord = toCoords(zone);
+    for (int x = coord.x; x < coord.x + 64; x += 16) {
+        for (int z = coord.y; z < coord.y + 64; z += 16) {
+            Chunk* c = findChunk(x, z);
+            // Still on the GPU from before it was evicted
+            if (c != nullptr && !c->hasMesh()) {
+                restoreChunk(c);
+            }
+        }
+    }
+}
+
+void Terrain::restoreChunk(Chunk* c) {
+    // Evicted so lately that its mesh may still be on its way back
+    collectEvictedMeshes(toKey(c->get_minX(), c->get_minZ()));
+    uPtr<ChunkOpaqueTransparentVBOData> mesh = m_residency.takeMesh({toKey(c->get_minX(), c->get_minZ()), c->serial()});
+    // Up to date if no snapshot was taken and no block changed since
+    if (mesh != nullptr && mesh->m_version == c->m_meshVersion && c->dirtySections() == 0) {
+        m_chunksThatHaveVBOsLock.lock();
+        m_chunksThatHaveVBOs.push_back(std::move(mesh));
+        m_chunksThatHaveVBOsLock.unlock();
+        return;
+    }
+    MeshBufferPool::release(std::move(mesh));
+    // Chunks still generating are meshed when they are done
+    if (c->isBlockDataReady()) {
+        m_chunksThatHaveBlockDataLock.lock();
+        m_chunksThatHaveBlockData.insert(c);
+        m_chunksThatHaveBlockDataLock.unlock();
+    }
+}
+
+void Terrain::enforceGpuBudget() {
+    long long budget = static_cast<long long>(m_residency.budget());
+    long long total = static_cast<long long>(m_residency.gpuBytes());
+    if (budget == 0 || (total <= budget && !m_residency.anyOverBudget())) {
+        return;
+    }
+
+    auto distance = [this](int64_t key) {
+        return glm::length(glm::vec2(toCoords(key) + 8 - m_meshFocus));
+    };
+    // Every chunk with a mesh on the GPU, farthest first
+    std::vector<std::pair<float, Chunk*>> uploaded;
+    m_chunks.forEach([&](int64_t key, Chunk *c) {
+        if (c->hasMesh()) {
+            uploaded.push_back({distance(key), c});
+        }
+    });
+    std::sort(uploaded.begin(), uploaded.end(),
+              [](const auto &a, const auto &b) { return a.first > b.first; });
+    size_t farthest = 0;
+    auto evictFarthest = [&]() {
+        Chunk* c = uploaded[farthest++].second;
+        ChunkRef ref{toKey(c->get_minX(), c->get_minZ()), c->serial()};
+        size_t bytes = c->gpuBytes();
+        total -= bytes;
+        evictChunk(c);
+        m_residency.markOverBudget(ref, bytes);
+    };
+    while (total > budget && farthest < uploaded.size()) {
+        evictFarthest();
+    }
+
+    std::vector<ChunkResidency::OverBudget> waiting = m_residency.overBudget();
+    std::sort(waiting.begin(), waiting.end(), [&](const auto &a, const auto &b) {
+        return distance(a.ref.key) < distance(b.ref.key);
+    });
+    int restored = 0;
+    for (const auto &w : waiting) {
+        if (restored == MAX_BUDGET_RESTORES_PER_TICK) {
+            break;
+        }
+        Chunk* c = m_chunks.find(w.ref);
+        if (c == nullptr || c->hasMesh()) {
+            m_residency.clearOverBudget(w.ref.key, false);
+            continue;
+        }
+        float d = distance(w.ref.key);
+        auto fits = [&]() { return total + static_cast<long long>(w.bytes) <= budget * ChunkResidency::RESTORE_BELOW; };
+        while (!fits() && farthest < uploaded.size() && uploaded[farthest].first > d + BUDGET_SWAP_MARGIN) {
+            evictFarthest();
+        }
+        // The rest are farther still
+        if (!fits()) {
+            break;
+        }
+        m_residency.clearOverBudget(w.ref.key, true);
+        restoreChunk(c);
+        total += w.bytes;
+        restored++;
+    }
+}
+
+void Terrain::spawnBlockTypeWorker(int64_t zone, int priority) {
     glm::ivec2 coord = toCoords(zone);
-    std::vector<Chunk*> chunksToFill;
+    std::vector<ChunkRef> chunksToFill;
     for(int x = coord.x; x < coord.x + 64; x += 16) {
         for(int z = coord.y; z < coord.y + 64; z += 16) {
             Chunk* c = instantiateChunkAt(x, z);
-            chunksToFill.push_back(c);
+            chunksToFill.push_back({toKey(x, z), c->serial()});
         }
     }
 
-    BlockGenerateWorker* worker = new BlockGenerateWorker(
-        coord.x, coord.y, chunksToFill,
-        &m_chunksThatHaveBlockData, &m_chunksThatHaveBlockDataLock, this
+    // Chunks that were saved before are read back on the I/O thread,
+    // which starts a BlockGenerateWorker for the rest
+    ChunkLoadWorker* worker = new ChunkLoadWorker(
+        coord.x, coord.y, chunksToFill, mp_regions.get(),
+        &m_chunksThatHaveBlockData, &m_chunksThatHaveBlockDataLock, this, priority
     );
-    QThreadPool::globalInstance()->start(worker);
+    m_ioPool.start(worker, priority);
     /*
     if (QThreadPool::globalInstance()->waitForDone() == false)
     {
@@ -367,6 +746,7 @@ void Terrain::spawnBlockTypeWorker(int64_t zone) {
 }
 
 void Terrain::createChunkBlockData(Chunk* c){
+    c->clearStaleBlocks();
     for(int x = c->get_minX(); x < c->get_minX() + 16; ++x) {
         for(int z = c->get_minZ(); z < c->get_minZ() + 16; ++z) {
             BiomeType biome;
@@ -394,6 +774,7 @@ void Terrain::check_edge(float x_f, float z_f)
         {
             new_chunk = instantiateChunkAt(xFloor + x_bias, zFloor + z_bias);
             createChunkBlockData(new_chunk);
+            new_chunk->publishBlockData(true);
             new_chunk->createVBOdata();
         }
     }
@@ -404,6 +785,7 @@ void Terrain::check_edge(float x_f, float z_f)
         {
             new_chunk = instantiateChunkAt(xFloor + x_bias, zFloor + z_bias);
             createChunkBlockData(new_chunk);
+            new_chunk->publishBlockData(true);
             new_chunk->createVBOdata();
         }
     }
@@ -640,7 +1022,7 @@ void Terrain::CreateTestScene()
     // for each chunk, create the vbo data
     for (int x = m_minX; x < m_maxX; x += 16)
         for (int z = m_minZ; z < m_maxZ; z += 16)
-            m_chunks[toKey(x, z)]->createVBOdata();
+            findChunk(x, z)->createVBOdata();
 
 }
 
@@ -5,12 +5,23 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <cmath>
+#include <algorithm>
+#include <optional>
+#include <atomic>
+#include <chrono>
 #include <QRunnable>
 #include <QMutex>
 #include <QThreadPool>
 #include "shaderprogram.h"
 #include "chunkworkers.h"
 #include "chunk.h"
+#include "chunkgrid.h"
+#include "chunkdirectory.h"
+#include "chunkpool.h"
+#include "regionfile.h"
+#include "zonepredictor.h"
+#include "chunkresidency.h"
+#include "evictedmesh.h"
 #include "texture.h"
 
 
@@ -25,9 +36,38 @@ struct hash<glm::ivec2> {
 };
 }
 
+// An axis-aligned box of blocks in world space, from min up to but
+// not including max
+struct BlockBox {
+    glm::ivec3 min, max;
+
+    glm::ivec3 size() const { return max - min; }
+    int volume() const {
+        glm::ivec3 s = glm::max(size(), glm::ivec3(0));
+        return s.x * s.y * s.z;
+    }
+    // Index of (x, y, z) in a buffer laid out x fastest, then y, then z,
+    // the same order as a Chunk's blocks
+    int indexOf(int x, int y, int z) const {
+        glm::ivec3 s = size();
+        return (x - min.x) + s.x * ((y - min.y) + s.y * (z - min.z));
+    }
+};
+
+// How Terrain writes chunks to the region files
+enum class SaveMode {
+    // Every block, so that loading needs no generation
+    FULL_CHUNKS,
+    // Only the blocks changed since generation; the rest is regenerated
+    // from the world seed on load, and untouched chunks are not saved
+    EDITS_ONLY
+};
+
 // Helper functions to convert (x, z) to and from hash map key
 int64_t toKey(int x, int z);
 glm::ivec2 toCoords(int64_t k);
+// Key of the terrain generation zone holding world-space (x, z)
+int64_t zoneKeyAt(int x, int z);
 
 // The container class for all of the Chunks in the game.
 // Ultimately, while Terrain will always store all Chunks,
@@ -55,54 +95,162 @@ private:
     // surrounding the Player should be rendered, the Chunks
     // in the Terrain will never be deleted until the program is terminated.
     std::unordered_set<int64_t> m_generatedTerrain;
+    // Which of those zones have their meshes on the GPU, and meshes kept
+    // for the ones that do not
+    ChunkResidency m_residency;
+    // Meshes just evicted from the GPU, still being read back for
+    // m_residency's cache; see collectEvictedMeshes()
+    struct Evicting {
+        ChunkRef ref;
+        uPtr<EvictedMesh> mesh;
+    };
+    std::vector<Evicting> m_evicting;
 
     OpenGLContext* mp_context;
 
     std::unordered_set<Chunk*> m_chunksThatHaveBlockData;
     QMutex m_chunksThatHaveBlockDataLock;
-    std::vector<ChunkOpaqueTransparentVBOData*> m_chunksThatHaveVBOs;
+    // Meshes waiting for bind_terrain_vbo_data(); the queue owns them
+    std::vector<uPtr<ChunkOpaqueTransparentVBOData>> m_chunksThatHaveVBOs;
     QMutex m_chunksThatHaveVBOsLock;
+    // Consecutive ticks with no terrain work queued, see
+    // multithreadedTerrainUpdate()
+    int m_idleTicks;
     std::vector<int64_t> block_to_generate_id;
+    // Zones the player is heading for, from m_zonePredictor, spawned only
+    // when block_to_generate_id is empty. Remade every tick.
+    ZonePredictor m_zonePredictor;
+    std::vector<int64_t> m_predictedZones;
+    bool m_predictZones;
+    // See setGpuBudget(); about twice what the default zoneRadius needs
+    static constexpr size_t DEFAULT_GPU_BUDGET_MB = 1024;
+    // Over-budget chunks enforceGpuBudget() brings back per tick
+    static constexpr int MAX_BUDGET_RESTORES_PER_TICK = 8;
+    // How much nearer than the farthest mesh on the GPU, in blocks, an
+    // over-budget chunk must be to take its place
+    static constexpr float BUDGET_SWAP_MARGIN = 32.f;
+    // Chunks waiting to be meshed above which no predicted zone is spawned
+    static constexpr size_t MAX_MESH_BACKLOG_FOR_PREDICTION = 16;
+    // Where the player was last tick; spawnVBOWorkers() meshes the chunks
+    // nearest it first
+    glm::ivec2 m_meshFocus;
     int m_chunkCreated;
-    //mutable QMutex m_chunksMutex;
 
     // the texture that applies to all chunks
     uPtr<Texture> mp_texture;
 
+    // O(1) lookup of the chunks around the player; see findChunk()
+    ChunkGrid m_chunkGrid;
+
+    // Every chunk's mesh on the GPU, and the positions of its opaque pass
+    // for the depth-only passes. Declared before the chunks, so that they
+    // outlive them.
+    MeshArena m_meshArena;
+    MeshArena m_depthArena;
+
+    // Unloaded chunks waiting to be reused by instantiateChunkAt()
+    ChunkPool m_chunkPool;
+
+    // Saved chunks on disk, read and written only by jobs on m_ioPool,
+    // a pool of one thread so that they run one at a time and in order
+    uPtr<RegionStore> mp_regions;
+    QThreadPool m_ioPool;
+    // Decides all the randomness in generation; kept with the region files
+    uint32_t m_seed;
+    SaveMode m_saveMode;
+    // Save batches queued on m_ioPool and not yet written
+    std::atomic<int> m_saveBatchesInFlight;
+    // Seconds between autosaves, 0 for none, and when the last one ran
+    int m_autosaveSeconds;
+    std::chrono::steady_clock::time_point m_lastAutosave;
+
 
 
 public:
-    Terrain(OpenGLContext *context);
+    // Saves to and loads from the world in worldDirectory, which a Terrain
+    // must have to itself: MyGL's is the player's save, and anything else
+    // wanting a world of its own, such as a benchmark, gives a directory
+    // of its own
+    Terrain(OpenGLContext *context, const QString &worldDirectory);
     ~Terrain();
 
-    std::unordered_map<int64_t, uPtr<Chunk>> m_chunks;
+    // Every loaded Chunk. Worker threads may look chunks up here, inside
+    // a ChunkDirectory::ReadGuard, while the GUI thread adds and unloads them.
+    ChunkDirectory m_chunks;
 
     // Instantiates a new Chunk and stores it in
     // our chunk map at the given coordinates.
     // Returns a pointer to the created Chunk.
     Chunk* instantiateChunkAt(int x, int z);
+    // The Chunk containing these world-space coordinates, or nullptr.
+    // Chunks near the player come from m_chunkGrid, the rest from m_chunks.
+    Chunk* findChunk(int x, int z) const;
     // Do these world-space coordinates lie within
     // a Chunk that exists?
     bool hasChunkAt(int x, int z) const;
-    // Assuming a Chunk exists at these coords,
-    // return a mutable reference to it
-    uPtr<Chunk>& getChunkAt(int x, int z);
-    // Assuming a Chunk exists at these coords,
-    // return a const reference to it
-    const uPtr<Chunk>& getChunkAt(int x, int z) const;
+    // Unloads the 4 x 4 chunks of a terrain generation zone, saving any
+    // changes, to be loaded again if the player comes back. The chunks are freed by
+    // a later reclaimChunks(), once no worker can still be using them.
+    void unloadZone(int64_t zone);
+    // Hands unloaded chunks that no worker can see any more back to the
+    // ChunkPool, dropping any work still queued for them. Called every tick.
+    void reclaimChunks();
+    ChunkPool::Stats chunkPoolStats() const { return m_chunkPool.stats(); }
+    ChunkResidency::Stats residencyStats() const { return m_residency.stats(); }
+    MeshArena::Stats meshArenaStats() const { return m_meshArena.stats(); }
+    MeshArena::Stats depthArenaStats() const { return m_depthArena.stats(); }
+    void setUseMeshArenaVAOs(bool use) { m_meshArena.setUseVAOs(use); m_depthArena.setUseVAOs(use); }
+    // Corners of the chunks whose meshes changed since the last call
+    std::vector<glm::ivec2> takeMeshChanges() { return m_meshArena.takeChanges(); }
+    // Megabytes of chunk mesh to keep on the GPU at most, 0 for no limit.
+    // Past it, the meshes farthest from the player are evicted first.
+    void setGpuBudget(size_t megabytes) { m_residency.setBudget(megabytes << 20); }
+    size_t gpuBudget() const { return m_residency.budget(); }
+    // Queues a save of every generated chunk whose blocks are not on disk
+    // yet. Returns how many were queued.
+    int saveAll();
+    uint32_t seed() const { return m_seed; }
+    void setSaveMode(SaveMode mode) { m_saveMode = mode; }
+    // Every this many seconds multithreadedTerrainUpdate() saves the
+    // chunks edited since the last save, in one batch. 0 turns it off.
+    void setAutosaveInterval(int seconds) { m_autosaveSeconds = seconds; }
     // Given a world-space coordinate (which may have negative
     // values) return the block stored at that point in space.
+    // Throws std::out_of_range if there is no Chunk there
     BlockType getBlockAt(int x, int y, int z) const;
     BlockType getBlockAt(glm::vec3 p) const;
+    // The same lookup without the exception: std::nullopt if there is no
+    // Chunk there. For many nearby queries, use a BlockAccessor instead.
+    std::optional<BlockType> tryGetBlockAt(int x, int y, int z) const;
     // Given a world-space coordinate (which may have negative
     // values) set the block at that point in space to the
     // given type.
     void setBlockAt(int x, int y, int z, BlockType t);
 
+    // Bulk versions of the above for boxes of blocks. They work one chunk
+    // at a time, copying whole x-rows straight from or into its blocks.
+    // Buffers are laid out as in BlockBox::indexOf().
+    // Reads every block of the box into out. Blocks of unloaded chunks
+    // or outside [0, 256) in y read as EMPTY; returns false if any
+    // chunk was unloaded.
+    bool readRegion(const BlockBox &box, std::vector<BlockType> &out) const;
+    // Writes every block of the box from blocks, skipping unloaded chunks.
+    // Only the sections that actually change are marked dirty. Returns the
+    // chunks whose meshes are now out of date, including neighbors whose
+    // border faces the edit exposed or hid.
+    std::vector<Chunk*> writeRegion(const BlockBox &box, const std::vector<BlockType> &blocks);
+    // The same, with each block's new type given by f(x, y, z, oldType)
+    template <typename F>
+    std::vector<Chunk*> writeRegion(const BlockBox &box, F f);
+
     // Draws every Chunk that falls within the bounding box
     // described by the min and max coords, using the provided
-    // ShaderProgram
+    // ShaderProgram, with one multi-draw per MeshArena page
     void draw(int minX, int maxX, int minZ, int maxZ, ShaderProgram *shaderProgram, bool opaque);
+    // The same for a depth-only pass over the opaque Chunks, from their
+    // positions alone: merged for the shadow maps, or exactly as draw()
+    // has them for the depth prepass
+    void drawDepth(int minX, int maxX, int minZ, int maxZ, ShaderProgram *shaderProgram, bool shadow);
 
     // Initializes the Chunks that store the 64 x 256 x 64 block scene you
     // see when the base code is run.
@@ -114,13 +262,22 @@ public:
     void createChunkBlockData(Chunk* c);
 
     // Multithreading for terrain update
-    void multithreadedTerrainUpdate(glm::vec3 currentPlayerPos, glm::vec3 previousPlayerPos);
+    // look is the direction the player faces, for the ZonePredictor
+    void multithreadedTerrainUpdate(glm::vec3 currentPlayerPos, glm::vec3 previousPlayerPos, glm::vec3 look);
+    // Whether to generate zones ahead of the player's path early; on by default
+    void setZonePrediction(bool on) { m_predictZones = on; }
     std::unordered_set<int64_t> borderingZone(glm::ivec2 zone, int radius) const;
     void spawnVBOWorker(Chunk* c);
     void spawnVBOWorkers(int n);
-    void spawnBlockTypeWorker(int64_t zone);
+    // Loads or generates a zone, its jobs running before those with
+    // lower priority
+    void spawnBlockTypeWorker(int64_t zone, int priority = 0);
+    // Spawns up to n zones: the ones needed now, then predicted ones
     void spawnBlockTypeWorkers(int n);
     void bind_terrain_vbo_data(int n);
+    // Uploads a finished mesh to its chunk, or caches it if the chunk's
+    // zone is not resident
+    void uploadMesh(uPtr<ChunkOpaqueTransparentVBOData> mesh);
     void initialTerrainGeneration(glm::vec3 currentPlayerPos);
 
     float PerlinNoise2D(float x, float z, float frequency, int octaves);
@@ -134,6 +291,120 @@ public:
     void create_load_texture(const char *textureFile);
 
     // Visible distance
-    const int zoneRadius = 5;
+    static constexpr int zoneRadius = 5;
 
+private:
+    // Calls fn(chunk, lo, hi) for every loaded chunk the box overlaps,
+    // with lo and hi (exclusive) the overlap in world coordinates,
+    // already clamped to [0, 256) in y. Returns false if some chunk in
+    // the box was not loaded.
+    template <typename Fn>
+    bool forEachChunkIn(const BlockBox &box, Fn fn) const;
+    // Adds a copy of what needs saving of c to batch, if anything, and
+    // marks c saved. Cheap enough for the GUI thread: in EDITS_ONLY mode
+    // only the edits are copied.
+    void copyForSave(Chunk* c, std::vector<ChunkSave> &batch);
+    // Hands a batch to the I/O thread to be written out
+    void queueSaves(std::vector<ChunkSave> batch, const char* reason);
+    // Saves every dirty chunk under reason; returns how many
+    int saveDirty(const char* reason);
+    // Starts an autosave when one is due. While earlier saves are still
+    // being written it waits, so edits keep merging into fewer writes.
+    void autosaveIfDue();
+    // Moves the resident zones to those around the player, evicting and
+    // restoring meshes to match
+    void updateResidency(glm::ivec2 playerZone);
+    // Takes the meshes of a zone off the GPU, into m_residency's cache
+    void evictZone(int64_t zone);
+    // Takes the mesh of c off the GPU, and starts reading it back for
+    // m_residency's cache
+    void evictChunk(Chunk* c);
+    // Caches the evicted meshes that have been read back. With key, also
+    // that of the chunk at key, waiting for it if need be.
+    void collectEvictedMeshes(std::optional<int64_t> key = std::nullopt);
+    // Puts back the meshes of a generated zone that was evicted: from the
+    // cache if still up to date, else by meshing the chunks again
+    void restoreZone(int64_t zone);
+    // Uploads the cached mesh of c if still up to date, else queues c to
+    // be meshed again
+    void restoreChunk(Chunk* c);
+    // Evicts the meshes farthest from the player while over the GPU
+    // budget, and brings back the nearest over-budget ones when there is
+    // room, or when they are well nearer than the farthest mesh uploaded
+    void enforceGpuBudget();
 };
+
+// Every chunk within zoneRadius of the player must fall in m_chunkGrid's window,
+// or findChunk() quietly falls back to m_chunks. Loaded zones reach
+// 4 * zoneRadius + 3 chunks either side of the player's chunk, and the
+// window's centre may lag the player by SLACK chunks.
+static_assert(4 * Terrain::zoneRadius + 3 + ChunkGrid::SLACK <= ChunkGrid::SIZE / 2 - 1,
+              "ChunkGrid::SIZE is too small for Terrain::zoneRadius");
+
+template <typename Fn>
+bool Terrain::forEachChunkIn(const BlockBox &box, Fn fn) const
+{
+    bool complete = true;
+    int yLo = std::max(box.min.y, 0), yHi = std::min(box.max.y, 256);
+    if (box.volume() == 0 || yLo >= yHi) {
+        return complete;
+    }
+    for (int cz = ChunkGrid::chunkCoord(box.min.z); cz <= ChunkGrid::chunkCoord(box.max.z - 1); cz++) {
+        for (int cx = ChunkGrid::chunkCoord(box.min.x); cx <= ChunkGrid::chunkCoord(box.max.x - 1); cx++) {
+            Chunk* c = findChunk(16 * cx, 16 * cz);
+            if (c == nullptr) {
+                complete = false;
+                continue;
+            }
+            glm::ivec3 lo(std::max(box.min.x, 16 * cx), yLo, std::max(box.min.z, 16 * cz));
+            glm::ivec3 hi(std::min(box.max.x, 16 * cx + 16), yHi, std::min(box.max.z, 16 * cz + 16));
+            fn(c, lo, hi);
+        }
+    }
+    return complete;
+}
+
+template <typename F>
+std::vector<Chunk*> Terrain::writeRegion(const BlockBox &box, F f)
+{
+    std::vector<Chunk*> remesh;
+    auto needsRemesh = [&remesh](Chunk* c) {
+        if (c != nullptr && std::find(remesh.begin(), remesh.end(), c) == remesh.end()) {
+            remesh.push_back(c);
+        }
+    };
+
+    forEachChunkIn(box, [&](Chunk* c, glm::ivec3 lo, glm::ivec3 hi) {
+        int changedYMin = 256, changedYMax = -1;
+        bool edge[4] = {false, false, false, false}; // x = 0, x = 15, z = 0, z = 15
+        for (int z = lo.z; z < hi.z; z++) {
+            for (int y = lo.y; y < hi.y; y++) {
+                BlockType* row = &c->m_blocks[16 * y + 4096 * (z & 15)];
+                for (int x = lo.x; x < hi.x; x++) {
+                    BlockType t = f(x, y, z, row[x & 15]);
+                    if (t == row[x & 15]) {
+                        continue;
+                    }
+                    row[x & 15] = t;
+                    c->recordEdit(x & 15, y, z & 15);
+                    changedYMin = std::min(changedYMin, y);
+                    changedYMax = std::max(changedYMax, y);
+                    edge[0] |= (x & 15) == 0;
+                    edge[1] |= (x & 15) == 15;
+                    edge[2] |= (z & 15) == 0;
+                    edge[3] |= (z & 15) == 15;
+                }
+            }
+        }
+        if (changedYMax < 0) {
+            return;
+        }
+        c->markDirty(changedYMin, changedYMax);
+        needsRemesh(c);
+        if (edge[0]) needsRemesh(c->getNeighbor(XNEG));
+        if (edge[1]) needsRemesh(c->getNeighbor(XPOS));
+        if (edge[2]) needsRemesh(c->getNeighbor(ZNEG));
+        if (edge[3]) needsRemesh(c->getNeighbor(ZPOS));
+    });
+    return remesh;
+}
@@ -0,0 +1,86 @@
+#include "zonepredictor.h"
+#include "terrain.h"
+#include <algorithm>
+#include <unordered_set>
+
+namespace {
+
+glm::ivec2 zoneOf(glm::vec2 p) {
+    return glm::ivec2(64.f * glm::floor(p / 64.f));
+}
+
+} // namespace
+
+ZonePredictor::ZonePredictor()
+    : m_position(0.f), m_velocity(0.f), m_look(0.f), m_started(false)
+{}
+
+void ZonePredictor::update(glm::vec3 position, glm::vec3 lastPosition, glm::vec3 look)
+{
+    glm::vec2 step(position.x - lastPosition.x, position.z - lastPosition.z);
+    // A jump of more than a zone in one tick is a teleport, not movement
+    if (!m_started || glm::length(step) > 64.f) {
+        m_velocity = glm::vec2(0.f);
+        m_started = true;
+    } else {
+        m_velocity = glm::mix(m_velocity, step, SMOOTHING);
+    }
+    m_position = glm::vec2(position.x, position.z);
+    glm::vec2 lookXZ(look.x, look.z);
+    m_look = glm::length(lookXZ) > 1e-4f ? glm::normalize(lookXZ) : glm::vec2(0.f);
+}
+
+void ZonePredictor::reset()
+{
+    m_velocity = glm::vec2(0.f);
+    m_started = false;
+}
+
+std::vector<int64_t> ZonePredictor::predict(int radius) const
+{
+    std::vector<int64_t> zones;
+    float speed = glm::length(m_velocity);
+    float distance = speed * LOOKAHEAD_TICKS;
+    // Not going to leave the zone in time for it to matter
+    if (distance < 32.f) {
+        return zones;
+    }
+
+    glm::vec2 dir = m_velocity / speed;
+    if (glm::dot(m_look, dir) > 0.f) {
+        dir = glm::normalize(glm::mix(dir, m_look, LOOK_WEIGHT));
+    }
+
+    glm::ivec2 current = zoneOf(m_position);
+    auto nearPlayer = [&](glm::ivec2 zone) {
+        glm::ivec2 d = glm::abs(zone - current) / 64;
+        return std::max(d.x, d.y) <= radius;
+    };
+
+    // Walk the path half a zone at a time. The zones each point brings
+    // into range are queued nearest the path first.
+    std::unordered_set<int64_t> seen;
+    std::vector<std::pair<float, glm::ivec2>> ring;
+    for (float d = 32.f; d <= distance; d += 32.f) {
+        glm::vec2 p = m_position + dir * d;
+        glm::ivec2 center = zoneOf(p);
+        ring.clear();
+        for (int dz = -radius; dz <= radius; dz++) {
+            for (int dx = -radius; dx <= radius; dx++) {
+                glm::ivec2 zone = center + 64 * glm::ivec2(dx, dz);
+                if (!nearPlayer(zone) && seen.insert(toKey(zone.x, zone.y)).second) {
+                    ring.push_back({glm::length(glm::vec2(zone) + 32.f - p), zone});
+                }
+            }
+        }
+        std::sort(ring.begin(), ring.end(),
+                  [](const auto &a, const auto &b) { return a.first < b.first; });
+        for (const auto &r : ring) {
+            zones.push_back(toKey(r.second.x, r.second.y));
+            if (static_cast<int>(zones.size()) == MAX_ZONES) {
+                return zones;
+            }
+        }
+    }
+    return zones;
+}
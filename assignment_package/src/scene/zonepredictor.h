@@ -0,0 +1,42 @@
+#pragma once
+#include "glm_includes.h"
+#include <vector>
+#include <cstdint>
+
+// Guesses which terrain generation zones the player is about to need,
+// so that Terrain can start on them before the player's zone changes.
+//
+// It follows the player's horizontal velocity, smoothed over a few
+// ticks and bent a little towards where they look, for LOOKAHEAD_TICKS.
+// Every zone within the load radius of a point along that path, but not
+// of the player now, is a prediction, the ones needed soonest first.
+// Predictions are made afresh every tick, so a change of course simply
+// drops the old ones.
+class ZonePredictor {
+public:
+    // Two seconds of MyGL's 60 ticks per second
+    static constexpr int LOOKAHEAD_TICKS = 120;
+    static constexpr int MAX_ZONES = 64;
+    // How far the look direction pulls the path, when roughly ahead
+    static constexpr float LOOK_WEIGHT = 0.25f;
+    // Weight of the newest tick in the smoothed velocity
+    static constexpr float SMOOTHING = 0.2f;
+
+    ZonePredictor();
+
+    // Feeds one tick of movement: the player's position now and a tick
+    // ago, and the direction they look in
+    void update(glm::vec3 position, glm::vec3 lastPosition, glm::vec3 look);
+    // Forgets the movement so far, e.g. after a teleport
+    void reset();
+    // Keys of the zones, within radius zones of the path ahead, that are
+    // not within radius zones of the player yet, soonest needed first
+    std::vector<int64_t> predict(int radius) const;
+
+private:
+    glm::vec2 m_position;
+    // Blocks per tick, in x and z
+    glm::vec2 m_velocity;
+    glm::vec2 m_look;
+    bool m_started;
+};
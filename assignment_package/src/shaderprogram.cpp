@@ -5,17 +5,18 @@
 #include <QDebug>
 #include <stdexcept>
 #include <iostream>
+#include <cstddef>
 
-
+static_assert(sizeof(PerFrameUniforms) == 368, "PerFrameUniforms must match the std140 PerFrame block");
 
 ShaderProgram::ShaderProgram(OpenGLContext *context)
     : vertShader(), fragShader(), prog(),
     attrPos(-1), attrNor(-1), attrCol(-1), attrUV(-1), attrUVFrameBuffer(-1),
     unifModel(-1), unifModelInvTr(-1), unifViewProj(-1), unifColor(-1),
-    unifLightSpaceMatrix(-1), unifLightDirection(-1), unifEffectType(-1),
-    unifSampler2D(-1), unifSamplerFrameBuffer(-1),
+    unifLightSpaceMatrix(-1), unifLightDirection(-1), unifCascade(-1), unifEffectType(-1),
+    unifSampler2D(-1), unifSamplerFrameBuffer(-1), unifDepthTexture(-1), unifShadowMappingDepth(-1),
     unifTime(-1), unifCameraPos(-1),unifScreenSize(-1),
-      context(context)
+      m_nullIndices(), context(context)
 {}
 
 void ShaderProgram::create(const char *vertfile, const char *fragfile)
@@ -81,9 +82,12 @@ void ShaderProgram::create(const char *vertfile, const char *fragfile)
     unifEffectType = context->glGetUniformLocation(prog, "u_EffectType");
     unifLightSpaceMatrix = context->glGetUniformLocation(prog, "u_LightSpaceMatrix");
     unifLightDirection = context->glGetUniformLocation(prog, "u_LightDirection");
+    unifCascade = context->glGetUniformLocation(prog, "u_Cascade");
 
     unifSampler2D  = context->glGetUniformLocation(prog, "u_Texture");
     unifSamplerFrameBuffer = context->glGetUniformLocation(prog, "u_RenderedTexture");
+    unifDepthTexture = context->glGetUniformLocation(prog, "u_DepthTexture");
+    unifShadowMappingDepth = context->glGetUniformLocation(prog, "u_ShadowMappingDepth");
     unifTime = context->glGetUniformLocation(prog, "u_Time");
     unifCameraPos = context->glGetUniformLocation(prog, "u_CameraPos");
 
@@ -91,9 +95,55 @@ void ShaderProgram::create(const char *vertfile, const char *fragfile)
     unifEye = context->glGetUniformLocation(prog, "u_Eye");
 
     unifScreenSize = context->glGetUniformLocation(prog, "u_ScreenSize");
+
+    // Per-frame values come from the uniform buffer at PER_FRAME_BINDING
+    GLuint perFrame = context->glGetUniformBlockIndex(prog, "PerFrame");
+    if (perFrame != GL_INVALID_INDEX) {
+        context->glUniformBlockBinding(prog, perFrame, PER_FRAME_BINDING);
+        checkPerFrameLayout(perFrame);
+    }
     context->printGLErrorLog();
 }
 
+bool ShaderProgram::checkPerFrameLayout(GLuint block)
+{
+    // Every member of the block, and where PerFrameUniforms has it.
+    // Members of a std140 block are active whether or not they are used.
+    static const char* names[] = {"u_ViewProj", "u_Cascades[0]", "u_LightDirection", "u_height",
+                                  "u_CameraPos", "u_Time", "u_ScreenSize", "u_CascadeCount"};
+    static const size_t offsets[] = {
+        offsetof(PerFrameUniforms, viewProj), offsetof(PerFrameUniforms, cascades),
+        offsetof(PerFrameUniforms, lightDirection), offsetof(PerFrameUniforms, height),
+        offsetof(PerFrameUniforms, cameraPos), offsetof(PerFrameUniforms, time),
+        offsetof(PerFrameUniforms, screenSize), offsetof(PerFrameUniforms, cascadeCount)};
+    const GLsizei count = sizeof(names) / sizeof(names[0]);
+
+    bool matches = true;
+    GLint size = 0;
+    context->glGetActiveUniformBlockiv(prog, block, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+    if (size > static_cast<GLint>(sizeof(PerFrameUniforms))) {
+        qDebug() << "PerFrame block is" << size << "bytes, PerFrameUniforms only" << sizeof(PerFrameUniforms);
+        matches = false;
+    }
+    GLuint indices[count];
+    GLint driverOffsets[count];
+    context->glGetUniformIndices(prog, count, names, indices);
+    for (GLsizei i = 0; i < count; i++) {
+        if (indices[i] == GL_INVALID_INDEX) {
+            qDebug() << "PerFrame block has no" << names[i];
+            matches = false;
+            continue;
+        }
+        context->glGetActiveUniformsiv(prog, 1, &indices[i], GL_UNIFORM_OFFSET, &driverOffsets[i]);
+        if (static_cast<size_t>(driverOffsets[i]) != offsets[i]) {
+            qDebug() << "PerFrame member" << names[i] << "is at" << driverOffsets[i]
+                     << "but PerFrameUniforms has it at" << offsets[i];
+            matches = false;
+        }
+    }
+    return matches;
+}
+
 void ShaderProgram::useMe()
 {
     context->glUseProgram(prog);
@@ -222,7 +272,43 @@ void ShaderProgram::seteffectType(const int type)
     }
 }
 
-void ShaderProgram::drawInterleaved(Drawable *d, bool opaque, int textureSlot)
+void ShaderProgram::setCascade(int cascade)
+{
+    useMe();
+    if(unifCascade != -1)
+    {
+        context->glUniform1i(unifCascade, cascade);
+    }
+}
+
+void ShaderProgram::setDepthTextureSlot(int slot)
+{
+    useMe();
+    if(unifDepthTexture != -1)
+    {
+        context->glUniform1i(unifDepthTexture, slot);
+    }
+}
+
+void ShaderProgram::setShadowMappingDepthSlot(int slot)
+{
+    useMe();
+    if(unifShadowMappingDepth != -1)
+    {
+        context->glUniform1i(unifShadowMappingDepth, slot);
+    }
+}
+
+void ShaderProgram::setRenderedTextureSlot(int slot)
+{
+    useMe();
+    if(unifSamplerFrameBuffer != -1)
+    {
+        context->glUniform1i(unifSamplerFrameBuffer, slot);
+    }
+}
+
+int ShaderProgram::drawInterleaved(Drawable *d, bool opaque, int textureSlot)
 {
     useMe();
 
@@ -297,6 +383,99 @@ void ShaderProgram::drawInterleaved(Drawable *d, bool opaque, int textureSlot)
     if (attrUV != -1) context->glDisableVertexAttribArray(attrUV);
 
     context->printGLErrorLog();
+    // Program, buffers, draw and error check, and three per attribute
+    int attribs = (attrPos != -1) + (attrNor != -1) + (attrUV != -1);
+    return 5 + (unifSampler2D != -1) + 3 * attribs;
+}
+
+int ShaderProgram::drawInterleavedMulti(GLuint vbo, GLuint ibo, const std::vector<GLsizei> &counts,
+                                        const std::vector<GLint> &baseVertices, int textureSlot,
+                                        bool positionsOnly)
+{
+    useMe();
+
+    if(unifSampler2D != -1)
+    {
+        context->glUniform1i(unifSampler2D, /*GL_TEXTURE*/textureSlot);
+    }
+
+    context->glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    int attribs = setInterleavedAttribs(positionsOnly);
+
+    // Every mesh starts at the beginning of the shared index buffer
+    m_nullIndices.resize(counts.size(), nullptr);
+    context->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    int draws = context->multiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, m_nullIndices.data(),
+                                                     static_cast<GLsizei>(counts.size()), baseVertices.data());
+
+    if (attrPos != -1) context->glDisableVertexAttribArray(attrPos);
+    if (attrNor != -1) context->glDisableVertexAttribArray(attrNor);
+    if (attrUV != -1) context->glDisableVertexAttribArray(attrUV);
+
+    context->printGLErrorLog();
+    return 4 + (unifSampler2D != -1) + 3 * attribs + draws;
+}
+
+int ShaderProgram::drawMulti(const std::vector<GLsizei> &counts, const std::vector<GLint> &baseVertices,
+                             int textureSlot)
+{
+    useMe();
+
+    if(unifSampler2D != -1)
+    {
+        context->glUniform1i(unifSampler2D, /*GL_TEXTURE*/textureSlot);
+    }
+
+    m_nullIndices.resize(counts.size(), nullptr);
+    int draws = context->multiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, m_nullIndices.data(),
+                                                     static_cast<GLsizei>(counts.size()), baseVertices.data());
+
+    context->printGLErrorLog();
+    return 2 + (unifSampler2D != -1) + draws;
+}
+
+GLuint ShaderProgram::createInterleavedVAO(GLuint vbo, GLuint ibo, bool positionsOnly)
+{
+    GLuint vao;
+    context->glGenVertexArrays(1, &vao);
+    context->glBindVertexArray(vao);
+    context->glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    setInterleavedAttribs(positionsOnly);
+    context->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    return vao;
+}
+
+int ShaderProgram::setInterleavedAttribs(bool positionsOnly)
+{
+    if (positionsOnly)
+    {
+        // w is left to default to 1
+        if (attrPos == -1)
+            return 0;
+        context->glEnableVertexAttribArray(attrPos);
+        context->glVertexAttribPointer(attrPos, 3, GL_FLOAT, false, sizeof(glm::vec3), (void*)(0));
+        return 1;
+    }
+    int attribs = 0;
+    if (attrPos != -1)
+    {
+        context->glEnableVertexAttribArray(attrPos);
+        context->glVertexAttribPointer(attrPos, 4, GL_FLOAT, false, sizeof(glm::vec4) * 3, (void*)(0));
+        attribs++;
+    }
+    if (attrNor != -1)
+    {
+        context->glEnableVertexAttribArray(attrNor);
+        context->glVertexAttribPointer(attrNor, 4, GL_FLOAT, false, sizeof(glm::vec4) * 3, (void*)(sizeof(glm::vec4)));
+        attribs++;
+    }
+    if (attrUV != -1)
+    {
+        context->glEnableVertexAttribArray(attrUV);
+        context->glVertexAttribPointer(attrUV, 4, GL_FLOAT, false, sizeof(glm::vec4) * 3, (void*)(2 * sizeof(glm::vec4)));
+        attribs++;
+    }
+    return attribs;
 }
 
 
@@ -4,13 +4,35 @@
 #include <openglcontext.h>
 #include <glm_includes.h>
 #include <glm/glm.hpp>
+#include <vector>
 
 #include "drawable.h"
+#include "shadowcascades.h"
 
 
+// Values shared by the terrain programs that change once a frame, laid out
+// as the std140 PerFrame uniform block of their shaders. MyGL uploads them
+// to one uniform buffer a frame instead of setting each program's uniforms.
+struct PerFrameUniforms
+{
+    glm::mat4 viewProj;
+    // The light's view-projection of each shadow cascade, nearest first
+    glm::mat4 cascades[ShadowCascades::MAX_CASCADES];
+    glm::vec3 lightDirection;
+    float height;      // of the player above the ground, for shadow filtering
+    glm::vec3 cameraPos;
+    int time;
+    glm::vec2 screenSize;
+    int cascadeCount;
+    int padding;       // std140 may round the block up to a whole vec4
+};
+
 class ShaderProgram
 {
 public:
+    // The uniform buffer binding create() points every PerFrame block at
+    static constexpr GLuint PER_FRAME_BINDING = 0;
+
     GLuint vertShader; // A handle for the vertex shader stored in this shader program
     GLuint fragShader; // A handle for the fragment shader stored in this shader program
     GLuint prog;       // A handle for the linked shader program stored in this class
@@ -28,10 +50,13 @@ public:
     int unifColor; // A handle for the "uniform" vec4 representing color of geometry in the vertex shader
     int unifLightSpaceMatrix;  // for spacial transformation in light space
     int unifLightDirection;  // for vec3 light direction
+    int unifCascade; // the shadow cascade to draw depth for, -1 for the camera
 
     int unifEffectType;
     int unifSampler2D; // A handle to the "uniform" sampler2D that will be used to read the texture containing the scene render
     int unifSamplerFrameBuffer;
+    int unifDepthTexture; // depth of the scene from the camera, for edges
+    int unifShadowMappingDepth;
     int unifTime; // A handle for the "uniform" float representing time in the shader
     int unifCameraPos; // A handle for the "uniform" vec3 representing the camera position in the shader
 
@@ -55,6 +80,11 @@ public:
     // Pass the given color to this shader on the GPU
     void setGeometryColor(glm::vec4 color);
     void seteffectType(const int type);
+    void setCascade(int cascade);
+    // Point the samplers at texture slots; these only need setting once
+    void setDepthTextureSlot(int slot);
+    void setShadowMappingDepthSlot(int slot);
+    void setRenderedTextureSlot(int slot);
     // Draw the given object to our screen using this ShaderProgram's shaders
     void drawSkybox(Drawable &d);
     // Draw the given object to our screen multiple times using instanced rendering
@@ -66,8 +96,26 @@ public:
     // Utility function that prints any shader linking errors to the console
     void printLinkInfoLog(int prog);
 
-    // Draw objects using interleaved buffer
-    void drawInterleaved(Drawable *d, bool opaque, int textureSlot = 0);
+    // Draw objects using interleaved buffer.
+    // These draw functions return how many GL calls they made, for Benchmark.
+    int drawInterleaved(Drawable *d, bool opaque, int textureSlot = 0);
+    // Draws many meshes from one interleaved vertex buffer in one call:
+    // mesh i is counts[i] indices from the start of ibo, offset by
+    // baseVertices[i]. See MeshArena. With positionsOnly the buffer holds
+    // nothing but a vec3 position per vertex.
+    int drawInterleavedMulti(GLuint vbo, GLuint ibo, const std::vector<GLsizei> &counts,
+                             const std::vector<GLint> &baseVertices, int textureSlot = 0,
+                             bool positionsOnly = false);
+    // The same with the buffers and attributes already in a VAO, made by
+    // createInterleavedVAO() and bound by the caller
+    int drawMulti(const std::vector<GLsizei> &counts, const std::vector<GLint> &baseVertices,
+                  int textureSlot = 0);
+    // Makes a VAO that feeds this program interleaved vertices from vbo and
+    // indices from ibo, and leaves it bound. It serves every program with
+    // the same interleavedLayout(). positionsOnly as for drawInterleavedMulti().
+    GLuint createInterleavedVAO(GLuint vbo, GLuint ibo, bool positionsOnly = false);
+    // Where this program reads position, normal and UV, -1 for unused
+    glm::ivec3 interleavedLayout() const { return glm::ivec3(attrPos, attrNor, attrUV); }
     void drawEffect(Drawable &d);
 
 
@@ -80,6 +128,17 @@ public:
     void setScreenSize(const glm::vec2 &screenSize);
 
 private:
+    // Compares PerFrameUniforms with the size and member offsets the
+    // driver gives the PerFrame block of this program, and prints any
+    // difference. Returns whether they match.
+    bool checkPerFrameLayout(GLuint block);
+    // Points the attributes of this program at the interleaved vertices of
+    // the bound GL_ARRAY_BUFFER, or just its position at the vec3s of one
+    // holding positions only. Returns the number of attributes.
+    int setInterleavedAttribs(bool positionsOnly = false);
+
+    // As many null index offsets as the last drawInterleavedMulti() drew
+    std::vector<const void*> m_nullIndices;
     OpenGLContext* context;   // Since Qt's OpenGL support is done through classes like QOpenGLFunctions_3_2_Core,
                             // we need to pass our OpenGL context to the Drawable in order to call GL functions
                             // from within this class.
@@ -0,0 +1,125 @@
+#include "shadowcascades.h"
+#include <algorithm>
+#include <cmath>
+
+// lookAt() needs an up that is not along the light
+static glm::vec3 lightUp(glm::vec3 lightDir)
+{
+    return std::abs(lightDir.y) > 0.999f ? glm::vec3(0.f, 0.f, 1.f) : glm::vec3(0.f, 1.f, 0.f);
+}
+
+ShadowCascades::ShadowCascades(int count, int resolution, float distance)
+    : m_count(glm::clamp(count, 1, MAX_CASCADES)), m_resolution(resolution), m_distance(distance),
+      m_cascades(), m_stats{0, 0}
+{
+    for (Cascade &c : m_cascades) {
+        c.lightDir = glm::vec3(0.f, 1.f, 0.f);
+        c.stale = true;
+    }
+}
+
+void ShadowCascades::fit(const glm::mat4 &viewProj, float nearClip, float farClip, glm::vec3 lightDir)
+{
+    // The corners of the camera's near and far planes. A point at some
+    // depth in the view is the same share of the way from one to the
+    // other along each edge of the frustum.
+    glm::mat4 invViewProj = glm::inverse(viewProj);
+    glm::vec3 nearCorners[4], farCorners[4];
+    for (int c = 0; c < 4; c++) {
+        glm::vec2 xy(c & 1 ? 1.f : -1.f, c & 2 ? 1.f : -1.f);
+        glm::vec4 n = invViewProj * glm::vec4(xy, -1.f, 1.f);
+        glm::vec4 f = invViewProj * glm::vec4(xy, 1.f, 1.f);
+        nearCorners[c] = glm::vec3(n) / n.w;
+        farCorners[c] = glm::vec3(f) / f.w;
+    }
+
+    lightDir = glm::normalize(lightDir);
+    float minLightCos = std::cos(glm::radians(MAX_LIGHT_ANGLE));
+
+    float end = std::min(m_distance, farClip);
+    float sliceNear = nearClip;
+    for (int i = 0; i < m_count; i++) {
+        float share = (i + 1) / static_cast<float>(m_count);
+        float logSplit = nearClip * std::pow(end / nearClip, share);
+        float uniformSplit = nearClip + (end - nearClip) * share;
+        float sliceFar = glm::mix(uniformSplit, logSplit, SPLIT_LAMBDA);
+
+        glm::vec3 corners[8];
+        glm::vec3 centre(0.f);
+        for (int c = 0; c < 4; c++) {
+            corners[c] = glm::mix(nearCorners[c], farCorners[c], (sliceNear - nearClip) / (farClip - nearClip));
+            corners[c + 4] = glm::mix(nearCorners[c], farCorners[c], (sliceFar - nearClip) / (farClip - nearClip));
+            centre += corners[c] + corners[c + 4];
+        }
+        centre /= 8.f;
+        float radius = 0.f;
+        for (const glm::vec3 &corner : corners) {
+            radius = std::max(radius, glm::length(corner - centre));
+        }
+        sliceNear = sliceFar;
+        m_stats.cascadeFrames++;
+
+        // Keep the cascade while the slice is still inside what it covers,
+        // seen from the light it was drawn for
+        Cascade &cascade = m_cascades[i];
+        if (!cascade.stale && glm::dot(lightDir, cascade.lightDir) >= minLightCos) {
+            glm::mat3 rotation(glm::lookAt(glm::vec3(0.f), -cascade.lightDir, lightUp(cascade.lightDir)));
+            glm::vec3 offset = rotation * (centre - glm::vec3(cascade.bounds));
+            if (glm::length(glm::vec2(offset)) + radius <= cascade.bounds.w) {
+                continue;
+            }
+        }
+
+        // Whole blocks, so that rounding does not change it from frame
+        // to frame
+        radius = std::ceil(radius * (1.f + PADDING));
+
+        glm::vec3 up = lightUp(lightDir);
+        glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.f), -lightDir, up);
+        float texel = 2.f * radius / m_resolution;
+        glm::vec3 lightCentre(lightRotation * glm::vec4(centre, 1.f));
+        lightCentre.x = std::floor(lightCentre.x / texel) * texel;
+        lightCentre.y = std::floor(lightCentre.y / texel) * texel;
+        centre = glm::vec3(glm::inverse(lightRotation) * glm::vec4(lightCentre, 1.f));
+
+        glm::mat4 view = glm::lookAt(centre + lightDir * LIGHT_DISTANCE, centre, up);
+        glm::mat4 proj = glm::ortho(-radius, radius, -radius, radius, 0.1f, 2.f * LIGHT_DISTANCE);
+        cascade.matrix = proj * view;
+        cascade.bounds = glm::vec4(centre, radius);
+        cascade.lightDir = lightDir;
+        cascade.stale = true;
+    }
+}
+
+void ShadowCascades::invalidate(glm::ivec2 corner)
+{
+    for (int i = 0; i < m_count; i++) {
+        glm::ivec4 b = casterBounds(i);
+        if (corner.x + 16 > b[0] && corner.x < b[1] && corner.y + 16 > b[2] && corner.y < b[3]) {
+            m_cascades[i].stale = true;
+        }
+    }
+}
+
+void ShadowCascades::markDrawn(int i)
+{
+    m_cascades[i].stale = false;
+    m_stats.drawn++;
+}
+
+glm::ivec4 ShadowCascades::casterBounds(int i) const
+{
+    glm::vec4 b = m_cascades[i].bounds;
+    glm::vec3 lightDir = m_cascades[i].lightDir;
+    // Casters lie anywhere from the sphere up towards the light, until
+    // either MAX_CASTER_HEIGHT or the start of the light's view
+    float climb = std::max(0.f, MAX_CASTER_HEIGHT - (b.y - b.w));
+    float along = lightDir.y > 0.f ? std::min(climb / lightDir.y, LIGHT_DISTANCE) : LIGHT_DISTANCE;
+    glm::vec2 reach = glm::vec2(lightDir.x, lightDir.z) * along;
+    glm::vec2 lo = glm::vec2(b.x, b.z) - b.w + glm::min(reach, glm::vec2(0.f));
+    glm::vec2 hi = glm::vec2(b.x, b.z) + b.w + glm::max(reach, glm::vec2(0.f));
+    // Out to whole chunks, as Terrain::draw() steps a chunk at a time
+    glm::ivec2 lo16 = glm::ivec2(glm::floor(lo / 16.f)) * 16;
+    glm::ivec2 hi16 = glm::ivec2(glm::ceil(hi / 16.f)) * 16;
+    return glm::ivec4(lo16.x, hi16.x, lo16.y, hi16.y);
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "glm_includes.h"
+
+// Fits the shadow maps of cascaded shadow mapping. The camera's view out
+// to distance is cut into count slices, short near the camera and longer
+// further away, and each gets a resolution square shadow map of its own
+// with the light's orthographic view fitted around it. The shadows close
+// to the player thus get most of the texels, from much less memory than
+// one map over the whole view would need.
+//
+// Each slice is fitted with the sphere around it, which is the same size
+// whichever way the camera turns, and its centre is snapped to whole
+// texels of the light's view, so that shadow edges do not shimmer as the
+// camera moves.
+//
+// The shadow maps are cached. A cascade covers PADDING more than its
+// slice, and is only fitted and drawn again once the slice leaves what it
+// covers, the light has turned more than MAX_LIGHT_ANGLE since it was
+// drawn, or a chunk that can cast a shadow into it changed.
+class ShadowCascades {
+public:
+    // The most cascades there can be, as sized in the shaders
+    static constexpr int MAX_CASCADES = 4;
+    // Between the uniform split, 0, and the logarithmic one, 1
+    static constexpr float SPLIT_LAMBDA = 0.75f;
+    // How far the light's view starts towards the light from the middle
+    // of a cascade. Its depth covers twice that, as the one shadow map
+    // before did, so that the depth bias of the shaders still fits.
+    static constexpr float LIGHT_DISTANCE = 500.f;
+    // Share of its slice's radius a cascade covers beyond it
+    static constexpr float PADDING = 0.25f;
+    // Degrees. The sun turns 0.05 degrees a tick.
+    static constexpr float MAX_LIGHT_ANGLE = 0.25f;
+
+    ShadowCascades(int count, int resolution, float distance);
+
+    // Fits the cascades that need it to the camera of viewProj, whose near
+    // and far clip planes are nearClip and farClip, for a light shining
+    // from lightDir. Call once a frame.
+    void fit(const glm::mat4 &viewProj, float nearClip, float farClip, glm::vec3 lightDir);
+    // Marks the cascades that the chunk at corner can cast a shadow into
+    // as needing to be drawn again
+    void invalidate(glm::ivec2 corner);
+    // Whether the shadow map of cascade i is out of date
+    bool isStale(int i) const { return m_cascades[i].stale; }
+    // Call once the shadow map of cascade i has been drawn
+    void markDrawn(int i);
+
+    int count() const { return m_count; }
+    int resolution() const { return m_resolution; }
+    float distance() const { return m_distance; }
+    // The light's view-projection of cascade i
+    const glm::mat4 &matrix(int i) const { return m_cascades[i].matrix; }
+    // The world-space sphere cascade i covers, centre and radius
+    glm::vec4 bounds(int i) const { return m_cascades[i].bounds; }
+    // The xz rectangle, min x, max x, min z and max z, that anything
+    // below MAX_CASTER_HEIGHT casting a shadow into cascade i is in
+    glm::ivec4 casterBounds(int i) const;
+
+    struct Stats {
+        long long cascadeFrames; // cascades fitted, one a frame each
+        long long drawn;         // of those drawn; the rest were skipped
+    };
+    Stats stats() const { return m_stats; }
+
+private:
+    // Nothing is built above the top of the world
+    static constexpr float MAX_CASTER_HEIGHT = 256.f;
+
+    struct Cascade {
+        glm::mat4 matrix;
+        glm::vec4 bounds;
+        glm::vec3 lightDir; // it was fitted for
+        bool stale;
+    };
+
+    int m_count;
+    int m_resolution;
+    float m_distance;
+    Cascade m_cascades[MAX_CASCADES];
+    Stats m_stats;
+};
@@ -2,19 +2,33 @@ INCLUDEPATH += $$PWD
 DEPENDPATH += $$PWD
 
 SOURCES += \
+    $$PWD/benchmark.cpp \
     $$PWD/framebuffer.cpp \
+    $$PWD/gputimer.cpp \
     $$PWD/main.cpp \
     $$PWD/mainwindow.cpp \
     $$PWD/mygl.cpp \
+    $$PWD/scene/blockaccessor.cpp \
+    $$PWD/scene/chunkdirectory.cpp \
+    $$PWD/scene/chunkgrid.cpp \
+    $$PWD/scene/chunkmesher.cpp \
+    $$PWD/scene/chunkpool.cpp \
+    $$PWD/scene/chunkresidency.cpp \
     $$PWD/scene/chunkworkers.cpp \
+    $$PWD/scene/evictedmesh.cpp \
+    $$PWD/scene/mesharena.cpp \
+    $$PWD/scene/meshpool.cpp \
     $$PWD/scene/quad.cpp \
+    $$PWD/scene/regionfile.cpp \
     $$PWD/shaderprogram.cpp \
+    $$PWD/shadowcascades.cpp \
     $$PWD/drawable.cpp \
     $$PWD/cameracontrolshelp.cpp \
     $$PWD/scene/cube.cpp \
     $$PWD/openglcontext.cpp \
     $$PWD/scene/terrain.cpp \
     $$PWD/scene/worldaxes.cpp \
+    $$PWD/scene/zonepredictor.cpp \
     $$PWD/scene/entity.cpp \
     $$PWD/scene/player.cpp \
     $$PWD/scene/camera.cpp \
@@ -23,19 +37,34 @@ SOURCES += \
     $$PWD/texture.cpp
 
 HEADERS += \
+    $$PWD/benchmark.h \
     $$PWD/framebuffer.h \
+    $$PWD/gputimer.h \
     $$PWD/mainwindow.h \
     $$PWD/mygl.h \
+    $$PWD/scene/blockaccessor.h \
+    $$PWD/scene/blockregistry.h \
+    $$PWD/scene/chunkdirectory.h \
+    $$PWD/scene/chunkgrid.h \
     $$PWD/scene/chunkhelper.h \
+    $$PWD/scene/chunkmesher.h \
+    $$PWD/scene/chunkpool.h \
+    $$PWD/scene/chunkresidency.h \
     $$PWD/scene/chunkworkers.h \
+    $$PWD/scene/evictedmesh.h \
+    $$PWD/scene/mesharena.h \
+    $$PWD/scene/meshpool.h \
     $$PWD/scene/quad.h \
+    $$PWD/scene/regionfile.h \
     $$PWD/shaderprogram.h \
+    $$PWD/shadowcascades.h \
     $$PWD/drawable.h \
     $$PWD/cameracontrolshelp.h \
     $$PWD/scene/cube.h \
     $$PWD/openglcontext.h \
     $$PWD/scene/terrain.h \
     $$PWD/scene/worldaxes.h \
+    $$PWD/scene/zonepredictor.h \
     $$PWD/smartpointerhelp.h \
     $$PWD/glm_includes.h \
     $$PWD/scene/entity.h \